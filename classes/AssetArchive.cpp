@@ -0,0 +1,312 @@
+#include "AssetArchive.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + ASSET_ARCHIVE_ALIGNMENT - 1) & ~(uint64_t)(ASSET_ARCHIVE_ALIGNMENT - 1);
+}
+
+static uint64_t hashName(const std::string& name) {
+	return hashBytes(name.data(), name.size());
+}
+
+static int64_t fileTime(const std::string& path, std::error_code& error) {
+	return (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+}
+
+AssetArchive::AssetArchive() {
+	this->header = nullptr;
+	this->entries = nullptr;
+	this->names = nullptr;
+}
+
+AssetArchive& AssetArchive::get() {
+	static AssetArchive archive;
+	return archive;
+}
+
+bool AssetArchive::mount(const std::string& path, const std::string& root) {
+	this->unmount();
+	if (!this->file.open(path)) {
+		return false;
+	}
+	if (this->file.size() < sizeof(AssetArchiveHeader)) {
+		this->unmount();
+		return false;
+	}
+
+	this->header = (const AssetArchiveHeader*)this->file.data();
+	if (this->header->magic != ASSET_ARCHIVE_MAGIC || this->header->version != ASSET_ARCHIVE_VERSION) {
+		std::cout << "WARNING::ASSET_ARCHIVE::VERSION_MISMATCH " << path << std::endl;
+		this->unmount();
+		return false;
+	}
+
+	this->entries = (const AssetArchiveEntry*)(this->file.data() + sizeof(AssetArchiveHeader));
+	this->names = (const char*)(this->file.data() + this->header->names_offset);
+	if (!this->validate()) {
+		std::cout << "WARNING::ASSET_ARCHIVE::CORRUPT " << path << std::endl;
+		this->unmount();
+		return false;
+	}
+	this->root = normalizeName(root);
+	return true;
+}
+
+// Every range a lookup can touch has to lie inside the mapping, names
+// included, so find never reads past the end.
+bool AssetArchive::validate() {
+	uint64_t size = this->file.size();
+	uint64_t index_end = sizeof(AssetArchiveHeader) + (uint64_t)this->header->entry_count * sizeof(AssetArchiveEntry);
+	if (index_end > size || this->header->names_offset < index_end || this->header->names_offset + this->header->names_size > size) {
+		return false;
+	}
+	if (this->header->names_size == 0 || this->names[this->header->names_size - 1] != '\0') {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < this->header->entry_count; i++) {
+		const AssetArchiveEntry& entry = this->entries[i];
+		if (entry.offset % ASSET_ARCHIVE_ALIGNMENT != 0 || entry.offset + entry.size > size) {
+			return false;
+		}
+		if (entry.name_offset >= this->header->names_size) {
+			return false;
+		}
+		if (i > 0 && this->entries[i - 1].name_hash > entry.name_hash) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void AssetArchive::unmount() {
+	this->file.close();
+	this->header = nullptr;
+	this->entries = nullptr;
+	this->names = nullptr;
+	this->root.clear();
+}
+
+bool AssetArchive::isMounted() {
+	return this->header != nullptr;
+}
+
+unsigned int AssetArchive::getEntryCount() {
+	return this->header ? this->header->entry_count : 0;
+}
+
+std::string AssetArchive::normalizeName(const std::string& path) {
+	std::string name = std::filesystem::path(path).lexically_normal().generic_string();
+	while (name.size() > 2 && name.compare(0, 2, "./") == 0) {
+		name.erase(0, 2);
+	}
+	while (!name.empty() && name.back() == '/') {
+		name.pop_back();
+	}
+	return name;
+}
+
+std::string AssetArchive::nameFor(const std::string& path) {
+	std::string name = normalizeName(path);
+	if (this->root.empty() || this->root == ".") {
+		return name;
+	}
+	return std::filesystem::path(name).lexically_relative(this->root).generic_string();
+}
+
+const AssetArchiveEntry* AssetArchive::find(const std::string& path, unsigned int type) {
+	if (!this->header) {
+		return nullptr;
+	}
+	std::string name = this->nameFor(path);
+	uint64_t hash = hashName(name);
+
+	const AssetArchiveEntry* begin = this->entries;
+	const AssetArchiveEntry* end = this->entries + this->header->entry_count;
+	const AssetArchiveEntry* iter = std::lower_bound(begin, end, hash, [](const AssetArchiveEntry& entry, uint64_t value) {
+		return entry.name_hash < value;
+	});
+	for (; iter != end && iter->name_hash == hash; ++iter) {
+		if (iter->type == type && name == this->names + iter->name_offset) {
+			return iter;
+		}
+	}
+	return nullptr;
+}
+
+bool AssetArchive::stampSource(const std::string& path, AssetArchiveSource& source) {
+	std::memset(&source, 0, sizeof(AssetArchiveSource));
+	std::error_code error;
+	source.time = fileTime(path, error);
+	MappedFile file;
+	if (error || !file.open(path)) {
+		return false;
+	}
+	source.size = file.size();
+	source.hash = hashBytes(file.data(), file.size());
+	return true;
+}
+
+// Without its source the entry is the only copy, which is how a cooked
+// archive ships. A source that changed since cooking makes the entry stale
+// and the loader goes to the source instead.
+bool AssetArchive::isCurrent(const AssetArchiveEntry* entry, const std::string& path) {
+	std::error_code error;
+	uint64_t size = std::filesystem::file_size(path, error);
+	if (error) {
+		return true;
+	}
+	int64_t time = fileTime(path, error);
+	if (!error && size == entry->source.size && time == entry->source.time) {
+		return true;
+	}
+	AssetArchiveSource source;
+	if (size == entry->source.size && stampSource(path, source) && source.hash == entry->source.hash) {
+		return true;
+	}
+	std::cout << "WARNING::ASSET_ARCHIVE::STALE " << path << std::endl;
+	return false;
+}
+
+bool AssetArchive::loadMesh(const std::string& path, MeshCache& cache) {
+	const AssetArchiveEntry* entry = this->find(path, ASSET_ARCHIVE_MESH);
+	if (!entry || !this->isCurrent(entry, path)) {
+		return false;
+	}
+	if (!cache.open(this->file.data() + entry->offset, entry->size)) {
+		std::cout << "WARNING::ASSET_ARCHIVE::BAD_MESH " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool AssetArchive::loadTexture(const std::string& path, unsigned int flags, TextureData& image) {
+	const AssetArchiveEntry* entry = this->find(path, ASSET_ARCHIVE_TEXTURE);
+	if (!entry || entry->size < sizeof(AssetArchiveTexture) || !this->isCurrent(entry, path)) {
+		return false;
+	}
+	const unsigned char* blob = this->file.data() + entry->offset;
+	const AssetArchiveTexture* texture = (const AssetArchiveTexture*)blob;
+	if ((texture->flags & TEXTURE_FLIP_Y) != (flags & TEXTURE_FLIP_Y)) {
+		return false;
+	}
+
+	// Offsets are rebuilt exactly as buildMipChain lays them out.
+	std::vector<size_t> mip_offsets;
+	size_t level_size = (size_t)texture->width * texture->height * texture->num_components;
+	size_t mips_size = 0;
+	for (int w = texture->width, h = texture->height; w > 1 || h > 1;) {
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		mip_offsets.push_back(mips_size);
+		mips_size += (size_t)w * h * texture->num_components;
+	}
+	if (texture->mip_count != 0 && texture->mip_count != mip_offsets.size()) {
+		return false;
+	}
+	if (texture->mip_count == 0) {
+		mip_offsets.clear();
+		mips_size = 0;
+	}
+	if (sizeof(AssetArchiveTexture) + level_size > entry->size || texture->mips_offset + mips_size > entry->size) {
+		std::cout << "WARNING::ASSET_ARCHIVE::BAD_TEXTURE " << path << std::endl;
+		return false;
+	}
+
+	image.pixels = (unsigned char*)(blob + sizeof(AssetArchiveTexture));
+	image.width = (int)texture->width;
+	image.height = (int)texture->height;
+	image.num_components = (int)texture->num_components;
+	image.mip_offsets = mip_offsets;
+	image.mapped = true;
+	image.mapped_mips = blob + texture->mips_offset;
+	return true;
+}
+
+bool AssetArchive::loadText(const std::string& path, std::string& out) {
+	const AssetArchiveEntry* entry = this->find(path, ASSET_ARCHIVE_SHADER);
+	if (!entry || !this->isCurrent(entry, path)) {
+		return false;
+	}
+	out.assign((const char*)this->file.data() + entry->offset, entry->size);
+	return true;
+}
+
+bool AssetArchive::write(const std::string& path, std::vector<AssetArchiveItem>& items) {
+	for (unsigned int i = 0; i < items.size(); i++) {
+		items[i].name = normalizeName(items[i].name);
+	}
+	std::sort(items.begin(), items.end(), [](const AssetArchiveItem& a, const AssetArchiveItem& b) {
+		uint64_t hash_a = hashName(a.name);
+		uint64_t hash_b = hashName(b.name);
+		return hash_a != hash_b ? hash_a < hash_b : a.name < b.name;
+	});
+
+	AssetArchiveHeader header;
+	std::memset(&header, 0, sizeof(AssetArchiveHeader));
+	header.magic = ASSET_ARCHIVE_MAGIC;
+	header.version = ASSET_ARCHIVE_VERSION;
+	header.entry_count = (uint32_t)items.size();
+
+	std::vector<AssetArchiveEntry> entries(items.size());
+	std::string names;
+	for (unsigned int i = 0; i < items.size(); i++) {
+		entries[i].name_hash = hashName(items[i].name);
+		entries[i].type = items[i].type;
+		entries[i].name_offset = (uint32_t)names.size();
+		entries[i].size = items[i].data.size();
+		entries[i].source = items[i].source;
+		names += items[i].name;
+		names += '\0';
+	}
+	header.names_offset = sizeof(AssetArchiveHeader) + entries.size() * sizeof(AssetArchiveEntry);
+	header.names_size = (uint32_t)names.size();
+	if (names.empty()) {
+		names += '\0';
+		header.names_size = 1;
+	}
+
+	uint64_t offset = header.names_offset + header.names_size;
+	for (unsigned int i = 0; i < items.size(); i++) {
+		offset = alignOffset(offset);
+		entries[i].offset = offset;
+		offset += entries[i].size;
+	}
+
+	std::string temp_path = path + ".tmp";
+	std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cout << "ERROR::ASSET_ARCHIVE::WRITE_FAILED " << path << std::endl;
+		return false;
+	}
+
+	const char zeros[ASSET_ARCHIVE_ALIGNMENT] = { 0 };
+	out.write((const char*)&header, sizeof(AssetArchiveHeader));
+	out.write((const char*)entries.data(), entries.size() * sizeof(AssetArchiveEntry));
+	out.write(names.data(), header.names_size);
+	uint64_t written = header.names_offset + header.names_size;
+	for (unsigned int i = 0; i < items.size(); i++) {
+		out.write(zeros, entries[i].offset - written);
+		out.write((const char*)items[i].data.data(), items[i].data.size());
+		written = entries[i].offset + entries[i].size;
+	}
+	out.close();
+
+	if (!out) {
+		std::remove(temp_path.c_str());
+		std::cout << "ERROR::ASSET_ARCHIVE::WRITE_FAILED " << path << std::endl;
+		return false;
+	}
+	std::remove(path.c_str());
+	if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,114 @@
+#ifndef ASSET_ARCHIVE_H
+#define ASSET_ARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+
+#define ASSET_ARCHIVE_MAGIC 0x4B415041u // "APAK"
+// Bump whenever the layout below changes.
+#define ASSET_ARCHIVE_VERSION 2
+#define ASSET_ARCHIVE_ALIGNMENT 64
+
+// Entry types
+#define ASSET_ARCHIVE_MESH 1u
+#define ASSET_ARCHIVE_TEXTURE 2u
+#define ASSET_ARCHIVE_SHADER 3u
+
+// File layout: header, the entry index sorted by name hash, the name table,
+// then one blob per entry aligned to ASSET_ARCHIVE_ALIGNMENT. Mesh blobs are
+// mesh cache images, texture blobs an AssetArchiveTexture followed by level 0
+// and the mip chain as decodeTexture builds it, shader blobs the source text.
+struct AssetArchiveHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t names_size;
+	uint64_t names_offset;
+	uint64_t pad;
+};
+
+// File an entry was cooked from. A load whose source is still there checks
+// size and modification time, and hashes the file only when those moved.
+struct AssetArchiveSource {
+	uint64_t hash;
+	uint64_t size;
+	int64_t time;
+};
+
+struct AssetArchiveEntry {
+	uint64_t name_hash;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t type;
+	uint32_t name_offset;
+	AssetArchiveSource source;
+};
+
+struct AssetArchiveTexture {
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_components;
+	// TEXTURE_FLIP_Y if the rows were flipped when cooked
+	uint32_t flags;
+	uint32_t mip_count;
+	uint32_t pad;
+	uint64_t mips_offset;
+};
+
+// Input to AssetArchive::write, the cooker fills these.
+struct AssetArchiveItem {
+	std::string name;
+	unsigned int type;
+	std::vector<unsigned char> data;
+	AssetArchiveSource source;
+};
+
+// Read-only view of a cooked archive. Names are paths relative to the
+// directory the archive was cooked from; mount takes where that directory
+// is as seen from the working directory, so the loaders can keep asking
+// for the paths they always used. Lookups never touch the file system, the
+// loads stat the source and skip entries it has changed since.
+// Mount once before loading starts, the loaders keep pointers into it.
+class AssetArchive {
+
+	public:
+		static AssetArchive& get();
+
+		bool mount(const std::string& path, const std::string& root = ".");
+		void unmount();
+		bool isMounted();
+		unsigned int getEntryCount();
+
+		const AssetArchiveEntry* find(const std::string& path, unsigned int type);
+		bool loadMesh(const std::string& path, MeshCache& cache);
+		// Fills image with pointers into the mapping, only if the cooked rows
+		// were flipped the way flags asks for.
+		bool loadTexture(const std::string& path, unsigned int flags, TextureData& image);
+		bool loadText(const std::string& path, std::string& out);
+
+		static std::string normalizeName(const std::string& path);
+		static bool stampSource(const std::string& path, AssetArchiveSource& source);
+		static bool write(const std::string& path, std::vector<AssetArchiveItem>& items);
+
+	private:
+		MappedFile file;
+		const AssetArchiveHeader* header;
+		const AssetArchiveEntry* entries;
+		const char* names;
+		std::string root;
+
+		AssetArchive();
+		AssetArchive(const AssetArchive&);
+		AssetArchive& operator=(const AssetArchive&);
+
+		bool validate();
+		bool isCurrent(const AssetArchiveEntry* entry, const std::string& path);
+		std::string nameFor(const std::string& path);
+};
+
+#endif
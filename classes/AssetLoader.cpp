@@ -0,0 +1,116 @@
+#include "AssetLoader.h"
+
+#include <chrono>
+
+AssetLoader::AssetLoader(unsigned int num_threads) : pool(num_threads) {
+	this->uploading = ASSET_INVALID_HANDLE;
+	this->next_handle = 1;
+	this->pending = 0;
+}
+
+AssetLoader::~AssetLoader() {
+	this->clear();
+}
+
+AssetHandle AssetLoader::loadModel(Model* asset, std::string path, int loader) {
+	AssetHandle handle = this->next_handle++;
+
+	AssetJob job;
+	job.model = asset;
+	job.state = ASSET_QUEUED;
+	job.data = new ModelData();
+	this->jobs.insert(std::make_pair(handle, job));
+	this->pending++;
+
+	ModelData* data = job.data;
+	// The pool already spreads loads over its workers, a parser fanning
+	// out on top of each would start workers * cores threads.
+	this->pool.submit([this, handle, data, path, loader]() {
+		Model::prepare(path, loader, *data, 1);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->prepared.push_back(handle);
+	});
+	return handle;
+}
+
+AssetHandle AssetLoader::adopt(Model* asset) {
+	AssetHandle handle = this->next_handle++;
+
+	AssetJob job;
+	job.model = asset;
+	job.state = ASSET_READY;
+	job.data = nullptr;
+	this->jobs.insert(std::make_pair(handle, job));
+	return handle;
+}
+
+int AssetLoader::getState(AssetHandle handle) {
+	auto iter = this->jobs.find(handle);
+	if (iter == this->jobs.end()) {
+		return ASSET_FAILED;
+	}
+	return iter->second.state;
+}
+
+Model* AssetLoader::getModel(AssetHandle handle) {
+	auto iter = this->jobs.find(handle);
+	if (iter == this->jobs.end()) {
+		return nullptr;
+	}
+	return iter->second.model;
+}
+
+void AssetLoader::update(double budget_ms, std::vector<Model*>& ready) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	while (true) {
+		if (this->uploading == ASSET_INVALID_HANDLE) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->prepared.empty()) {
+				return;
+			}
+			this->uploading = this->prepared.front();
+			this->prepared.pop_front();
+		}
+
+		AssetJob& job = this->jobs[this->uploading];
+		job.state = ASSET_UPLOADING;
+		if (job.model->uploadStep(*job.data)) {
+			job.state = job.data->loaded ? ASSET_READY : ASSET_FAILED;
+			job.model->finishLoad(*job.data);
+			delete job.data;
+			job.data = nullptr;
+			ready.push_back(job.model);
+			this->uploading = ASSET_INVALID_HANDLE;
+			this->pending--;
+		}
+
+		auto now = std::chrono::high_resolution_clock::now();
+		if (std::chrono::duration<double, std::milli>(now - start).count() >= budget_ms) {
+			return;
+		}
+	}
+}
+
+unsigned int AssetLoader::getPendingCount() {
+	return this->pending;
+}
+
+void AssetLoader::clear() {
+	this->pool.wait();
+
+	for (auto iter = this->jobs.begin(); iter != this->jobs.end(); ++iter) {
+		ModelData* data = iter->second.data;
+		if (data == nullptr) {
+			continue;
+		}
+		for (unsigned int i = 0; i < data->textures.size(); i++) {
+			freeTextureData(data->textures[i]);
+		}
+		delete data;
+	}
+	this->jobs.clear();
+	this->prepared.clear();
+	this->uploading = ASSET_INVALID_HANDLE;
+	this->pending = 0;
+}
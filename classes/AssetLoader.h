@@ -0,0 +1,62 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include "Model.h"
+#include "ThreadPool.h"
+
+typedef unsigned int AssetHandle;
+
+#define ASSET_INVALID_HANDLE 0
+
+#define ASSET_QUEUED 0
+#define ASSET_UPLOADING 1
+#define ASSET_READY 2
+#define ASSET_FAILED 3
+
+// Loads models in the background. File I/O, parsing and image decoding run
+// on the pool; update() does the GL uploads on the render thread, a mesh or
+// texture at a time, until the frame's budget is spent.
+class AssetLoader {
+
+	public:
+		AssetLoader(unsigned int num_threads = 0);
+		~AssetLoader();
+
+		// asset has to be an empty Model(), it fills in once the load finishes.
+		AssetHandle loadModel(Model* asset, std::string path, int loader);
+		// Gives an already loaded model a handle so callers can treat both alike.
+		AssetHandle adopt(Model* asset);
+		int getState(AssetHandle handle);
+		Model* getModel(AssetHandle handle);
+		// Always makes some progress, so a tiny budget can't starve loading.
+		// Assets that finished during the call are appended to ready.
+		void update(double budget_ms, std::vector<Model*>& ready);
+		unsigned int getPendingCount();
+		// Waits for running jobs and forgets every asset, loaded or not.
+		void clear();
+
+	private:
+		struct AssetJob {
+			Model* model;
+			int state;
+			// Dropped once the upload finishes.
+			ModelData* data;
+		};
+
+		ThreadPool pool;
+		std::mutex mutex;
+		std::map<AssetHandle, AssetJob> jobs;
+		// Parsed on a worker, waiting for upload. Guarded by mutex.
+		std::deque<AssetHandle> prepared;
+		AssetHandle uploading;
+		AssetHandle next_handle;
+		unsigned int pending;
+};
+
+#endif
@@ -0,0 +1,397 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+BVH::BVH() : BVH(0.1f) {
+}
+
+BVH::BVH(float margin) {
+	this->root = BVH_NULL_NODE;
+	this->free_list = BVH_NULL_NODE;
+	this->leaf_count = 0;
+	this->margin = margin;
+}
+
+int BVH::allocateNode() {
+	if (this->free_list == BVH_NULL_NODE) {
+		BVHNode node;
+		node.parent = BVH_NULL_NODE;
+		node.height = -1;
+		this->nodes.push_back(node);
+		this->free_list = (int)this->nodes.size() - 1;
+	}
+
+	int node = this->free_list;
+	this->free_list = this->nodes[node].parent;
+	this->nodes[node].parent = BVH_NULL_NODE;
+	this->nodes[node].left = BVH_NULL_NODE;
+	this->nodes[node].right = BVH_NULL_NODE;
+	this->nodes[node].height = 0;
+	this->nodes[node].user_data = nullptr;
+	return node;
+}
+
+void BVH::freeNode(int node) {
+	this->nodes[node].parent = this->free_list;
+	this->nodes[node].height = -1;
+	this->free_list = node;
+}
+
+int BVH::insert(const AABB& box, void* user_data) {
+	int leaf = this->allocateNode();
+	this->nodes[leaf].box.min = box.min - glm::vec3(this->margin);
+	this->nodes[leaf].box.max = box.max + glm::vec3(this->margin);
+	this->nodes[leaf].user_data = user_data;
+	this->insertLeaf(leaf);
+	this->leaf_count++;
+	return leaf;
+}
+
+void BVH::remove(int proxy) {
+	this->removeLeaf(proxy);
+	this->freeNode(proxy);
+	this->leaf_count--;
+}
+
+bool BVH::update(int proxy, const AABB& box) {
+	if (containsAABB(this->nodes[proxy].box, box)) {
+		return false;
+	}
+
+	this->removeLeaf(proxy);
+	this->nodes[proxy].box.min = box.min - glm::vec3(this->margin);
+	this->nodes[proxy].box.max = box.max + glm::vec3(this->margin);
+	this->insertLeaf(proxy);
+	return true;
+}
+
+void BVH::clear() {
+	this->nodes.clear();
+	this->root = BVH_NULL_NODE;
+	this->free_list = BVH_NULL_NODE;
+	this->leaf_count = 0;
+}
+
+void* BVH::getUserData(int proxy) {
+	return this->nodes[proxy].user_data;
+}
+
+const AABB& BVH::getFatBounds(int proxy) {
+	return this->nodes[proxy].box;
+}
+
+int BVH::getHeight() {
+	if (this->root == BVH_NULL_NODE) {
+		return 0;
+	}
+	return this->nodes[this->root].height;
+}
+
+unsigned int BVH::getLeafCount() {
+	return this->leaf_count;
+}
+
+bool BVH::getBounds(AABB& out) {
+	if (this->root == BVH_NULL_NODE) {
+		return false;
+	}
+	out = this->nodes[this->root].box;
+	return true;
+}
+
+void BVH::insertLeaf(int leaf) {
+	if (this->root == BVH_NULL_NODE) {
+		this->root = leaf;
+		this->nodes[leaf].parent = BVH_NULL_NODE;
+		return;
+	}
+
+	// Walk down towards the sibling that grows the tree's surface area least.
+	AABB leaf_box = this->nodes[leaf].box;
+	int index = this->root;
+	while (this->nodes[index].height > 0) {
+		int left = this->nodes[index].left;
+		int right = this->nodes[index].right;
+
+		float area = surfaceArea(this->nodes[index].box);
+		float combined_area = surfaceArea(mergeAABB(this->nodes[index].box, leaf_box));
+
+		// Cost of pairing with this node, and the growth every descendant inherits.
+		float cost = 2.0f * combined_area;
+		float inheritance = 2.0f * (combined_area - area);
+
+		float cost_left = surfaceArea(mergeAABB(leaf_box, this->nodes[left].box)) + inheritance;
+		if (this->nodes[left].height > 0) {
+			cost_left -= surfaceArea(this->nodes[left].box);
+		}
+		float cost_right = surfaceArea(mergeAABB(leaf_box, this->nodes[right].box)) + inheritance;
+		if (this->nodes[right].height > 0) {
+			cost_right -= surfaceArea(this->nodes[right].box);
+		}
+
+		if (cost < cost_left && cost < cost_right) {
+			break;
+		}
+		index = cost_left < cost_right ? left : right;
+	}
+
+	int sibling = index;
+	int old_parent = this->nodes[sibling].parent;
+	int new_parent = this->allocateNode();
+	this->nodes[new_parent].parent = old_parent;
+	this->nodes[new_parent].box = mergeAABB(leaf_box, this->nodes[sibling].box);
+	this->nodes[new_parent].height = this->nodes[sibling].height + 1;
+	this->nodes[new_parent].left = sibling;
+	this->nodes[new_parent].right = leaf;
+	this->nodes[sibling].parent = new_parent;
+	this->nodes[leaf].parent = new_parent;
+
+	if (old_parent != BVH_NULL_NODE) {
+		if (this->nodes[old_parent].left == sibling) {
+			this->nodes[old_parent].left = new_parent;
+		} else {
+			this->nodes[old_parent].right = new_parent;
+		}
+	} else {
+		this->root = new_parent;
+	}
+
+	this->refit(this->nodes[leaf].parent);
+}
+
+void BVH::removeLeaf(int leaf) {
+	if (leaf == this->root) {
+		this->root = BVH_NULL_NODE;
+		return;
+	}
+
+	int parent = this->nodes[leaf].parent;
+	int grandparent = this->nodes[parent].parent;
+	int sibling = this->nodes[parent].left == leaf ? this->nodes[parent].right : this->nodes[parent].left;
+
+	if (grandparent != BVH_NULL_NODE) {
+		if (this->nodes[grandparent].left == parent) {
+			this->nodes[grandparent].left = sibling;
+		} else {
+			this->nodes[grandparent].right = sibling;
+		}
+		this->nodes[sibling].parent = grandparent;
+		this->freeNode(parent);
+		this->refit(grandparent);
+	} else {
+		this->root = sibling;
+		this->nodes[sibling].parent = BVH_NULL_NODE;
+		this->freeNode(parent);
+	}
+}
+
+// Rebalances and recomputes boxes and heights from node up to the root.
+void BVH::refit(int node) {
+	int index = node;
+	while (index != BVH_NULL_NODE) {
+		index = this->balance(index);
+
+		int left = this->nodes[index].left;
+		int right = this->nodes[index].right;
+		this->nodes[index].height = 1 + std::max(this->nodes[left].height, this->nodes[right].height);
+		this->nodes[index].box = mergeAABB(this->nodes[left].box, this->nodes[right].box);
+
+		index = this->nodes[index].parent;
+	}
+}
+
+// Promotes the taller grandchild when the subtree of a is out of balance by
+// more than one level. Returns the node that now sits where a was.
+int BVH::balance(int a) {
+	BVHNode& node_a = this->nodes[a];
+	if (node_a.height < 2) {
+		return a;
+	}
+
+	int b = node_a.left;
+	int c = node_a.right;
+	int diff = this->nodes[c].height - this->nodes[b].height;
+
+	if (diff > 1 || diff < -1) {
+		// Work on the taller child, called up here, and its two children.
+		int up = diff > 1 ? c : b;
+		int other = diff > 1 ? b : c;
+		int f = this->nodes[up].left;
+		int g = this->nodes[up].right;
+
+		this->nodes[up].left = a;
+		this->nodes[up].parent = this->nodes[a].parent;
+		this->nodes[a].parent = up;
+
+		int up_parent = this->nodes[up].parent;
+		if (up_parent != BVH_NULL_NODE) {
+			if (this->nodes[up_parent].left == a) {
+				this->nodes[up_parent].left = up;
+			} else {
+				this->nodes[up_parent].right = up;
+			}
+		} else {
+			this->root = up;
+		}
+
+		// The taller grandchild stays with up, the shorter one moves under a.
+		int keep = this->nodes[f].height > this->nodes[g].height ? f : g;
+		int move = keep == f ? g : f;
+
+		this->nodes[up].right = keep;
+		if (diff > 1) {
+			this->nodes[a].right = move;
+		} else {
+			this->nodes[a].left = move;
+		}
+		this->nodes[move].parent = a;
+
+		this->nodes[a].box = mergeAABB(this->nodes[other].box, this->nodes[move].box);
+		this->nodes[a].height = 1 + std::max(this->nodes[other].height, this->nodes[move].height);
+		this->nodes[up].box = mergeAABB(this->nodes[a].box, this->nodes[keep].box);
+		this->nodes[up].height = 1 + std::max(this->nodes[a].height, this->nodes[keep].height);
+
+		return up;
+	}
+
+	return a;
+}
+
+void BVH::collectLeaves(int node, std::vector<void*>& out) {
+	size_t base = this->stack.size();
+	this->stack.push_back(node);
+	while (this->stack.size() > base) {
+		int index = this->stack.back();
+		this->stack.pop_back();
+		if (this->nodes[index].height == 0) {
+			out.push_back(this->nodes[index].user_data);
+		} else {
+			this->stack.push_back(this->nodes[index].left);
+			this->stack.push_back(this->nodes[index].right);
+		}
+	}
+}
+
+void BVH::queryFrustum(Frustum& frustum, std::vector<void*>& out) {
+	if (this->root == BVH_NULL_NODE) {
+		return;
+	}
+
+	this->stack.clear();
+	this->stack.push_back(this->root);
+	while (!this->stack.empty()) {
+		int index = this->stack.back();
+		this->stack.pop_back();
+
+		int result = frustum.classifyAABB(this->nodes[index].box);
+		if (result == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+		// Fully inside, everything below is visible without further tests.
+		if (result == FRUSTUM_INSIDE || this->nodes[index].height == 0) {
+			this->collectLeaves(index, out);
+			continue;
+		}
+		this->stack.push_back(this->nodes[index].left);
+		this->stack.push_back(this->nodes[index].right);
+	}
+}
+
+void BVH::queryAABB(const AABB& box, std::vector<void*>& out) {
+	if (this->root == BVH_NULL_NODE) {
+		return;
+	}
+
+	this->stack.clear();
+	this->stack.push_back(this->root);
+	while (!this->stack.empty()) {
+		int index = this->stack.back();
+		this->stack.pop_back();
+
+		if (!overlapAABB(this->nodes[index].box, box)) {
+			continue;
+		}
+		if (this->nodes[index].height == 0) {
+			out.push_back(this->nodes[index].user_data);
+		} else {
+			this->stack.push_back(this->nodes[index].left);
+			this->stack.push_back(this->nodes[index].right);
+		}
+	}
+}
+
+void BVH::queryRay(glm::vec3 origin, glm::vec3 direction, float max_t, std::vector<void*>& out) {
+	if (this->root == BVH_NULL_NODE) {
+		return;
+	}
+
+	glm::vec3 inv_direction = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	std::vector<std::pair<float, void*>> hits;
+
+	this->stack.clear();
+	this->stack.push_back(this->root);
+	while (!this->stack.empty()) {
+		int index = this->stack.back();
+		this->stack.pop_back();
+
+		float t;
+		if (!intersectRayAABB(origin, inv_direction, this->nodes[index].box, max_t, t)) {
+			continue;
+		}
+		if (this->nodes[index].height == 0) {
+			hits.push_back(std::make_pair(t, this->nodes[index].user_data));
+		} else {
+			this->stack.push_back(this->nodes[index].left);
+			this->stack.push_back(this->nodes[index].right);
+		}
+	}
+
+	std::sort(hits.begin(), hits.end(), [](const std::pair<float, void*>& a, const std::pair<float, void*>& b) {
+		return a.first < b.first;
+	});
+	for (unsigned int i = 0; i < hits.size(); i++) {
+		out.push_back(hits[i].second);
+	}
+}
+
+float surfaceArea(const AABB& box) {
+	glm::vec3 d = box.max - box.min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool containsAABB(const AABB& outer, const AABB& inner) {
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+		inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+}
+
+bool overlapAABB(const AABB& a, const AABB& b) {
+	return a.min.x <= b.max.x && b.min.x <= a.max.x &&
+		a.min.y <= b.max.y && b.min.y <= a.max.y &&
+		a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+bool intersectRayAABB(glm::vec3 origin, glm::vec3 inv_direction, const AABB& box, float max_t, float& t) {
+	float t_min = 0.0f;
+	float t_max = max_t;
+	for (int i = 0; i < 3; i++) {
+		float t1 = (box.min[i] - origin[i]) * inv_direction[i];
+		float t2 = (box.max[i] - origin[i]) * inv_direction[i];
+		// NaN from 0 * inf (ray in the slab plane) must not reject the box
+		if (t1 != t1 || t2 != t2) {
+			if (origin[i] < box.min[i] || origin[i] > box.max[i]) {
+				return false;
+			}
+			continue;
+		}
+		t_min = std::max(t_min, std::min(t1, t2));
+		t_max = std::min(t_max, std::max(t1, t2));
+		if (t_min > t_max) {
+			return false;
+		}
+	}
+	t = t_min;
+	return true;
+}
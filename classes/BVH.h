@@ -0,0 +1,76 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+#include "Frustum.h"
+
+#define BVH_NULL_NODE -1
+
+struct BVHNode {
+	// Leaves store a fattened box so small moves don't touch the tree.
+	AABB box;
+	void* user_data;
+	// Doubles as the next free node while the node is unused.
+	int parent;
+	int left;
+	int right;
+	// 0 for leaves, -1 for free nodes
+	int height;
+};
+
+// Dynamic AABB tree over scene objects. Leaves are inserted by walking down
+// the cheaper side by surface area and the tree is kept balanced with
+// rotations on the way back up.
+class BVH {
+
+	public:
+		BVH();
+		BVH(float margin);
+
+		int insert(const AABB& box, void* user_data);
+		void remove(int proxy);
+		// Returns true when the box left its fat bounds and was reinserted.
+		bool update(int proxy, const AABB& box);
+		void clear();
+
+		void* getUserData(int proxy);
+		const AABB& getFatBounds(int proxy);
+		int getHeight();
+		unsigned int getLeafCount();
+		// Fat box around every leaf, false when the tree is empty.
+		bool getBounds(AABB& out);
+
+		void queryFrustum(Frustum& frustum, std::vector<void*>& out);
+		void queryAABB(const AABB& box, std::vector<void*>& out);
+		// Leaves whose fat box the ray hits before max_t, nearest first.
+		void queryRay(glm::vec3 origin, glm::vec3 direction, float max_t, std::vector<void*>& out);
+
+	private:
+		std::vector<BVHNode> nodes;
+		int root;
+		int free_list;
+		unsigned int leaf_count;
+		float margin;
+		std::vector<int> stack;
+
+		int allocateNode();
+		void freeNode(int node);
+		void insertLeaf(int leaf);
+		void removeLeaf(int leaf);
+		int balance(int node);
+		void refit(int node);
+		void collectLeaves(int node, std::vector<void*>& out);
+};
+
+float surfaceArea(const AABB& box);
+bool containsAABB(const AABB& outer, const AABB& inner);
+bool overlapAABB(const AABB& a, const AABB& b);
+// Slab test, t receives the entry distance along the ray.
+bool intersectRayAABB(glm::vec3 origin, glm::vec3 inv_direction, const AABB& box, float max_t, float& t);
+
+#endif
@@ -29,6 +29,8 @@ Camera::Camera(GLFWwindow* w) {
 	this->lasty = 300.0f;
 
 	this->fov = 45.0f;
+	this->near_plane = 0.1f;
+	this->far_plane = 100.0f;
 }
 
 glm::mat4 Camera::getView() {
@@ -43,15 +45,44 @@ glm::vec3 Camera::getPosition() {
 	return this->pos;
 }
 
+float Camera::getFov() {
+	return this->fov;
+}
+
+float Camera::getNear() {
+	return this->near_plane;
+}
+
+float Camera::getFar() {
+	return this->far_plane;
+}
+
 void Camera::update() {
 	this->current_frame = glfwGetTime();
 	this->delta_time = this->current_frame - this->last_frame;
 	this->last_frame = this->current_frame;
 	this->speed = 5.0f * this->delta_time;
-	this->projection = glm::perspective(glm::radians(this->fov), 800.0f / 600.0f, 0.1f, 100.f);
+	this->projection = glm::perspective(glm::radians(this->fov), 800.0f / 600.0f, this->near_plane, this->far_plane);
 	this->view = glm::lookAt(this->pos, this->pos + this->front, this->up);
 }
 
+void Camera::getRay(double xpos, double ypos, glm::vec3& origin, glm::vec3& direction) {
+	int width, height;
+	glfwGetWindowSize(this->window, &width, &height);
+
+	float x = (2.0f * (float)xpos) / width - 1.0f;
+	float y = 1.0f - (2.0f * (float)ypos) / height;
+
+	glm::mat4 inv = glm::inverse(this->projection * this->view);
+	glm::vec4 near_point = inv * glm::vec4(x, y, -1.0f, 1.0f);
+	glm::vec4 far_point = inv * glm::vec4(x, y, 1.0f, 1.0f);
+	near_point /= near_point.w;
+	far_point /= far_point.w;
+
+	origin = glm::vec3(near_point);
+	direction = glm::normalize(glm::vec3(far_point) - glm::vec3(near_point));
+}
+
 void Camera::moveForward() {
 	this->pos += this->speed * this->front;
 }
@@ -14,7 +14,12 @@ class Camera {
 		glm::mat4 getView();
 		glm::mat4 getProjection();
 		glm::vec3 getPosition();
+		float getFov();
+		float getNear();
+		float getFar();
 		void update();
+		// World space ray through a point in window coordinates.
+		void getRay(double xpos, double ypos, glm::vec3& origin, glm::vec3& direction);
 		void moveBackward();
 		void moveForward();
 		void moveLeft();
@@ -49,6 +54,8 @@ class Camera {
 		float lasty;
 
 		float fov;
+		float near_plane;
+		float far_plane;
 
 };
 
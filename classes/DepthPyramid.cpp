@@ -0,0 +1,105 @@
+#include "DepthPyramid.h"
+
+DepthPyramid::DepthPyramid() {
+	this->shader = nullptr;
+	this->texture = 0;
+	this->width = 0;
+	this->height = 0;
+	this->levels = 0;
+	this->valid = false;
+}
+
+void DepthPyramid::allocate(int width, int height) {
+	if (this->texture != 0) {
+		glDeleteTextures(1, &this->texture);
+	}
+	this->width = width;
+	this->height = height;
+
+	int level_width = width / 2 > 1 ? width / 2 : 1;
+	int level_height = height / 2 > 1 ? height / 2 : 1;
+	this->levels = 1;
+	for (int size = level_width > level_height ? level_width : level_height; size > 1; size /= 2) {
+		this->levels++;
+	}
+
+	glGenTextures(1, &this->texture);
+	glBindTexture(GL_TEXTURE_2D, this->texture);
+	glTexStorage2D(GL_TEXTURE_2D, this->levels, GL_R32F, level_width, level_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	this->valid = false;
+}
+
+// One dispatch per level, each reading the one before through the sampler
+// while writing its own through an image.
+void DepthPyramid::build(unsigned int depth_texture, int width, int height) {
+	if (this->shader == nullptr) {
+		this->shader = new Shader(DEPTH_PYRAMID_SHADER_PATH);
+		this->u_source = this->shader->getIntUniform("source");
+		this->u_source_level = this->shader->getIntUniform("sourceLevel");
+	}
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+	if (this->texture == 0 || width != this->width || height != this->height) {
+		this->allocate(width, height);
+	}
+
+	this->shader->use();
+	this->shader->setInt(this->u_source, DEPTH_PYRAMID_TEXTURE_UNIT);
+	glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+
+	int level_width = width / 2 > 1 ? width / 2 : 1;
+	int level_height = height / 2 > 1 ? height / 2 : 1;
+	for (int level = 0; level < this->levels; level++) {
+		if (level == 0) {
+			glBindTexture(GL_TEXTURE_2D, depth_texture);
+			this->shader->setInt(this->u_source_level, 0);
+		} else {
+			glBindTexture(GL_TEXTURE_2D, this->texture);
+			this->shader->setInt(this->u_source_level, level - 1);
+		}
+		glBindImageTexture(0, this->texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((level_width + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, (level_height + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		level_width = level_width / 2 > 1 ? level_width / 2 : 1;
+		level_height = level_height / 2 > 1 ? level_height / 2 : 1;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	this->valid = true;
+}
+
+bool DepthPyramid::isValid() {
+	return this->valid;
+}
+
+unsigned int DepthPyramid::getTexture() {
+	return this->texture;
+}
+
+int DepthPyramid::getLevels() {
+	return this->levels;
+}
+
+void DepthPyramid::clear() {
+	if (this->texture != 0) {
+		glDeleteTextures(1, &this->texture);
+		this->texture = 0;
+	}
+	if (this->shader != nullptr) {
+		glDeleteProgram(this->shader->get());
+		delete this->shader;
+		this->shader = nullptr;
+	}
+	this->width = 0;
+	this->height = 0;
+	this->levels = 0;
+	this->valid = false;
+}
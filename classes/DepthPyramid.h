@@ -0,0 +1,46 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "Shader.h"
+
+#define DEPTH_PYRAMID_SHADER_PATH "shaders/compute_depth_pyramid.glsl"
+// local_size_x and local_size_y of the shader.
+#define DEPTH_PYRAMID_WORKGROUP_SIZE 8
+// Unit the source and the finished pyramid are bound to, above the ones
+// meshes use for their material textures.
+#define DEPTH_PYRAMID_TEXTURE_UNIT 15
+
+// Hierarchical depth for occlusion culling: a single channel float mip chain
+// whose level 0 is half the size of the depth buffer, every texel holding the
+// farthest depth under it. Built by compute, needs a GL 4.3 context.
+class DepthPyramid {
+
+	public:
+		DepthPyramid();
+
+		// Reads depth_texture, which must not be sampled with depth compare.
+		// Reallocates when the size changed.
+		void build(unsigned int depth_texture, int width, int height);
+		bool isValid();
+		unsigned int getTexture();
+		int getLevels();
+		void clear();
+
+	private:
+		Shader* shader;
+		IntUniform u_source;
+		IntUniform u_source_level;
+		unsigned int texture;
+		// Of the depth buffer, not of level 0.
+		int width;
+		int height;
+		int levels;
+		bool valid;
+
+		void allocate(int width, int height);
+};
+
+#endif
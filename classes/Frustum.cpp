@@ -0,0 +1,162 @@
+#include "Frustum.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_USE_SSE 1
+#endif
+
+void BoundsList::clear() {
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	extent_x.clear();
+	extent_y.clear();
+	extent_z.clear();
+}
+
+void BoundsList::add(const AABB& box) {
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	center_x.push_back(center.x);
+	center_y.push_back(center.y);
+	center_z.push_back(center.z);
+	extent_x.push_back(extent.x);
+	extent_y.push_back(extent.y);
+	extent_z.push_back(extent.z);
+}
+
+unsigned int BoundsList::size() {
+	return (unsigned int)center_x.size();
+}
+
+Frustum::Frustum() {
+	for (int i = 0; i < 6; i++) {
+		this->planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+}
+
+Frustum::Frustum(glm::mat4 view_proj) {
+	this->update(view_proj);
+}
+
+// Gribb/Hartmann plane extraction, glm matrices are column major.
+void Frustum::update(glm::mat4 view_proj) {
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++) {
+		row[i] = glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]);
+	}
+
+	this->planes[0] = row[3] + row[0];
+	this->planes[1] = row[3] - row[0];
+	this->planes[2] = row[3] + row[1];
+	this->planes[3] = row[3] - row[1];
+	this->planes[4] = row[3] + row[2];
+	this->planes[5] = row[3] - row[2];
+
+	for (int i = 0; i < 6; i++) {
+		float length = glm::length(glm::vec3(this->planes[i]));
+		this->planes[i] /= length;
+	}
+}
+
+bool Frustum::testAABB(const AABB& box) {
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	for (int i = 0; i < 6; i++) {
+		glm::vec3 normal = glm::vec3(this->planes[i]);
+		float d = glm::dot(normal, center) + this->planes[i].w;
+		float r = glm::dot(glm::abs(normal), extent);
+		if (d + r < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int Frustum::classifyAABB(const AABB& box) {
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	int result = FRUSTUM_INSIDE;
+	for (int i = 0; i < 6; i++) {
+		glm::vec3 normal = glm::vec3(this->planes[i]);
+		float d = glm::dot(normal, center) + this->planes[i].w;
+		float r = glm::dot(glm::abs(normal), extent);
+		if (d + r < 0.0f) {
+			return FRUSTUM_OUTSIDE;
+		}
+		if (d - r < 0.0f) {
+			result = FRUSTUM_INTERSECT;
+		}
+	}
+	return result;
+}
+
+bool Frustum::testSphere(const BoundingSphere& sphere) {
+	for (int i = 0; i < 6; i++) {
+		float d = glm::dot(glm::vec3(this->planes[i]), sphere.center) + this->planes[i].w;
+		if (d < -sphere.radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Frustum::cull(BoundsList& list, std::vector<unsigned char>& visible) {
+	unsigned int n = list.size();
+	visible.resize(n);
+	unsigned int i = 0;
+
+#ifdef FRUSTUM_USE_SSE
+	for (; i + 4 <= n; i += 4) {
+		__m128 cx = _mm_loadu_ps(&list.center_x[i]);
+		__m128 cy = _mm_loadu_ps(&list.center_y[i]);
+		__m128 cz = _mm_loadu_ps(&list.center_z[i]);
+		__m128 ex = _mm_loadu_ps(&list.extent_x[i]);
+		__m128 ey = _mm_loadu_ps(&list.extent_y[i]);
+		__m128 ez = _mm_loadu_ps(&list.extent_z[i]);
+		__m128 outside = _mm_setzero_ps();
+
+		for (int p = 0; p < 6; p++) {
+			glm::vec4 plane = this->planes[p];
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))), _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::fabs(plane.y)))), _mm_mul_ps(ez, _mm_set1_ps(std::fabs(plane.z))));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(outside);
+		visible[i + 0] = (mask & 1) ? 0 : 1;
+		visible[i + 1] = (mask & 2) ? 0 : 1;
+		visible[i + 2] = (mask & 4) ? 0 : 1;
+		visible[i + 3] = (mask & 8) ? 0 : 1;
+	}
+#endif
+
+	for (; i < n; i++) {
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++) {
+			glm::vec4 plane = this->planes[p];
+			float d = plane.x * list.center_x[i] + plane.y * list.center_y[i] + plane.z * list.center_z[i] + plane.w;
+			float r = std::fabs(plane.x) * list.extent_x[i] + std::fabs(plane.y) * list.extent_y[i] + std::fabs(plane.z) * list.extent_z[i];
+			inside = d + r >= 0.0f;
+		}
+		visible[i] = inside ? 1 : 0;
+	}
+}
+
+AABB transformAABB(const AABB& box, glm::vec3 position, glm::vec3 scale) {
+	glm::vec3 a = box.min * scale + position;
+	glm::vec3 b = box.max * scale + position;
+	AABB result;
+	result.min = glm::min(a, b);
+	result.max = glm::max(a, b);
+	return result;
+}
+
+AABB mergeAABB(const AABB& a, const AABB& b) {
+	AABB result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+	return result;
+}
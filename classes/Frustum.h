@@ -0,0 +1,70 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
+};
+
+// Boxes kept as structure-of-arrays (center and half extents) so the
+// frustum test can run over four of them at a time.
+class BoundsList {
+
+	public:
+		std::vector<float> center_x;
+		std::vector<float> center_y;
+		std::vector<float> center_z;
+		std::vector<float> extent_x;
+		std::vector<float> extent_y;
+		std::vector<float> extent_z;
+
+		void clear();
+		void add(const AABB& box);
+		unsigned int size();
+};
+
+#define FRUSTUM_OUTSIDE 0
+#define FRUSTUM_INTERSECT 1
+#define FRUSTUM_INSIDE 2
+
+struct CullStats {
+	unsigned int models_tested;
+	unsigned int models_visible;
+	unsigned int meshes_tested;
+	unsigned int meshes_visible;
+};
+
+class Frustum {
+
+	public:
+		Frustum();
+		Frustum(glm::mat4 view_proj);
+
+		void update(glm::mat4 view_proj);
+		bool testAABB(const AABB& box);
+		// FRUSTUM_OUTSIDE, FRUSTUM_INTERSECT or FRUSTUM_INSIDE
+		int classifyAABB(const AABB& box);
+		bool testSphere(const BoundingSphere& sphere);
+		// Writes 1 to visible[i] for every box that is at least partially inside.
+		void cull(BoundsList& list, std::vector<unsigned char>& visible);
+
+	private:
+		// xyz is the inward facing normal, w the distance term
+		glm::vec4 planes[6];
+};
+
+AABB transformAABB(const AABB& box, glm::vec3 position, glm::vec3 scale);
+AABB mergeAABB(const AABB& a, const AABB& b);
+
+#endif
@@ -0,0 +1,316 @@
+#include "GeometryArena.h"
+#include "Mesh.h"
+
+#include <iterator>
+#include <vector>
+#include <cstring>
+
+RangeAllocator::RangeAllocator() {
+	this->capacity = 0;
+	this->used = 0;
+}
+
+void RangeAllocator::reset(size_t capacity) {
+	this->free_ranges.clear();
+	this->capacity = capacity;
+	this->used = 0;
+	if (capacity > 0) {
+		this->free_ranges[0] = capacity;
+	}
+}
+
+void RangeAllocator::grow(size_t capacity) {
+	if (capacity <= this->capacity) {
+		return;
+	}
+	size_t offset = this->capacity;
+	this->capacity = capacity;
+	this->free(offset, capacity - offset);
+	// free() counted the new space as given back.
+	this->used += capacity - offset;
+}
+
+bool RangeAllocator::allocate(size_t size, size_t alignment, size_t& offset) {
+	if (size == 0) {
+		offset = 0;
+		return true;
+	}
+
+	for (auto iter = this->free_ranges.begin(); iter != this->free_ranges.end(); ++iter) {
+		size_t start = iter->first;
+		size_t range = iter->second;
+		size_t aligned = (start + alignment - 1) / alignment * alignment;
+		if (aligned + size > start + range) {
+			continue;
+		}
+
+		this->free_ranges.erase(iter);
+		if (aligned > start) {
+			this->free_ranges[start] = aligned - start;
+		}
+		if (aligned + size < start + range) {
+			this->free_ranges[aligned + size] = start + range - aligned - size;
+		}
+		this->used += size;
+		offset = aligned;
+		return true;
+	}
+	return false;
+}
+
+void RangeAllocator::free(size_t offset, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	this->used -= size;
+
+	auto next = this->free_ranges.lower_bound(offset);
+	if (next != this->free_ranges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			this->free_ranges.erase(prev);
+		}
+	}
+	if (next != this->free_ranges.end() && offset + size == next->first) {
+		size += next->second;
+		this->free_ranges.erase(next);
+	}
+	this->free_ranges[offset] = size;
+}
+
+size_t RangeAllocator::getCapacity() {
+	return this->capacity;
+}
+
+size_t RangeAllocator::getUsed() {
+	return this->used;
+}
+
+size_t RangeAllocator::getFreeRangeCount() {
+	return this->free_ranges.size();
+}
+
+GeometryArena& GeometryArena::get() {
+	static GeometryArena arena;
+	return arena;
+}
+
+GeometryArena::GeometryArena() {
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+		this->pools[i].VAO = 0;
+		this->pools[i].VBO = 0;
+		this->pools[i].EBO = 0;
+		this->pools[i].depth_VAO = 0;
+		this->pools[i].position_VBO = 0;
+		this->pools[i].stride = 0;
+		this->pools[i].position_stride = 0;
+	}
+}
+
+// Created on first use, so formats nobody uses cost nothing.
+GeometryArena::Pool& GeometryArena::getPool(VertexFormat format) {
+	Pool& pool = this->pools[format];
+	if (pool.VAO != 0) {
+		return pool;
+	}
+
+	pool.stride = format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+	pool.position_stride = getPositionStride(format);
+	size_t vertex_capacity = GEOMETRY_ARENA_VERTEX_BYTES / pool.stride;
+	pool.vertices.reset(vertex_capacity);
+	pool.indices.reset(GEOMETRY_ARENA_INDEX_BYTES);
+
+	glGenVertexArrays(1, &pool.VAO);
+	glGenBuffers(1, &pool.VBO);
+	glGenBuffers(1, &pool.EBO);
+	glGenVertexArrays(1, &pool.depth_VAO);
+	glGenBuffers(1, &pool.position_VBO);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * pool.stride, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.position_VBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * pool.position_stride, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, GEOMETRY_ARENA_INDEX_BYTES, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	this->setupAttributes(pool, format);
+	this->setupDepthAttributes(pool, format);
+	return pool;
+}
+
+void GeometryArena::setupAttributes(Pool& pool, VertexFormat format) {
+	glBindVertexArray(pool.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	if (format == VERTEX_FORMAT_PACKED) {
+		// Normalized, so the shaders see positions in [0, 1] and normals in [-1, 1].
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, tex_coords));
+	} else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tex_coords));
+	}
+
+	setupInstanceAttributes();
+	glBindVertexArray(0);
+}
+
+// Same packing as the full vertices, so the shaders dequantize the same way.
+void GeometryArena::setupDepthAttributes(Pool& pool, VertexFormat format) {
+	glBindVertexArray(pool.depth_VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, pool.position_VBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+
+	glEnableVertexAttribArray(0);
+	if (format == VERTEX_FORMAT_PACKED) {
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, (GLsizei)pool.position_stride, (void*)0);
+	} else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (GLsizei)pool.position_stride, (void*)0);
+	}
+
+	setupInstanceAttributes();
+	glBindVertexArray(0);
+}
+
+// Instance attributes advance once per instance, their pointers are set per batch.
+void GeometryArena::setupInstanceAttributes() {
+	for (unsigned int i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + i);
+		glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + i, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+	glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+	glEnableVertexAttribArray(INSTANCE_DRAW_ID_LOCATION);
+	glVertexAttribDivisor(INSTANCE_DRAW_ID_LOCATION, 1);
+}
+
+// Packed positions keep their padding so every vertex stays 4 byte aligned.
+size_t GeometryArena::getPositionStride(VertexFormat format) {
+	return format == VERTEX_FORMAT_PACKED ? sizeof(((PackedVertex*)0)->position) : sizeof(glm::vec3);
+}
+
+// New buffer with the old contents copied over on the GPU.
+unsigned int GeometryArena::resizeBuffer(unsigned int buffer, size_t old_size, size_t new_size) {
+	unsigned int resized;
+	glGenBuffers(1, &resized);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &buffer);
+	return resized;
+}
+
+void GeometryArena::allocate(VertexFormat format, const void* vertices, size_t num_vertices, const void* indices, size_t index_bytes, GeometryAllocation& allocation) {
+	Pool& pool = this->getPool(format);
+	allocation.format = format;
+	allocation.vertex_count = num_vertices;
+	allocation.index_bytes = index_bytes;
+
+	// Grown buffers are new buffer objects, the VAO has to point at them again.
+	bool resized = false;
+	while (!pool.vertices.allocate(num_vertices, 1, allocation.vertex_offset)) {
+		size_t capacity = pool.vertices.getCapacity();
+		pool.VBO = resizeBuffer(pool.VBO, capacity * pool.stride, capacity * 2 * pool.stride);
+		pool.position_VBO = resizeBuffer(pool.position_VBO, capacity * pool.position_stride, capacity * 2 * pool.position_stride);
+		pool.vertices.grow(capacity * 2);
+		resized = true;
+	}
+	while (!pool.indices.allocate(index_bytes, GEOMETRY_ARENA_INDEX_ALIGNMENT, allocation.index_offset)) {
+		size_t capacity = pool.indices.getCapacity();
+		pool.EBO = resizeBuffer(pool.EBO, capacity, capacity * 2);
+		pool.indices.grow(capacity * 2);
+		resized = true;
+	}
+	if (resized) {
+		this->setupAttributes(pool, format);
+		this->setupDepthAttributes(pool, format);
+	}
+
+	// Positions lead both vertex layouts.
+	std::vector<unsigned char> positions(num_vertices * pool.position_stride);
+	const unsigned char* source = (const unsigned char*)vertices;
+	for (size_t i = 0; i < num_vertices; i++) {
+		std::memcpy(&positions[i * pool.position_stride], source + i * pool.stride, pool.position_stride);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.vertex_offset * pool.stride, num_vertices * pool.stride, vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.position_VBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.vertex_offset * pool.position_stride, positions.size(), positions.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.index_offset, index_bytes, indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation) {
+	Pool& pool = this->pools[allocation.format];
+	if (pool.VAO == 0) {
+		return;
+	}
+	pool.vertices.free(allocation.vertex_offset, allocation.vertex_count);
+	pool.indices.free(allocation.index_offset, allocation.index_bytes);
+}
+
+unsigned int GeometryArena::getVAO(VertexFormat format) {
+	return this->getPool(format).VAO;
+}
+
+unsigned int GeometryArena::getDepthVAO(VertexFormat format) {
+	return this->getPool(format).depth_VAO;
+}
+
+size_t GeometryArena::getCapacity() {
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+		bytes += this->pools[i].vertices.getCapacity() * (this->pools[i].stride + this->pools[i].position_stride) + this->pools[i].indices.getCapacity();
+	}
+	return bytes;
+}
+
+size_t GeometryArena::getUsed() {
+	size_t bytes = 0;
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+		bytes += this->pools[i].vertices.getUsed() * (this->pools[i].stride + this->pools[i].position_stride) + this->pools[i].indices.getUsed();
+	}
+	return bytes;
+}
+
+size_t GeometryArena::getFreeRangeCount() {
+	size_t count = 0;
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+		count += this->pools[i].vertices.getFreeRangeCount() + this->pools[i].indices.getFreeRangeCount();
+	}
+	return count;
+}
+
+void GeometryArena::clear() {
+	for (unsigned int i = 0; i < VERTEX_FORMAT_COUNT; i++) {
+		Pool& pool = this->pools[i];
+		if (pool.VAO == 0) {
+			continue;
+		}
+		glDeleteVertexArrays(1, &pool.VAO);
+		glDeleteBuffers(1, &pool.VBO);
+		glDeleteBuffers(1, &pool.EBO);
+		glDeleteVertexArrays(1, &pool.depth_VAO);
+		glDeleteBuffers(1, &pool.position_VBO);
+		pool.VAO = 0;
+		pool.VBO = 0;
+		pool.EBO = 0;
+		pool.depth_VAO = 0;
+		pool.position_VBO = 0;
+		pool.vertices.reset(0);
+		pool.indices.reset(0);
+	}
+}
@@ -0,0 +1,115 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <map>
+#include <cstddef>
+
+// Layout of the GPU vertex buffer. Loaders, caches and optimisers always work
+// on Vertex, packing happens at upload.
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT = 0,
+	// PackedVertex, half the size of Vertex.
+	VERTEX_FORMAT_PACKED = 1
+};
+
+#define VERTEX_FORMAT_COUNT 2
+
+// Initial sizes of the shared buffers of each vertex format, they double
+// whenever an allocation doesn't fit.
+#define GEOMETRY_ARENA_VERTEX_BYTES (4 << 20)
+#define GEOMETRY_ARENA_INDEX_BYTES (2 << 20)
+// Index ranges start aligned to the widest index type.
+#define GEOMETRY_ARENA_INDEX_ALIGNMENT 4
+
+// First fit over the free ranges, kept sorted by offset so neighbours merge
+// again when a range is freed. Units are up to the caller.
+class RangeAllocator {
+
+	public:
+		RangeAllocator();
+
+		void reset(size_t capacity);
+		// Adds space at the end, merged with a trailing free range.
+		void grow(size_t capacity);
+		bool allocate(size_t size, size_t alignment, size_t& offset);
+		void free(size_t offset, size_t size);
+
+		size_t getCapacity();
+		size_t getUsed();
+		size_t getFreeRangeCount();
+
+	private:
+		// Offset to size.
+		std::map<size_t, size_t> free_ranges;
+		size_t capacity;
+		size_t used;
+};
+
+// Where a mesh lives in the arena. vertex_offset counts vertices and is the
+// base vertex of every draw, index_offset is in bytes.
+struct GeometryAllocation {
+	VertexFormat format;
+	size_t vertex_offset;
+	size_t vertex_count;
+	size_t index_offset;
+	size_t index_bytes;
+};
+
+// Static mesh data of every mesh in a few large buffers: one vertex and one
+// index buffer per vertex format, sub-allocated by RangeAllocator, with one
+// VAO per format that all meshes of it share. Meshes draw with base vertex.
+// Positions are kept a second time in a tightly packed stream with its own
+// VAO for depth only passes, indexed like the full vertices so the same
+// draws work on either.
+class GeometryArena {
+
+	public:
+		static GeometryArena& get();
+
+		// Copies the data in, growing the buffers if needed.
+		void allocate(VertexFormat format, const void* vertices, size_t num_vertices, const void* indices, size_t index_bytes, GeometryAllocation& allocation);
+		void free(const GeometryAllocation& allocation);
+
+		unsigned int getVAO(VertexFormat format);
+		// Position stream only, plus the instance attributes.
+		unsigned int getDepthVAO(VertexFormat format);
+		// Bytes per vertex in the position stream.
+		static size_t getPositionStride(VertexFormat format);
+		// Bytes in buffers and bytes handed out, over all formats.
+		size_t getCapacity();
+		size_t getUsed();
+		size_t getFreeRangeCount();
+		// Deletes the buffers, every allocation is invalid afterwards.
+		void clear();
+
+	private:
+		struct Pool {
+			unsigned int VAO;
+			unsigned int VBO;
+			unsigned int EBO;
+			unsigned int depth_VAO;
+			unsigned int position_VBO;
+			size_t stride;
+			size_t position_stride;
+			// In vertices and in bytes.
+			RangeAllocator vertices;
+			RangeAllocator indices;
+		};
+
+		Pool pools[VERTEX_FORMAT_COUNT];
+
+		GeometryArena();
+		GeometryArena(const GeometryArena&) = delete;
+		GeometryArena& operator=(const GeometryArena&) = delete;
+
+		Pool& getPool(VertexFormat format);
+		void setupAttributes(Pool& pool, VertexFormat format);
+		void setupDepthAttributes(Pool& pool, VertexFormat format);
+		static void setupInstanceAttributes();
+		static unsigned int resizeBuffer(unsigned int buffer, size_t old_size, size_t new_size);
+};
+
+#endif
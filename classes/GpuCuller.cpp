@@ -0,0 +1,472 @@
+#include "GpuCuller.h"
+
+#include <cstring>
+
+GpuCuller::GpuCuller() {
+	this->layout_dirty = true;
+	this->output_capacity = 0;
+	this->cull_shader = nullptr;
+	this->commands_shader = nullptr;
+	this->instance_buffer = 0;
+	this->group_base_buffer = 0;
+	this->group_count_buffer = 0;
+	this->output_buffer = 0;
+	this->counter_buffer = 0;
+	this->command_buffer = 0;
+	this->command_group_buffer = 0;
+	this->draw_data_buffer = 0;
+	for (unsigned int i = 0; i < GPU_CULL_READBACK_SLOTS; i++) {
+		this->readback[i].buffer = 0;
+		this->readback[i].fence = nullptr;
+		this->readback[i].instances = 0;
+		this->readback[i].serial = 0;
+	}
+	this->readback_next = 0;
+	this->cull_serial = 0;
+	this->stats_serial = 0;
+	std::memset(&this->stats, 0, sizeof(GpuCullStats));
+	this->debug_view = false;
+}
+
+// Compute shaders, shader storage buffers and buffer clears.
+bool GpuCuller::isSupported() {
+	return GLAD_GL_VERSION_4_3 != 0;
+}
+
+void GpuCuller::add(Model* model, Shader* shader, const SceneUniforms* uniforms) {
+	if (this->slots.find(model) != this->slots.end()) {
+		this->setShader(model, shader, uniforms);
+		return;
+	}
+	Entry entry;
+	entry.model = model;
+	entry.shader = shader;
+	entry.uniforms = uniforms;
+	this->slots.insert(std::make_pair(model, (unsigned int)this->entries.size()));
+	this->entries.push_back(entry);
+	// Group ranges are sized by instance count per asset.
+	this->layout_dirty = true;
+}
+
+void GpuCuller::remove(Model* model) {
+	auto iter = this->slots.find(model);
+	if (iter == this->slots.end()) {
+		return;
+	}
+	unsigned int slot = iter->second;
+	this->slots.erase(iter);
+	if (slot + 1 != this->entries.size()) {
+		this->entries[slot] = this->entries.back();
+		this->slots[this->entries[slot].model] = slot;
+	}
+	this->entries.pop_back();
+	this->layout_dirty = true;
+}
+
+void GpuCuller::update(Model* model) {
+	auto iter = this->slots.find(model);
+	if (iter != this->slots.end() && !this->layout_dirty) {
+		this->dirty_slots.push_back(iter->second);
+	}
+}
+
+void GpuCuller::setShader(Model* model, Shader* shader, const SceneUniforms* uniforms) {
+	auto iter = this->slots.find(model);
+	if (iter == this->slots.end()) {
+		return;
+	}
+	Entry& entry = this->entries[iter->second];
+	if (entry.shader == shader) {
+		return;
+	}
+	entry.shader = shader;
+	entry.uniforms = uniforms;
+	// Switching to a shader the asset already has groups for only moves the
+	// instance, a new pair needs groups of its own.
+	if (this->buckets.find(std::make_pair(shader, model->getAsset())) == this->buckets.end()) {
+		this->layout_dirty = true;
+	} else {
+		this->update(model);
+	}
+}
+
+void GpuCuller::invalidate() {
+	this->layout_dirty = true;
+}
+
+void GpuCuller::init() {
+	if (this->cull_shader != nullptr) {
+		return;
+	}
+	this->cull_shader = new Shader(GPU_CULL_SHADER_PATH);
+	this->u_view_proj = this->cull_shader->getMat4Uniform("viewProj");
+	this->u_camera_pos = this->cull_shader->getVec3Uniform("cameraPos");
+	this->u_near_plane = this->cull_shader->getFloatUniform("nearPlane");
+	this->u_pixels_per_unit = this->cull_shader->getFloatUniform("pixelsPerUnit");
+	this->u_lod_pixel_error = this->cull_shader->getFloatUniform("lodPixelError");
+	this->u_lod_hysteresis = this->cull_shader->getFloatUniform("lodHysteresis");
+	this->u_instance_count = this->cull_shader->getIntUniform("instanceCount");
+	this->u_debug_view = this->cull_shader->getIntUniform("debugView");
+	this->u_phase = this->cull_shader->getIntUniform("phase");
+	this->u_occlusion = this->cull_shader->getIntUniform("occlusion");
+	this->u_hiz_view_proj = this->cull_shader->getMat4Uniform("hizViewProj");
+	this->u_hiz = this->cull_shader->getIntUniform("hiZ");
+
+	this->commands_shader = new Shader(GPU_CULL_COMMANDS_SHADER_PATH);
+	this->u_command_count = this->commands_shader->getIntUniform("commandCount");
+
+	unsigned int zero[GPU_CULL_COUNTERS] = {0};
+	uploadBuffer(this->counter_buffer, zero, sizeof(zero), GL_DYNAMIC_COPY);
+}
+
+// Every group of an asset gets room for all static instances of the asset,
+// so an instance can switch between the asset's shaders without moving
+// anyone else.
+void GpuCuller::buildLayout() {
+	this->buckets.clear();
+	this->runs.clear();
+	this->commands.clear();
+	this->command_groups.clear();
+	this->group_bases.clear();
+	this->draw_data.clear();
+	this->output_capacity = 0;
+
+	std::map<Model*, unsigned int> asset_instances;
+	for (unsigned int i = 0; i < this->entries.size(); i++) {
+		const Entry& entry = this->entries[i];
+		Model* asset = entry.model->getAsset();
+		if (entry.shader == nullptr || !asset->isReady()) {
+			continue;
+		}
+		asset_instances[asset]++;
+		Bucket bucket;
+		bucket.first_group = 0;
+		bucket.uniforms = entry.uniforms;
+		this->buckets.insert(std::make_pair(std::make_pair(entry.shader, asset), bucket));
+	}
+
+	// Buckets sort by shader first, which keeps program changes down.
+	for (auto iter = this->buckets.begin(); iter != this->buckets.end(); ++iter) {
+		Shader* shader = iter->first.first;
+		Model* asset = iter->first.second;
+		Bucket& bucket = iter->second;
+		bucket.first_group = (unsigned int)this->group_bases.size();
+
+		unsigned int capacity = asset_instances[asset];
+		unsigned int lod_count = glm::clamp(asset->getLodCount(), 1u, (unsigned int)MESH_MAX_LODS);
+		std::vector<Mesh>& meshes = asset->getMeshes();
+		for (unsigned int m = 0; m < meshes.size(); m++) {
+			IndirectRun run;
+			run.mesh = &meshes[m];
+			run.shader = shader;
+			run.uniforms = bucket.uniforms;
+			run.has_diffuse = asset->hasDiffuse();
+			run.has_specular = asset->hasSpecular();
+			run.depth_only = false;
+			run.first_command = this->commands.size();
+
+			for (unsigned int level = 0; level < lod_count; level++) {
+				unsigned int group = (unsigned int)this->group_bases.size();
+				this->group_bases.push_back((unsigned int)this->output_capacity);
+
+				DrawDataBlock block;
+				block.position_offset = glm::vec4(meshes[m].getPositionOffset(), 0.0f);
+				block.position_scale = glm::vec4(meshes[m].getPositionScale(), 0.0f);
+				this->draw_data.push_back(block);
+
+				// Instance counts are left to the GPU.
+				meshes[m].appendDrawCommands(level, 0, (unsigned int)this->output_capacity, this->commands);
+				this->command_groups.resize(this->commands.size(), group);
+				this->output_capacity += capacity;
+			}
+			run.command_count = this->commands.size() - run.first_command;
+			this->runs.push_back(run);
+		}
+	}
+
+	this->instance_data.resize(this->entries.size());
+	for (unsigned int i = 0; i < this->entries.size(); i++) {
+		this->fillInstance(i, this->instance_data[i]);
+	}
+
+	uploadBuffer(this->instance_buffer, this->instance_data.data(), this->instance_data.size() * sizeof(CullInstanceBlock), GL_DYNAMIC_DRAW);
+	uploadBuffer(this->group_base_buffer, this->group_bases.data(), this->group_bases.size() * sizeof(unsigned int), GL_STATIC_DRAW);
+	uploadBuffer(this->group_count_buffer, nullptr, this->group_bases.size() * sizeof(unsigned int), GL_DYNAMIC_COPY);
+	uploadBuffer(this->output_buffer, nullptr, this->output_capacity * sizeof(InstanceData), GL_DYNAMIC_COPY);
+	uploadBuffer(this->command_buffer, this->commands.data(), this->commands.size() * sizeof(DrawElementsIndirectCommand), GL_DYNAMIC_COPY);
+	uploadBuffer(this->command_group_buffer, this->command_groups.data(), this->command_groups.size() * sizeof(unsigned int), GL_STATIC_DRAW);
+	uploadBuffer(this->draw_data_buffer, this->draw_data.data(), this->draw_data.size() * sizeof(DrawDataBlock), GL_STATIC_DRAW);
+
+	this->dirty_slots.clear();
+	this->layout_dirty = false;
+}
+
+void GpuCuller::fillInstance(unsigned int slot, CullInstanceBlock& block) {
+	const Entry& entry = this->entries[slot];
+	Model* m = entry.model;
+	Model* asset = m->getAsset();
+
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, m->getPosition());
+	model = glm::scale(model, m->getScale());
+	block.model = model;
+	block.color = glm::vec4(m->getColor(), 1.0f);
+
+	BoundingSphere sphere = m->getWorldSphere();
+	block.sphere = glm::vec4(sphere.center, sphere.radius);
+	AABB bounds = m->getWorldBounds();
+	block.bounds_min = glm::vec4(bounds.min, 0.0f);
+	block.bounds_max = glm::vec4(bounds.max, 0.0f);
+
+	glm::vec3 scale = glm::abs(m->getScale());
+	float max_scale = glm::max(scale.x, glm::max(scale.y, scale.z));
+	unsigned int lod_count = glm::min(m->getLodCount(), (unsigned int)MESH_MAX_LODS);
+	block.lod_errors = glm::vec4(0.0f);
+	for (unsigned int level = 0; level < lod_count; level++) {
+		block.lod_errors[level] = m->getLodError(level) * max_scale;
+	}
+
+	auto bucket = this->buckets.find(std::make_pair(entry.shader, asset));
+	if (bucket == this->buckets.end()) {
+		// Not drawn until the layout has groups for it.
+		block.info = glm::uvec4(0u);
+		return;
+	}
+	lod_count = glm::max(lod_count, 1u);
+	block.info = glm::uvec4(bucket->second.first_group, (unsigned int)asset->getMeshes().size(), lod_count, glm::min(m->getLod(), lod_count - 1));
+}
+
+void GpuCuller::uploadDirty() {
+	if (this->dirty_slots.empty()) {
+		return;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, this->instance_buffer);
+	for (unsigned int i = 0; i < this->dirty_slots.size(); i++) {
+		unsigned int slot = this->dirty_slots[i];
+		if (slot >= this->entries.size()) {
+			continue;
+		}
+		this->fillInstance(slot, this->instance_data[slot]);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, slot * sizeof(CullInstanceBlock), sizeof(CullInstanceBlock), &this->instance_data[slot]);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	this->dirty_slots.clear();
+}
+
+void GpuCuller::cull(const GpuCullView& view, int phase, bool read_counters) {
+	this->init();
+	this->readCounters();
+	if (this->layout_dirty) {
+		this->buildLayout();
+	} else {
+		this->uploadDirty();
+	}
+	if (this->entries.empty() || this->commands.empty()) {
+		return;
+	}
+
+	unsigned int zero = 0;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, this->group_count_buffer);
+	glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	if (phase != GPU_CULL_PHASE_SECOND) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->counter_buffer);
+		glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_INSTANCE_BINDING, this->instance_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_GROUP_BASE_BINDING, this->group_base_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_GROUP_COUNT_BINDING, this->group_count_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OUTPUT_BINDING, this->output_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COUNTER_BINDING, this->counter_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMAND_BINDING, this->command_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMAND_GROUP_BINDING, this->command_group_buffer);
+
+	Shader* shader = this->cull_shader;
+	shader->use();
+	shader->setMatrix(this->u_view_proj, view.view_proj);
+	shader->setVector(this->u_camera_pos, view.camera_pos);
+	shader->setFloat(this->u_near_plane, view.near_plane);
+	shader->setFloat(this->u_pixels_per_unit, view.pixels_per_unit);
+	shader->setFloat(this->u_lod_pixel_error, view.lod_pixel_error);
+	shader->setFloat(this->u_lod_hysteresis, view.lod_hysteresis);
+	shader->setInt(this->u_instance_count, (int)this->entries.size());
+	shader->setInt(this->u_debug_view, this->debug_view && !view.shadow ? 1 : 0);
+	bool occlusion = view.occlusion && view.hiz_texture != 0;
+	shader->setInt(this->u_phase, occlusion ? phase : GPU_CULL_PHASE_ALL);
+	shader->setInt(this->u_occlusion, occlusion ? 1 : 0);
+	if (occlusion) {
+		shader->setMatrix(this->u_hiz_view_proj, view.hiz_view_proj);
+		shader->setInt(this->u_hiz, DEPTH_PYRAMID_TEXTURE_UNIT);
+		glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, view.hiz_texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	glDispatchCompute(((unsigned int)this->entries.size() + GPU_CULL_WORKGROUP_SIZE - 1) / GPU_CULL_WORKGROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	shader = this->commands_shader;
+	shader->use();
+	shader->setInt(this->u_command_count, (int)this->commands.size());
+	glDispatchCompute(((unsigned int)this->commands.size() + GPU_CULL_WORKGROUP_SIZE - 1) / GPU_CULL_WORKGROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	if (!read_counters) {
+		return;
+	}
+	this->cull_serial++;
+	// A slot still waiting on the GPU means it is far behind, skip this
+	// pass rather than wait.
+	ReadbackSlot& slot = this->readback[this->readback_next];
+	if (slot.fence != nullptr) {
+		return;
+	}
+	if (slot.buffer == 0) {
+		uploadBuffer(slot.buffer, nullptr, GPU_CULL_COUNTERS * sizeof(unsigned int), GL_STREAM_READ);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, this->counter_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GPU_CULL_COUNTERS * sizeof(unsigned int));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.instances = (unsigned int)this->entries.size();
+	slot.serial = this->cull_serial;
+	this->readback_next = (this->readback_next + 1) % GPU_CULL_READBACK_SLOTS;
+}
+
+// Polls the fences without a timeout, a copy that isn't done yet is picked
+// up by a later call.
+void GpuCuller::readCounters() {
+	for (unsigned int i = 0; i < GPU_CULL_READBACK_SLOTS; i++) {
+		ReadbackSlot& slot = this->readback[i];
+		if (slot.fence == nullptr) {
+			continue;
+		}
+		GLenum result = glClientWaitSync(slot.fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+			continue;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		if (slot.serial < this->stats_serial) {
+			continue;
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, slot.buffer);
+		const unsigned int* counters = (const unsigned int*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, GPU_CULL_COUNTERS * sizeof(unsigned int), GL_MAP_READ_BIT);
+		if (counters != nullptr) {
+			this->stats.instances = slot.instances;
+			this->stats.visible = counters[0];
+			for (unsigned int level = 0; level < MESH_MAX_LODS; level++) {
+				this->stats.lod_instances[level] = counters[1 + level];
+			}
+			this->stats.occluded = counters[1 + MESH_MAX_LODS];
+			this->stats.second_phase = counters[2 + MESH_MAX_LODS];
+			this->stats.latency = this->cull_serial - slot.serial;
+			this->stats_serial = slot.serial;
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+}
+
+void GpuCuller::draw(RenderQueue& queue, Shader* depth_shader, const SceneUniforms* depth_uniforms) {
+	if (this->runs.empty() || this->layout_dirty) {
+		return;
+	}
+	if (depth_shader != nullptr) {
+		this->debug_runs = this->runs;
+		for (unsigned int i = 0; i < this->debug_runs.size(); i++) {
+			this->debug_runs[i].shader = depth_shader;
+			this->debug_runs[i].uniforms = depth_uniforms;
+			this->debug_runs[i].depth_only = true;
+		}
+		queue.submitIndirect(this->debug_runs, this->output_buffer, this->draw_data_buffer, this->command_buffer);
+		return;
+	}
+	if (!this->debug_view) {
+		queue.submitIndirect(this->runs, this->output_buffer, this->draw_data_buffer, this->command_buffer);
+		return;
+	}
+	this->debug_runs = this->runs;
+	for (unsigned int i = 0; i < this->debug_runs.size(); i++) {
+		this->debug_runs[i].has_diffuse = false;
+		this->debug_runs[i].has_specular = false;
+	}
+	queue.submitIndirect(this->debug_runs, this->output_buffer, this->draw_data_buffer, this->command_buffer);
+}
+
+void GpuCuller::setDebugView(bool enabled) {
+	this->debug_view = enabled;
+}
+
+bool GpuCuller::getDebugView() {
+	return this->debug_view;
+}
+
+const GpuCullStats& GpuCuller::getStats() {
+	return this->stats;
+}
+
+unsigned int GpuCuller::size() {
+	return (unsigned int)this->entries.size();
+}
+
+void GpuCuller::clear() {
+	this->entries.clear();
+	this->slots.clear();
+	this->dirty_slots.clear();
+	this->buckets.clear();
+	this->runs.clear();
+	this->commands.clear();
+	this->command_groups.clear();
+	this->group_bases.clear();
+	this->draw_data.clear();
+	this->instance_data.clear();
+	this->output_capacity = 0;
+	this->layout_dirty = true;
+
+	unsigned int buffers[] = {
+		this->instance_buffer, this->group_base_buffer, this->group_count_buffer, this->output_buffer,
+		this->counter_buffer, this->command_buffer, this->command_group_buffer, this->draw_data_buffer
+	};
+	glDeleteBuffers(8, buffers);
+	this->instance_buffer = 0;
+	this->group_base_buffer = 0;
+	this->group_count_buffer = 0;
+	this->output_buffer = 0;
+	this->counter_buffer = 0;
+	this->command_buffer = 0;
+	this->command_group_buffer = 0;
+	this->draw_data_buffer = 0;
+
+	for (unsigned int i = 0; i < GPU_CULL_READBACK_SLOTS; i++) {
+		if (this->readback[i].fence != nullptr) {
+			glDeleteSync(this->readback[i].fence);
+			this->readback[i].fence = nullptr;
+		}
+		glDeleteBuffers(1, &this->readback[i].buffer);
+		this->readback[i].buffer = 0;
+	}
+	std::memset(&this->stats, 0, sizeof(GpuCullStats));
+
+	if (this->cull_shader != nullptr) {
+		glDeleteProgram(this->cull_shader->get());
+		glDeleteProgram(this->commands_shader->get());
+		delete this->cull_shader;
+		delete this->commands_shader;
+		this->cull_shader = nullptr;
+		this->commands_shader = nullptr;
+	}
+}
+
+// Buffers are never empty, a zero sized binding is an error.
+void GpuCuller::uploadBuffer(unsigned int& buffer, const void* data, size_t size, GLenum usage) {
+	if (buffer == 0) {
+		glGenBuffers(1, &buffer);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, size > 0 ? size : sizeof(unsigned int), size > 0 ? data : nullptr, usage);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
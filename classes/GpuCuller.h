@@ -0,0 +1,213 @@
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#include "Model.h"
+#include "Shader.h"
+#include "RenderQueue.h"
+#include "DepthPyramid.h"
+
+#define GPU_CULL_SHADER_PATH "shaders/compute_cull.glsl"
+#define GPU_CULL_COMMANDS_SHADER_PATH "shaders/compute_cull_commands.glsl"
+// local_size_x of both compute shaders.
+#define GPU_CULL_WORKGROUP_SIZE 64
+
+// Shader storage bindings of the culling passes, DRAW_DATA_SSBO_BINDING stays
+// free for the draws.
+#define GPU_CULL_INSTANCE_BINDING 1
+#define GPU_CULL_GROUP_BASE_BINDING 2
+#define GPU_CULL_GROUP_COUNT_BINDING 3
+#define GPU_CULL_OUTPUT_BINDING 4
+#define GPU_CULL_COUNTER_BINDING 5
+#define GPU_CULL_COMMAND_BINDING 6
+#define GPU_CULL_COMMAND_GROUP_BINDING 7
+
+// Visible instances, visible instances per level, instances rejected by the
+// occlusion test and instances only the second phase found visible.
+#define GPU_CULL_COUNTERS (3 + MESH_MAX_LODS)
+// Counter copies in flight. Stats lag the GPU by up to this many culls
+// instead of waiting for it.
+#define GPU_CULL_READBACK_SLOTS 3
+
+// A single pass tests against the frustum and, if asked, the depth pyramid.
+// Two-phase occlusion splits that up: the first phase draws what passes the
+// pyramid of the previous frame and defers the rest, the second tests the
+// deferred instances again against a pyramid of what the first one drew, so
+// instances coming into view show up in the same frame.
+#define GPU_CULL_PHASE_ALL 0
+#define GPU_CULL_PHASE_FIRST 1
+#define GPU_CULL_PHASE_SECOND 2
+
+// std430 mirror of CullInstance in compute_cull.glsl.
+struct CullInstanceBlock {
+	glm::mat4 model;
+	glm::vec4 color;
+	// World space bounding sphere, radius in w.
+	glm::vec4 sphere;
+	// World space box, w unused.
+	glm::vec4 bounds_min;
+	glm::vec4 bounds_max;
+	// Error of each level in world units.
+	glm::vec4 lod_errors;
+	// First group, mesh count, level count, current level. The GPU keeps a
+	// deferred flag above the level between the two phases.
+	glm::uvec4 info;
+};
+
+// View the culling pass tests against and picks levels for.
+struct GpuCullView {
+	glm::mat4 view_proj;
+	glm::vec3 camera_pos;
+	float near_plane;
+	float pixels_per_unit;
+	// 0 keeps every instance at full detail.
+	float lod_pixel_error;
+	float lod_hysteresis;
+	// Boxes are tested against hiz_texture, a DepthPyramid built from a view
+	// with hiz_view_proj.
+	bool occlusion;
+	unsigned int hiz_texture;
+	glm::mat4 hiz_view_proj;
+	// Light view of a shadow pass, never drawn with debug colors. Levels
+	// are still picked from the camera so casters match what it sees.
+	bool shadow;
+};
+
+// Counters of the newest culling pass that finished on the GPU.
+struct GpuCullStats {
+	unsigned int instances;
+	unsigned int visible;
+	unsigned int lod_instances[MESH_MAX_LODS];
+	unsigned int occluded;
+	// Part of visible, drawn by the second phase.
+	unsigned int second_phase;
+	// Counted culls between that pass and the one that read it back.
+	unsigned int latency;
+};
+
+// Frustum culling and level of detail selection of static instances in a
+// compute pass. Instances stay on the GPU and are only uploaded again when
+// they change. The pass appends the survivors to the instance range of their
+// (shader, mesh, level) group and writes the instance counts of the indirect
+// commands that draw the groups, so the CPU never visits them per frame.
+// Needs a GL 4.3 context and multi-draw shaders.
+class GpuCuller {
+
+	public:
+		GpuCuller();
+
+		static bool isSupported();
+
+		void add(Model* model, Shader* shader, const SceneUniforms* uniforms);
+		void remove(Model* model);
+		// Transform or color of the model changed.
+		void update(Model* model);
+		void setShader(Model* model, Shader* shader, const SceneUniforms* uniforms);
+		// Assets finished loading, the groups are laid out again.
+		void invalidate();
+
+		// One of the GPU_CULL_PHASE values. Counters add up over the phases
+		// of a frame, those of a pass with read_counters set show up in
+		// getStats a few culls later.
+		void cull(const GpuCullView& view, int phase, bool read_counters);
+		// Draws what the last cull left, through queue so state is shared.
+		// A depth shader draws every run with it from the position stream.
+		void draw(RenderQueue& queue, Shader* depth_shader = nullptr, const SceneUniforms* depth_uniforms = nullptr);
+
+		// Instances outside the frustum are drawn in red, occluded ones in
+		// purple and visible ones colored by level, all without textures.
+		void setDebugView(bool enabled);
+		bool getDebugView();
+		const GpuCullStats& getStats();
+		unsigned int size();
+		// Forgets every instance and deletes the GL objects.
+		void clear();
+
+	private:
+		struct Entry {
+			Model* model;
+			Shader* shader;
+			const SceneUniforms* uniforms;
+		};
+
+		// Groups of one shader and asset: mesh major, then level.
+		struct Bucket {
+			unsigned int first_group;
+			const SceneUniforms* uniforms;
+		};
+
+		struct ReadbackSlot {
+			unsigned int buffer;
+			GLsync fence;
+			unsigned int instances;
+			unsigned int serial;
+		};
+
+		std::vector<Entry> entries;
+		std::unordered_map<Model*, unsigned int> slots;
+		std::vector<unsigned int> dirty_slots;
+		bool layout_dirty;
+
+		std::map<std::pair<Shader*, Model*>, Bucket> buckets;
+		std::vector<IndirectRun> runs;
+		// Copies of runs with the shader or material overridden.
+		std::vector<IndirectRun> debug_runs;
+		std::vector<DrawElementsIndirectCommand> commands;
+		std::vector<unsigned int> command_groups;
+		std::vector<unsigned int> group_bases;
+		std::vector<DrawDataBlock> draw_data;
+		std::vector<CullInstanceBlock> instance_data;
+		size_t output_capacity;
+
+		Shader* cull_shader;
+		Shader* commands_shader;
+		Mat4Uniform u_view_proj;
+		Vec3Uniform u_camera_pos;
+		FloatUniform u_near_plane;
+		FloatUniform u_pixels_per_unit;
+		FloatUniform u_lod_pixel_error;
+		FloatUniform u_lod_hysteresis;
+		IntUniform u_instance_count;
+		IntUniform u_debug_view;
+		IntUniform u_phase;
+		IntUniform u_occlusion;
+		Mat4Uniform u_hiz_view_proj;
+		IntUniform u_hiz;
+		IntUniform u_command_count;
+
+		unsigned int instance_buffer;
+		unsigned int group_base_buffer;
+		unsigned int group_count_buffer;
+		unsigned int output_buffer;
+		unsigned int counter_buffer;
+		unsigned int command_buffer;
+		unsigned int command_group_buffer;
+		unsigned int draw_data_buffer;
+
+		ReadbackSlot readback[GPU_CULL_READBACK_SLOTS];
+		unsigned int readback_next;
+		unsigned int cull_serial;
+		unsigned int stats_serial;
+		GpuCullStats stats;
+
+		bool debug_view;
+
+		void init();
+		void buildLayout();
+		void fillInstance(unsigned int slot, CullInstanceBlock& block);
+		void uploadDirty();
+		void readCounters();
+		static void uploadBuffer(unsigned int& buffer, const void* data, size_t size, GLenum usage);
+};
+
+#endif
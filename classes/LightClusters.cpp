@@ -0,0 +1,282 @@
+#include "LightClusters.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_USE_SSE 1
+#endif
+
+LightClusters::LightClusters() {
+	this->projection = glm::mat4(0.0f);
+	this->near_plane = 0.0f;
+	this->far_plane = 0.0f;
+	this->depth_scale = 0.0f;
+	this->depth_bias = 0.0f;
+	this->light_buffer = 0;
+	this->grid_buffer = 0;
+	this->index_buffer = 0;
+	this->light_texture = 0;
+	this->grid_texture = 0;
+	this->index_texture = 0;
+	this->max_texels = 0;
+	this->stats = LightClusterStats();
+}
+
+void LightClusters::init() {
+	unsigned int buffers[3];
+	unsigned int textures[3];
+	GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (int i = 0; i < 3; i++) {
+		// A texture buffer needs a data store to attach to.
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	this->light_buffer = buffers[0];
+	this->grid_buffer = buffers[1];
+	this->index_buffer = buffers[2];
+	this->light_texture = textures[0];
+	this->grid_texture = textures[1];
+	this->index_texture = textures[2];
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &this->max_texels);
+}
+
+// Symmetric projections only, which is what Camera builds.
+void LightClusters::buildBounds(const glm::mat4& proj, float near_plane, float far_plane) {
+	this->projection = proj;
+	this->near_plane = near_plane;
+	this->far_plane = far_plane;
+	float log_ratio = std::log(far_plane / near_plane);
+	this->depth_scale = (float)CLUSTER_Z / log_ratio;
+	this->depth_bias = -(float)CLUSTER_Z * std::log(near_plane) / log_ratio;
+
+	this->min_x.resize(CLUSTER_COUNT);
+	this->min_y.resize(CLUSTER_COUNT);
+	this->min_z.resize(CLUSTER_COUNT);
+	this->max_x.resize(CLUSTER_COUNT);
+	this->max_y.resize(CLUSTER_COUNT);
+	this->max_z.resize(CLUSTER_COUNT);
+
+	// A tile spanning [a, b] in NDC covers a * d / proj[0][0] to
+	// b * d / proj[0][0] at view depth d, the box takes both ends of the slice.
+	for (int z = 0; z < CLUSTER_Z; z++) {
+		float d0 = near_plane * std::pow(far_plane / near_plane, (float)z / CLUSTER_Z);
+		float d1 = near_plane * std::pow(far_plane / near_plane, (float)(z + 1) / CLUSTER_Z);
+		for (int y = 0; y < CLUSTER_Y; y++) {
+			float a_y = -1.0f + 2.0f * y / CLUSTER_Y;
+			float b_y = -1.0f + 2.0f * (y + 1) / CLUSTER_Y;
+			for (int x = 0; x < CLUSTER_X; x++) {
+				float a_x = -1.0f + 2.0f * x / CLUSTER_X;
+				float b_x = -1.0f + 2.0f * (x + 1) / CLUSTER_X;
+				unsigned int i = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+				this->min_x[i] = glm::min(a_x * d0, a_x * d1) / proj[0][0];
+				this->max_x[i] = glm::max(b_x * d0, b_x * d1) / proj[0][0];
+				this->min_y[i] = glm::min(a_y * d0, a_y * d1) / proj[1][1];
+				this->max_y[i] = glm::max(b_y * d0, b_y * d1) / proj[1][1];
+				this->min_z[i] = -d1;
+				this->max_z[i] = -d0;
+			}
+		}
+	}
+}
+
+int LightClusters::sliceOf(float depth) {
+	int slice = (int)std::floor(std::log(depth) * this->depth_scale + this->depth_bias);
+	return glm::clamp(slice, 0, CLUSTER_Z - 1);
+}
+
+void LightClusters::assignLight(unsigned int light, glm::vec3 center, float radius, const glm::mat4& proj) {
+	float depth = -center.z;
+	float d_near = depth - radius;
+	float d_far = depth + radius;
+	if (d_far < this->near_plane || d_near > this->far_plane) {
+		return;
+	}
+	int z0 = this->sliceOf(glm::max(d_near, this->near_plane));
+	int z1 = this->sliceOf(glm::min(d_far, this->far_plane));
+
+	// Tiles the sphere's view space box projects to. Each side is divided by
+	// the depth that pushes it furthest out. Spheres reaching past the near
+	// plane can cover any tile.
+	int x0 = 0;
+	int x1 = CLUSTER_X - 1;
+	int y0 = 0;
+	int y1 = CLUSTER_Y - 1;
+	if (d_near > this->near_plane) {
+		float lo_x = proj[0][0] * (center.x - radius) / (center.x - radius < 0.0f ? d_near : d_far);
+		float hi_x = proj[0][0] * (center.x + radius) / (center.x + radius > 0.0f ? d_near : d_far);
+		float lo_y = proj[1][1] * (center.y - radius) / (center.y - radius < 0.0f ? d_near : d_far);
+		float hi_y = proj[1][1] * (center.y + radius) / (center.y + radius > 0.0f ? d_near : d_far);
+		if (lo_x > 1.0f || hi_x < -1.0f || lo_y > 1.0f || hi_y < -1.0f) {
+			return;
+		}
+		x0 = glm::clamp((int)std::floor((lo_x * 0.5f + 0.5f) * CLUSTER_X), 0, CLUSTER_X - 1);
+		x1 = glm::clamp((int)std::floor((hi_x * 0.5f + 0.5f) * CLUSTER_X), 0, CLUSTER_X - 1);
+		y0 = glm::clamp((int)std::floor((lo_y * 0.5f + 0.5f) * CLUSTER_Y), 0, CLUSTER_Y - 1);
+		y1 = glm::clamp((int)std::floor((hi_y * 0.5f + 0.5f) * CLUSTER_Y), 0, CLUSTER_Y - 1);
+	}
+
+	// Exact sphere against box test of the froxels in that range.
+	float radius_sq = radius * radius;
+	size_t first_pair = this->pair_clusters.size();
+	for (int z = z0; z <= z1; z++) {
+		for (int y = y0; y <= y1; y++) {
+			unsigned int row = (z * CLUSTER_Y + y) * CLUSTER_X;
+			int x = x0;
+
+#ifdef LIGHT_CLUSTERS_USE_SSE
+			__m128 cx = _mm_set1_ps(center.x);
+			__m128 cy = _mm_set1_ps(center.y);
+			__m128 cz = _mm_set1_ps(center.z);
+			__m128 zero = _mm_setzero_ps();
+			// Rows are a multiple of four long, so whole groups stay inside.
+			for (x = x0 & ~3; x <= x1; x += 4) {
+				unsigned int i = row + x;
+				__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_x[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&this->max_x[i]))), zero);
+				__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_y[i]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&this->max_y[i]))), zero);
+				__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_z[i]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&this->max_z[i]))), zero);
+				__m128 dist_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				int mask = _mm_movemask_ps(_mm_cmple_ps(dist_sq, _mm_set1_ps(radius_sq)));
+				for (int lane = 0; lane < 4; lane++) {
+					if ((mask & (1 << lane)) && x + lane >= x0 && x + lane <= x1) {
+						this->pair_clusters.push_back(i + lane);
+						this->pair_lights.push_back(light);
+						this->counts[i + lane]++;
+					}
+				}
+			}
+#endif
+
+			for (; x <= x1; x++) {
+				unsigned int i = row + x;
+				float dx = glm::max(glm::max(this->min_x[i] - center.x, center.x - this->max_x[i]), 0.0f);
+				float dy = glm::max(glm::max(this->min_y[i] - center.y, center.y - this->max_y[i]), 0.0f);
+				float dz = glm::max(glm::max(this->min_z[i] - center.z, center.z - this->max_z[i]), 0.0f);
+				if (dx * dx + dy * dy + dz * dz <= radius_sq) {
+					this->pair_clusters.push_back(i);
+					this->pair_lights.push_back(light);
+					this->counts[i]++;
+				}
+			}
+		}
+	}
+	if (this->pair_clusters.size() > first_pair) {
+		this->stats.lights_visible++;
+	}
+}
+
+void LightClusters::update(Camera* camera, const std::vector<PointLight*>& lights, const std::vector<int>& shadow_layers) {
+	if (this->light_buffer == 0) {
+		this->init();
+	}
+	glm::mat4 proj = camera->getProjection();
+	if (proj != this->projection || camera->getNear() != this->near_plane || camera->getFar() != this->far_plane) {
+		this->buildBounds(proj, camera->getNear(), camera->getFar());
+	}
+	glm::mat4 view = camera->getView();
+
+	this->stats = LightClusterStats();
+	this->stats.lights = (unsigned int)lights.size();
+	this->light_data.resize(lights.size());
+	this->pair_clusters.clear();
+	this->pair_lights.clear();
+	this->counts.assign(CLUSTER_COUNT, 0);
+
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		PointLight* light = lights[i];
+		PointLightBlock& block = this->light_data[i];
+		block.position = light->getPosition();
+		block.ambient = light->getAmbient();
+		block.diffuse = light->getDiffuse();
+		block.specular = light->getSpecular();
+		block.kc = light->getKC();
+		block.kl = light->getKL();
+		block.kq = light->getKQ();
+		block.shadow_layer = i < shadow_layers.size() ? (float)shadow_layers[i] : -1.0f;
+
+		float radius = light->getRadius();
+		if (radius > 0.0f) {
+			this->assignLight(i, glm::vec3(view * glm::vec4(block.position, 1.0f)), radius, proj);
+		}
+	}
+
+	// Offsets from the counts, then the pairs scattered into place. Lights
+	// that no longer fit into a buffer texture are dropped from the end.
+	this->grid.resize(2 * CLUSTER_COUNT);
+	unsigned int offset = 0;
+	unsigned int limit = (unsigned int)this->max_texels;
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++) {
+		unsigned int count = glm::min(this->counts[c], limit - offset);
+		this->grid[2 * c] = offset;
+		this->grid[2 * c + 1] = count;
+		this->counts[c] = offset;
+		offset += count;
+		this->stats.max_per_cluster = glm::max(this->stats.max_per_cluster, count);
+	}
+	this->indices.resize(offset);
+	for (unsigned int p = 0; p < this->pair_clusters.size(); p++) {
+		unsigned int c = this->pair_clusters[p];
+		if (this->counts[c] < this->grid[2 * c] + this->grid[2 * c + 1]) {
+			this->indices[this->counts[c]++] = this->pair_lights[p];
+		}
+	}
+	this->stats.indices = offset;
+
+	upload(this->light_buffer, this->light_data.data(), this->light_data.size() * sizeof(PointLightBlock));
+	upload(this->grid_buffer, this->grid.data(), this->grid.size() * sizeof(unsigned int));
+	upload(this->index_buffer, this->indices.data(), this->indices.size() * sizeof(unsigned int));
+}
+
+void LightClusters::upload(unsigned int buffer, const void* data, size_t size) {
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind() {
+	glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->light_texture);
+	glActiveTexture(GL_TEXTURE0 + CLUSTER_GRID_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->grid_texture);
+	glActiveTexture(GL_TEXTURE0 + CLUSTER_INDEX_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->index_texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+float LightClusters::getDepthScale() {
+	return this->depth_scale;
+}
+
+float LightClusters::getDepthBias() {
+	return this->depth_bias;
+}
+
+const LightClusterStats& LightClusters::getStats() {
+	return this->stats;
+}
+
+void LightClusters::clear() {
+	if (this->light_buffer != 0) {
+		unsigned int buffers[3] = { this->light_buffer, this->grid_buffer, this->index_buffer };
+		unsigned int textures[3] = { this->light_texture, this->grid_texture, this->index_texture };
+		glDeleteBuffers(3, buffers);
+		glDeleteTextures(3, textures);
+	}
+	this->light_buffer = 0;
+	this->grid_buffer = 0;
+	this->index_buffer = 0;
+	this->light_texture = 0;
+	this->grid_texture = 0;
+	this->index_texture = 0;
+	this->projection = glm::mat4(0.0f);
+	this->light_data.clear();
+	this->pair_clusters.clear();
+	this->pair_lights.clear();
+}
@@ -0,0 +1,119 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+#include "Camera.h"
+#include "PointLight.h"
+
+// Froxel grid, tiles across the screen and slices along the view. Matches
+// the defines in fragment_standard.glsl. CLUSTER_X stays a multiple of four
+// for the SSE test.
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+
+// Units of the buffer textures, below POINT_SHADOW_TEXTURE_UNIT.
+#define LIGHT_DATA_TEXTURE_UNIT 10
+#define CLUSTER_GRID_TEXTURE_UNIT 11
+#define CLUSTER_INDEX_TEXTURE_UNIT 12
+
+// Texels of one light in the light buffer, matches fetchPointLight in
+// fragment_standard.glsl.
+struct PointLightBlock {
+	glm::vec3 position;
+	float kc;
+	glm::vec3 ambient;
+	float kl;
+	glm::vec3 diffuse;
+	float kq;
+	glm::vec3 specular;
+	// Cube of the point shadow atlas, -1 for none.
+	float shadow_layer;
+};
+
+// Counters of the last build.
+struct LightClusterStats {
+	unsigned int lights;
+	// Lights that reached at least one cluster.
+	unsigned int lights_visible;
+	unsigned int indices;
+	unsigned int max_per_cluster;
+};
+
+// Clustered point light assignment for forward shading. Each frame the view
+// frustum is cut into a CLUSTER_X by CLUSTER_Y by CLUSTER_Z grid of froxels,
+// sliced exponentially in depth, and every light is added to the froxels its
+// attenuation sphere (see PointLight::getRadius) touches. A fragment then
+// only shades the lights of its froxel.
+//
+// The grid is built on the CPU. A light's sphere is projected to a range of
+// tiles and slices first, the froxels in it are then tested against the
+// sphere four at a time. Light data, the per froxel (offset, count) pairs
+// and the index list go to buffer textures, which a 3.3 context has.
+class LightClusters {
+
+	public:
+		LightClusters();
+
+		// shadow_layers holds the point shadow cube of each light or is
+		// empty. Uploads everything the shaders read.
+		void update(Camera* camera, const std::vector<PointLight*>& lights, const std::vector<int>& shadow_layers);
+		// Binds the buffer textures to their units.
+		void bind();
+
+		// Slice of a view space depth d is log(d) * getDepthScale() + getDepthBias().
+		float getDepthScale();
+		float getDepthBias();
+		const LightClusterStats& getStats();
+		void clear();
+
+	private:
+		// View space boxes of the froxels, structure-of-arrays with x the
+		// fastest index.
+		std::vector<float> min_x;
+		std::vector<float> min_y;
+		std::vector<float> min_z;
+		std::vector<float> max_x;
+		std::vector<float> max_y;
+		std::vector<float> max_z;
+		// Projection the boxes were built for.
+		glm::mat4 projection;
+		float near_plane;
+		float far_plane;
+		float depth_scale;
+		float depth_bias;
+
+		// Scratch space kept between frames.
+		std::vector<PointLightBlock> light_data;
+		std::vector<unsigned int> pair_clusters;
+		std::vector<unsigned int> pair_lights;
+		std::vector<unsigned int> counts;
+		std::vector<unsigned int> grid;
+		std::vector<unsigned int> indices;
+
+		unsigned int light_buffer;
+		unsigned int grid_buffer;
+		unsigned int index_buffer;
+		unsigned int light_texture;
+		unsigned int grid_texture;
+		unsigned int index_texture;
+		int max_texels;
+
+		LightClusterStats stats;
+
+		void init();
+		void buildBounds(const glm::mat4& proj, float near_plane, float far_plane);
+		int sliceOf(float depth);
+		void assignLight(unsigned int light, glm::vec3 center, float radius, const glm::mat4& proj);
+		static void upload(unsigned int buffer, const void* data, size_t size);
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+	this->bytes = nullptr;
+	this->length = 0;
+#ifdef _WIN32
+	this->file_handle = INVALID_HANDLE_VALUE;
+	this->mapping_handle = NULL;
+#else
+	this->fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile() {
+	this->close();
+}
+
+bool MappedFile::open(const std::string& path) {
+	this->close();
+
+#ifdef _WIN32
+	this->file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (this->file_handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(this->file_handle, &file_size) || file_size.QuadPart == 0) {
+		this->close();
+		return false;
+	}
+	this->mapping_handle = CreateFileMappingA(this->file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (this->mapping_handle == NULL) {
+		this->close();
+		return false;
+	}
+	this->bytes = (const unsigned char*)MapViewOfFile(this->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	if (this->bytes == nullptr) {
+		this->close();
+		return false;
+	}
+	this->length = (size_t)file_size.QuadPart;
+#else
+	this->fd = ::open(path.c_str(), O_RDONLY);
+	if (this->fd < 0) {
+		return false;
+	}
+	struct stat info;
+	if (fstat(this->fd, &info) != 0 || info.st_size == 0) {
+		this->close();
+		return false;
+	}
+	void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+	if (mapped == MAP_FAILED) {
+		this->close();
+		return false;
+	}
+	this->bytes = (const unsigned char*)mapped;
+	this->length = (size_t)info.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (this->bytes != nullptr) {
+		UnmapViewOfFile(this->bytes);
+	}
+	if (this->mapping_handle != NULL) {
+		CloseHandle(this->mapping_handle);
+	}
+	if (this->file_handle != INVALID_HANDLE_VALUE) {
+		CloseHandle(this->file_handle);
+	}
+	this->file_handle = INVALID_HANDLE_VALUE;
+	this->mapping_handle = NULL;
+#else
+	if (this->bytes != nullptr) {
+		munmap((void*)this->bytes, this->length);
+	}
+	if (this->fd >= 0) {
+		::close(this->fd);
+	}
+	this->fd = -1;
+#endif
+	this->bytes = nullptr;
+	this->length = 0;
+}
+
+bool MappedFile::isOpen() {
+	return this->bytes != nullptr;
+}
+
+const unsigned char* MappedFile::data() {
+	return this->bytes;
+}
+
+size_t MappedFile::size() {
+	return this->length;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+	const unsigned char* p = (const unsigned char*)data;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool open(const std::string& path);
+		void close();
+		bool isOpen();
+		const unsigned char* data();
+		size_t size();
+
+	private:
+		const unsigned char* bytes;
+		size_t length;
+#ifdef _WIN32
+		void* file_handle;
+		void* mapping_handle;
+#else
+		int fd;
+#endif
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+};
+
+// 64-bit FNV-1a, seed lets several inputs be chained into one key.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+
+#endif
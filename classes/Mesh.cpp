@@ -1,45 +1,247 @@
 #include "Mesh.h"
 
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+VertexFormat Mesh::default_format = VERTEX_FORMAT_FLOAT;
+size_t Mesh::total_gpu_memory = 0;
+
 Mesh::Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures) {
 	this->vertices = vertices;
 	this->indices = indices;
 	this->textures = textures;
+	this->format = default_format;
 
-	setupMesh();
+	computeBounds();
+	setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
 }
 
-void Mesh::setupMesh() {
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+Mesh::Mesh(const Vertex* vertices, unsigned int num_vertices, const unsigned int* indices, unsigned int num_indices, std::vector<Texture> textures, const AABB& bounds, const BoundingSphere& sphere, const std::vector<MeshLod>& lods, VertexFormat format) {
+	this->textures = textures;
+	this->bounds = bounds;
+	this->sphere = sphere;
+	this->lods = lods;
+	this->format = format;
 
-	glBindVertexArray(VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	setupMesh(vertices, num_vertices, indices, num_indices);
+}
 
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+void Mesh::computeBounds() {
+	computeMeshBounds(vertices.data(), (unsigned int)vertices.size(), bounds, sphere);
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+void computeMeshBounds(const Vertex* vertices, unsigned int num_vertices, AABB& bounds, BoundingSphere& sphere) {
+	if (num_vertices == 0) {
+		bounds.min = glm::vec3(0.0f);
+		bounds.max = glm::vec3(0.0f);
+		sphere.center = glm::vec3(0.0f);
+		sphere.radius = 0.0f;
+		return;
+	}
 
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	bounds.min = vertices[0].position;
+	bounds.max = vertices[0].position;
+	for (unsigned int i = 1; i < num_vertices; i++) {
+		bounds.min = glm::min(bounds.min, vertices[i].position);
+		bounds.max = glm::max(bounds.max, vertices[i].position);
+	}
 
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,normal));
+	// Centered on the box, radius from the farthest vertex rather than the
+	// box corner so it stays tight for round meshes.
+	sphere.center = (bounds.min + bounds.max) * 0.5f;
+	float radius_sq = 0.0f;
+	for (unsigned int i = 0; i < num_vertices; i++) {
+		glm::vec3 d = vertices[i].position - sphere.center;
+		radius_sq = glm::max(radius_sq, glm::dot(d, d));
+	}
+	sphere.radius = glm::sqrt(radius_sq);
+}
 
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex,tex_coords));
+// Round to nearest even, overflow goes to infinity and values below the half
+// range flush to zero, which is plenty for texture coordinates.
+uint16_t floatToHalf(float f) {
+	uint32_t bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	uint32_t abs_bits = bits & 0x7FFFFFFF;
 
-	glBindVertexArray(0);
+	if (abs_bits >= 0x7F800000) {
+		// Inf stays inf, NaN stays a quiet NaN.
+		return sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x200 : 0);
+	}
+	if (abs_bits >= 0x477FF000) {
+		return sign | 0x7C00;
+	}
+	if (abs_bits < 0x38800000) {
+		// Subnormal half, shift the mantissa with the implicit bit into place.
+		if (abs_bits < 0x33000000) {
+			return sign;
+		}
+		uint32_t exponent = abs_bits >> 23;
+		uint32_t mantissa = (abs_bits & 0x7FFFFF) | 0x800000;
+		uint32_t shift = 126 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1))) {
+			half++;
+		}
+		return sign | (uint16_t)half;
+	}
+
+	uint32_t half = (abs_bits - 0x38000000) >> 13;
+	uint32_t rest = abs_bits & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		half++;
+	}
+	return sign | (uint16_t)half;
+}
+
+static uint32_t packSnorm10(float v) {
+	v = glm::clamp(v, -1.0f, 1.0f);
+	return (uint32_t)((int32_t)glm::round(v * 511.0f)) & 0x3FF;
 }
 
-void Mesh::draw(Shader &shader) {
+void packVertices(const Vertex* vertices, unsigned int num_vertices, const AABB& bounds, std::vector<PackedVertex>& packed) {
+	glm::vec3 extent = bounds.max - bounds.min;
+	glm::vec3 to_fixed;
+	for (int c = 0; c < 3; c++) {
+		to_fixed[c] = extent[c] > 0.0f ? 65535.0f / extent[c] : 0.0f;
+	}
+
+	packed.resize(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; i++) {
+		const Vertex& v = vertices[i];
+		PackedVertex& p = packed[i];
+
+		glm::vec3 q = glm::clamp((v.position - bounds.min) * to_fixed, glm::vec3(0.0f), glm::vec3(65535.0f));
+		p.position[0] = (uint16_t)(q.x + 0.5f);
+		p.position[1] = (uint16_t)(q.y + 0.5f);
+		p.position[2] = (uint16_t)(q.z + 0.5f);
+		p.position[3] = 0;
+
+		glm::vec3 n = v.normal;
+		float length = glm::length(n);
+		if (length > 0.0f) {
+			n /= length;
+		}
+		p.normal = packSnorm10(n.x) | (packSnorm10(n.y) << 10) | (packSnorm10(n.z) << 20);
+
+		p.tex_coords[0] = floatToHalf(v.tex_coords.x);
+		p.tex_coords[1] = floatToHalf(v.tex_coords.y);
+	}
+}
+
+// Greedy over the triangles in order, a chunk ends where its vertex range
+// would no longer fit in 16 bits. Vertex fetch optimisation numbers vertices
+// by first use, so that rarely happens before 64K vertices.
+bool buildIndexChunks(const unsigned int* indices, const std::vector<MeshLod>& lods, std::vector<MeshIndexChunk>& chunks, std::vector<unsigned int>& lod_chunks) {
+	chunks.clear();
+	lod_chunks.clear();
+	unsigned int triangles = 0;
+
+	for (unsigned int level = 0; level < lods.size(); level++) {
+		lod_chunks.push_back((unsigned int)chunks.size());
+		unsigned int start = lods[level].index_offset;
+		unsigned int end = start + lods[level].index_count;
+		triangles += lods[level].index_count / 3;
+
+		unsigned int chunk_start = start;
+		unsigned int low = UINT_MAX;
+		unsigned int high = 0;
+		for (unsigned int i = start; i + 3 <= end; i += 3) {
+			unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+			unsigned int tri_low = std::min(a, std::min(b, c));
+			unsigned int tri_high = std::max(a, std::max(b, c));
+			if (tri_high - tri_low > 0xFFFF) {
+				return false;
+			}
+			if (std::max(high, tri_high) - std::min(low, tri_low) > 0xFFFF) {
+				MeshIndexChunk chunk;
+				chunk.index_offset = chunk_start;
+				chunk.index_count = i - chunk_start;
+				chunk.base_vertex = high <= 0xFFFF ? 0 : (int)low;
+				chunks.push_back(chunk);
+				chunk_start = i;
+				low = UINT_MAX;
+				high = 0;
+			}
+			low = std::min(low, tri_low);
+			high = std::max(high, tri_high);
+		}
+		if (end > chunk_start) {
+			MeshIndexChunk chunk;
+			chunk.index_offset = chunk_start;
+			chunk.index_count = end - chunk_start;
+			chunk.base_vertex = high <= 0xFFFF ? 0 : (int)low;
+			chunks.push_back(chunk);
+		}
+	}
+	lod_chunks.push_back((unsigned int)chunks.size());
+
+	// One chunk per level needs no extra draws, more have to pay for themselves.
+	if (chunks.size() > lods.size() && triangles / chunks.size() < MESH_MIN_CHUNK_TRIANGLES) {
+		return false;
+	}
+	return true;
+}
+
+void Mesh::setupMesh(const Vertex* vertex_data, size_t num_vertices, const unsigned int* index_data, size_t num_indices) {
+	if (lods.empty()) {
+		MeshLod full;
+		full.index_offset = 0;
+		full.index_count = (unsigned int)num_indices;
+		full.error = 0.0f;
+		lods.push_back(full);
+	}
+
+	// The arena copies the data, so the packed and narrowed copies only need
+	// to live until allocate returns.
+	std::vector<PackedVertex> packed;
+	const void* vertex_upload = vertex_data;
+	size_t vertex_bytes;
+	if (format == VERTEX_FORMAT_PACKED) {
+		packVertices(vertex_data, (unsigned int)num_vertices, bounds, packed);
+		vertex_upload = packed.data();
+		vertex_bytes = num_vertices * sizeof(PackedVertex);
+		position_offset = bounds.min;
+		position_scale = bounds.max - bounds.min;
+	} else {
+		vertex_bytes = num_vertices * sizeof(Vertex);
+		position_offset = glm::vec3(0.0f);
+		position_scale = glm::vec3(1.0f);
+	}
+
+	std::vector<uint16_t> short_indices;
+	const void* index_upload = index_data;
+	size_t index_bytes;
+	if (buildIndexChunks(index_data, lods, chunks, lod_chunks)) {
+		short_indices.assign(num_indices, 0);
+		for (unsigned int c = 0; c < chunks.size(); c++) {
+			const MeshIndexChunk& chunk = chunks[c];
+			for (unsigned int i = chunk.index_offset; i < chunk.index_offset + chunk.index_count; i++) {
+				short_indices[i] = (uint16_t)(index_data[i] - chunk.base_vertex);
+			}
+		}
+		index_upload = short_indices.data();
+		index_type = GL_UNSIGNED_SHORT;
+		index_bytes = num_indices * sizeof(uint16_t);
+	} else {
+		chunks.clear();
+		lod_chunks.clear();
+		index_type = GL_UNSIGNED_INT;
+		index_bytes = num_indices * sizeof(unsigned int);
+	}
+
+	GeometryArena::get().allocate(format, vertex_upload, num_vertices, index_upload, index_bytes, geometry);
+	gpu_memory = vertex_bytes + num_vertices * GeometryArena::getPositionStride(format) + index_bytes;
+	total_gpu_memory += gpu_memory;
+
 	unsigned int num_diffuse = 1;
 	unsigned int num_specular = 1;
 
 	for (unsigned int i = 0; i < textures.size(); i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-
 		std::string number;
 		std::string name = textures[i].type;
 		if (name == "texture_diffuse") {
@@ -47,23 +249,146 @@ void Mesh::draw(Shader &shader) {
 		} else if (name == "texture_specular") {
 			number = std::to_string(num_specular++);
 		}
-
-		//shader.setFloat(("material." + name + number).c_str(), i);
-		shader.setInt((name + number).c_str(), i);
-		glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		sampler_names.push_back(name + number);
 	}
+}
 
-	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
+const std::vector<IntUniform>& Mesh::getSamplerUniforms(Shader& shader) {
+	auto iter = sampler_uniforms.find(shader.get());
+	if (iter != sampler_uniforms.end()) {
+		return iter->second;
+	}
 
-	glActiveTexture(GL_TEXTURE0);
+	std::vector<IntUniform> handles;
+	for (unsigned int i = 0; i < sampler_names.size(); i++) {
+		handles.push_back(shader.getIntUniform(sampler_names[i].c_str()));
+	}
+	return sampler_uniforms.insert(std::make_pair(shader.get(), handles)).first->second;
 }
 
 void Mesh::bindArrayBuffer() {
-	glBindVertexArray(VAO);
+	glBindVertexArray(getVAO());
 }
 
 void Mesh::unbindArrayBuffer() {
 	glBindVertexArray(0);
+}
+
+unsigned int Mesh::getVAO() {
+	return GeometryArena::get().getVAO(format);
+}
+
+unsigned int Mesh::getDepthVAO() {
+	return GeometryArena::get().getDepthVAO(format);
+}
+
+void Mesh::release() {
+	if (gpu_memory == 0) {
+		return;
+	}
+	GeometryArena::get().free(geometry);
+	total_gpu_memory -= gpu_memory;
+	gpu_memory = 0;
+}
+
+unsigned int Mesh::getIndexCount() {
+	return lods[0].index_count;
+}
+
+unsigned int Mesh::getLodCount() {
+	return (unsigned int)lods.size();
+}
+
+const MeshLod& Mesh::getLod(unsigned int level) {
+	return lods[level < lods.size() ? level : lods.size() - 1];
+}
+
+void Mesh::drawLod(unsigned int level, unsigned int instances) {
+	level = level < lods.size() ? level : (unsigned int)lods.size() - 1;
+	GLint base_vertex = (GLint)geometry.vertex_offset;
+	if (index_type == GL_UNSIGNED_INT) {
+		const MeshLod& lod = lods[level];
+		void* offset = (void*)(geometry.index_offset + lod.index_offset * sizeof(unsigned int));
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.index_count, GL_UNSIGNED_INT, offset, (GLsizei)instances, base_vertex);
+		return;
+	}
+
+	for (unsigned int c = lod_chunks[level]; c < lod_chunks[level + 1]; c++) {
+		const MeshIndexChunk& chunk = chunks[c];
+		void* offset = (void*)(geometry.index_offset + chunk.index_offset * sizeof(uint16_t));
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, chunk.index_count, GL_UNSIGNED_SHORT, offset, (GLsizei)instances, base_vertex + chunk.base_vertex);
+	}
+}
+
+void Mesh::appendDrawCommands(unsigned int level, unsigned int instances, unsigned int base_instance, std::vector<DrawElementsIndirectCommand>& commands) {
+	level = level < lods.size() ? level : (unsigned int)lods.size() - 1;
+	DrawElementsIndirectCommand command;
+	command.instance_count = instances;
+	command.base_instance = base_instance;
+	if (index_type == GL_UNSIGNED_INT) {
+		const MeshLod& lod = lods[level];
+		command.count = lod.index_count;
+		command.first_index = (unsigned int)(geometry.index_offset / sizeof(unsigned int)) + lod.index_offset;
+		command.base_vertex = (int)geometry.vertex_offset;
+		commands.push_back(command);
+		return;
+	}
+
+	for (unsigned int c = lod_chunks[level]; c < lod_chunks[level + 1]; c++) {
+		const MeshIndexChunk& chunk = chunks[c];
+		command.count = chunk.index_count;
+		command.first_index = (unsigned int)(geometry.index_offset / sizeof(uint16_t)) + chunk.index_offset;
+		command.base_vertex = (int)geometry.vertex_offset + chunk.base_vertex;
+		commands.push_back(command);
+	}
+}
+
+GLenum Mesh::getIndexType() {
+	return index_type;
+}
+
+// Expects the mesh VAO to be bound.
+void Mesh::bindInstanceData(unsigned int buffer, size_t offset) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (unsigned int i = 0; i < 4; i++) {
+		glVertexAttribPointer(INSTANCE_MODEL_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + i * sizeof(glm::vec4)));
+	}
+	glVertexAttribPointer(INSTANCE_COLOR_LOCATION, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, color)));
+	glVertexAttribIPointer(INSTANCE_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void*)(offset + offsetof(InstanceData, draw_id)));
+}
+
+const AABB& Mesh::getBounds() {
+	return bounds;
+}
+
+const BoundingSphere& Mesh::getSphere() {
+	return sphere;
+}
+
+VertexFormat Mesh::getVertexFormat() {
+	return format;
+}
+
+glm::vec3 Mesh::getPositionOffset() {
+	return position_offset;
+}
+
+glm::vec3 Mesh::getPositionScale() {
+	return position_scale;
+}
+
+size_t Mesh::getGpuMemory() {
+	return gpu_memory;
+}
+
+void Mesh::setDefaultVertexFormat(VertexFormat format) {
+	default_format = format;
+}
+
+VertexFormat Mesh::getDefaultVertexFormat() {
+	return default_format;
+}
+
+size_t Mesh::getTotalGpuMemory() {
+	return total_gpu_memory;
 }
\ No newline at end of file
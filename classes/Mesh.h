@@ -8,8 +8,12 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
+#include <map>
+#include <cstdint>
 
 #include "Shader.h"
+#include "Frustum.h"
+#include "GeometryArena.h"
 
 struct Vertex {
 	glm::vec3 position;
@@ -17,12 +21,96 @@ struct Vertex {
 	glm::vec2 tex_coords;
 };
 
+// Position in 16 bit fixed point across the mesh bounds (w unused, keeps the
+// normal 4 byte aligned), normal as signed normalized 10:10:10:2 and texture
+// coordinates as half floats. The vertex shaders map positions back through
+// the positionOffset/positionScale uniforms.
+struct PackedVertex {
+	uint16_t position[4];
+	uint32_t normal;
+	uint16_t tex_coords[2];
+};
+
+// Per-instance attributes, streamed by the render queue. The model matrix
+// takes four consecutive attribute locations.
+#define INSTANCE_MODEL_LOCATION 3
+#define INSTANCE_COLOR_LOCATION 7
+#define INSTANCE_DRAW_ID_LOCATION 8
+
+struct InstanceData {
+	glm::mat4 model;
+	glm::vec3 color;
+	// Index of the instance's draw in the per-draw buffer of the multi-draw
+	// path, unused otherwise.
+	unsigned int draw_id;
+};
+
+// Layout glMultiDrawElementsIndirect reads.
+struct DrawElementsIndirectCommand {
+	unsigned int count;
+	unsigned int instance_count;
+	unsigned int first_index;
+	int base_vertex;
+	unsigned int base_instance;
+};
+
 struct Texture {
 	unsigned int id;
 	std::string type;
 	std::string path;
 };
 
+// Level 0 is the full mesh, coarser levels follow in the same index buffer
+// and use the same vertices.
+#define MESH_MAX_LODS 4
+
+// Index range of one level of detail. error is how far the level deviates
+// from the full mesh, in model space units.
+struct MeshLod {
+	unsigned int index_offset;
+	unsigned int index_count;
+	float error;
+};
+
+// Meshes whose levels can't be cut into chunks averaging at least this many
+// triangles keep 32 bit indices rather than paying for the extra draws.
+#define MESH_MIN_CHUNK_TRIANGLES 4096
+
+// Part of a level whose vertices all lie within 64K of base_vertex, so its
+// indices fit in 16 bits. Chunks cover their level in order.
+struct MeshIndexChunk {
+	unsigned int index_offset;
+	unsigned int index_count;
+	int base_vertex;
+};
+
+// Splits every level into chunks, returns false if 16 bit indices aren't
+// worth it (see MESH_MIN_CHUNK_TRIANGLES).
+bool buildIndexChunks(const unsigned int* indices, const std::vector<MeshLod>& lods, std::vector<MeshIndexChunk>& chunks, std::vector<unsigned int>& lod_chunks);
+
+// CPU side mesh produced by the loaders off the render thread. Vertex and
+// index data either live in the vectors or point into memory owned
+// elsewhere (a mapped mesh cache); vertex_data/index_data always point at it.
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	const Vertex* vertex_data;
+	const unsigned int* index_data;
+	unsigned int num_vertices;
+	unsigned int num_indices;
+	// Texture ids are filled in at upload.
+	std::vector<Texture> textures;
+	// Empty means a single level covering all indices.
+	std::vector<MeshLod> lods;
+	AABB bounds;
+	BoundingSphere sphere;
+};
+
+void computeMeshBounds(const Vertex* vertices, unsigned int num_vertices, AABB& bounds, BoundingSphere& sphere);
+// Quantizes positions against bounds, which must contain every vertex.
+void packVertices(const Vertex* vertices, unsigned int num_vertices, const AABB& bounds, std::vector<PackedVertex>& packed);
+uint16_t floatToHalf(float f);
+
 class Mesh {
 
 	public:
@@ -31,13 +119,72 @@ class Mesh {
 		std::vector<Texture> textures;
 
 		Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
-		void draw(Shader& shader);
+		// Uploads straight from caller owned memory (e.g. a mapped mesh cache),
+		// the CPU side vertex and index vectors stay empty.
+		Mesh(const Vertex* vertices, unsigned int num_vertices, const unsigned int* indices, unsigned int num_indices, std::vector<Texture> textures, const AABB& bounds, const BoundingSphere& sphere, const std::vector<MeshLod>& lods, VertexFormat format = Mesh::getDefaultVertexFormat());
 		void bindArrayBuffer();
 		void unbindArrayBuffer();
+		// Shared by all meshes of the same vertex format.
+		unsigned int getVAO();
+		// Positions only, for depth passes. Indexed like getVAO.
+		unsigned int getDepthVAO();
+		// Gives the geometry back to the arena. Meshes are copied around by
+		// value, so only the owner calls this, once.
+		void release();
+		// Of level 0.
+		unsigned int getIndexCount();
+		unsigned int getLodCount();
+		const MeshLod& getLod(unsigned int level);
+		// Draws a level with whatever index type and chunks the mesh was
+		// uploaded with. Expects the VAO to be bound.
+		void drawLod(unsigned int level, unsigned int instances);
+		// The same draws as indirect commands, instances taken from
+		// base_instance on.
+		void appendDrawCommands(unsigned int level, unsigned int instances, unsigned int base_instance, std::vector<DrawElementsIndirectCommand>& commands);
+		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+		GLenum getIndexType();
+		void bindInstanceData(unsigned int buffer, size_t offset);
+		const AABB& getBounds();
+		const BoundingSphere& getSphere();
+		const std::vector<IntUniform>& getSamplerUniforms(Shader& shader);
+		VertexFormat getVertexFormat();
+		// Object space position = offset + attribute * scale, the identity for
+		// float vertices.
+		glm::vec3 getPositionOffset();
+		glm::vec3 getPositionScale();
+		// Bytes in the vertex and index buffers.
+		size_t getGpuMemory();
+
+		// Format of meshes created from here on.
+		static void setDefaultVertexFormat(VertexFormat format);
+		static VertexFormat getDefaultVertexFormat();
+		// Vertex and index buffer bytes of every mesh uploaded so far.
+		static size_t getTotalGpuMemory();
 
 	private:
-		unsigned int VAO, VBO, EBO;
-		void setupMesh();
+		// Vertex and index ranges in the shared buffers of the arena.
+		GeometryAllocation geometry;
+		std::vector<MeshLod> lods;
+		// Empty for 32 bit indices. lod_chunks[level] is the first chunk of
+		// the level, lod_chunks[level + 1] one past its last.
+		std::vector<MeshIndexChunk> chunks;
+		std::vector<unsigned int> lod_chunks;
+		GLenum index_type;
+		VertexFormat format;
+		glm::vec3 position_offset;
+		glm::vec3 position_scale;
+		size_t gpu_memory;
+		AABB bounds;
+		BoundingSphere sphere;
+		// Sampler names per texture slot, resolved to handles once per program.
+		std::vector<std::string> sampler_names;
+		std::map<unsigned int, std::vector<IntUniform>> sampler_uniforms;
+
+		void setupMesh(const Vertex* vertex_data, size_t num_vertices, const unsigned int* index_data, size_t num_indices);
+		void computeBounds();
+
+		static VertexFormat default_format;
+		static size_t total_gpu_memory;
 
 };
 
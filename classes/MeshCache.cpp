@@ -0,0 +1,267 @@
+#include "MeshCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+static uint64_t alignOffset(uint64_t offset) {
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+std::string MeshCache::directory;
+
+MeshCache::MeshCache() {
+	this->base = nullptr;
+	this->size = 0;
+	this->header = nullptr;
+	this->entries = nullptr;
+	this->textures = nullptr;
+	this->lods = nullptr;
+}
+
+bool MeshCache::open(const std::string& path, uint64_t source_hash, unsigned int import_flags) {
+	this->close();
+	if (!this->file.open(path)) {
+		return false;
+	}
+	if (!this->attach(this->file.data(), this->file.size())) {
+		if (this->header) {
+			std::cout << "WARNING::MESH_CACHE::CORRUPT " << path << std::endl;
+		}
+		this->close();
+		return false;
+	}
+	if (this->header->import_flags != import_flags || this->header->source_hash != source_hash) {
+		this->close();
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::open(const unsigned char* data, size_t size) {
+	this->close();
+	if (!this->attach(data, size)) {
+		this->close();
+		return false;
+	}
+	return true;
+}
+
+// Leaves header set when only the body failed validation.
+bool MeshCache::attach(const unsigned char* data, size_t size) {
+	if (size < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	const MeshCacheHeader* candidate = (const MeshCacheHeader*)data;
+	if (candidate->magic != MESH_CACHE_MAGIC || candidate->version != MESH_CACHE_VERSION || candidate->vertex_size != sizeof(Vertex)) {
+		return false;
+	}
+
+	this->base = data;
+	this->size = size;
+	this->header = candidate;
+	this->entries = (const MeshCacheEntry*)(data + sizeof(MeshCacheHeader));
+	this->textures = (const MeshCacheTexture*)(this->entries + this->header->mesh_count);
+	this->lods = (const MeshCacheLod*)(this->textures + this->header->texture_count);
+	return this->validate();
+}
+
+// Every range the loader will touch has to lie inside the mapping.
+bool MeshCache::validate() {
+	uint64_t size = this->size;
+	uint64_t tables = sizeof(MeshCacheHeader) + (uint64_t)this->header->mesh_count * sizeof(MeshCacheEntry) + (uint64_t)this->header->texture_count * sizeof(MeshCacheTexture) + (uint64_t)this->header->lod_count * sizeof(MeshCacheLod);
+	if (tables > size) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < this->header->mesh_count; i++) {
+		const MeshCacheEntry& entry = this->entries[i];
+		if (entry.vertex_offset % MESH_CACHE_ALIGNMENT != 0 || entry.index_offset % MESH_CACHE_ALIGNMENT != 0) {
+			return false;
+		}
+		if (entry.vertex_offset + (uint64_t)entry.vertex_count * sizeof(Vertex) > size) {
+			return false;
+		}
+		if (entry.index_offset + (uint64_t)entry.index_count * sizeof(unsigned int) > size) {
+			return false;
+		}
+		if ((uint64_t)entry.first_texture + entry.texture_count > this->header->texture_count) {
+			return false;
+		}
+		if ((uint64_t)entry.first_lod + entry.lod_count > this->header->lod_count) {
+			return false;
+		}
+		for (unsigned int l = 0; l < entry.lod_count; l++) {
+			const MeshCacheLod& lod = this->lods[entry.first_lod + l];
+			if ((uint64_t)lod.index_offset + lod.index_count > entry.index_count) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void MeshCache::close() {
+	this->file.close();
+	this->base = nullptr;
+	this->size = 0;
+	this->header = nullptr;
+	this->entries = nullptr;
+	this->textures = nullptr;
+	this->lods = nullptr;
+}
+
+unsigned int MeshCache::getMeshCount() {
+	return this->header ? this->header->mesh_count : 0;
+}
+
+unsigned int MeshCache::getMaterialFlags() {
+	return this->header ? this->header->material_flags : 0;
+}
+
+const MeshCacheEntry& MeshCache::getEntry(unsigned int mesh) {
+	return this->entries[mesh];
+}
+
+const Vertex* MeshCache::getVertices(unsigned int mesh) {
+	return (const Vertex*)(this->base + this->entries[mesh].vertex_offset);
+}
+
+const unsigned int* MeshCache::getIndices(unsigned int mesh) {
+	return (const unsigned int*)(this->base + this->entries[mesh].index_offset);
+}
+
+const MeshCacheTexture* MeshCache::getTextures(unsigned int mesh) {
+	return this->textures + this->entries[mesh].first_texture;
+}
+
+const MeshCacheLod* MeshCache::getLods(unsigned int mesh) {
+	return this->lods + this->entries[mesh].first_lod;
+}
+
+bool MeshCache::serialize(uint64_t source_hash, unsigned int import_flags, const std::vector<MeshData>& meshes, unsigned int material_flags, std::vector<unsigned char>& out) {
+	MeshCacheHeader header;
+	std::memset(&header, 0, sizeof(MeshCacheHeader));
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.vertex_size = sizeof(Vertex);
+	header.import_flags = import_flags;
+	header.source_hash = source_hash;
+	header.mesh_count = (uint32_t)meshes.size();
+	header.material_flags = material_flags;
+
+	std::vector<MeshCacheEntry> entries(meshes.size());
+	std::vector<MeshCacheTexture> textures;
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		entries[i].first_texture = (uint32_t)textures.size();
+		entries[i].texture_count = (uint32_t)meshes[i].textures.size();
+		for (unsigned int t = 0; t < meshes[i].textures.size(); t++) {
+			const Texture& texture = meshes[i].textures[t];
+			MeshCacheTexture record;
+			std::memset(&record, 0, sizeof(MeshCacheTexture));
+			if (texture.type.size() >= sizeof(record.type) || texture.path.size() >= sizeof(record.path)) {
+				std::cout << "WARNING::MESH_CACHE::TEXTURE_PATH_TOO_LONG " << texture.path << std::endl;
+				return false;
+			}
+			std::memcpy(record.type, texture.type.c_str(), texture.type.size());
+			std::memcpy(record.path, texture.path.c_str(), texture.path.size());
+			textures.push_back(record);
+		}
+	}
+	header.texture_count = (uint32_t)textures.size();
+
+	std::vector<MeshCacheLod> lods;
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		entries[i].first_lod = (uint32_t)lods.size();
+		entries[i].lod_count = (uint32_t)meshes[i].lods.size();
+		for (unsigned int l = 0; l < meshes[i].lods.size(); l++) {
+			MeshCacheLod record;
+			record.index_offset = meshes[i].lods[l].index_offset;
+			record.index_count = meshes[i].lods[l].index_count;
+			record.error = meshes[i].lods[l].error;
+			record.pad = 0;
+			lods.push_back(record);
+		}
+	}
+	header.lod_count = (uint32_t)lods.size();
+
+	uint64_t tables = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) + textures.size() * sizeof(MeshCacheTexture);
+	uint64_t offset = tables + lods.size() * sizeof(MeshCacheLod);
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		entries[i].vertex_count = meshes[i].num_vertices;
+		entries[i].index_count = meshes[i].num_indices;
+		entries[i].bounds = meshes[i].bounds;
+		entries[i].sphere = meshes[i].sphere;
+		offset = alignOffset(offset);
+		entries[i].vertex_offset = offset;
+		offset = alignOffset(offset + (uint64_t)meshes[i].num_vertices * sizeof(Vertex));
+		entries[i].index_offset = offset;
+		offset += (uint64_t)meshes[i].num_indices * sizeof(unsigned int);
+	}
+
+	out.assign(offset, 0);
+	unsigned char* bytes = out.data();
+	std::memcpy(bytes, &header, sizeof(MeshCacheHeader));
+	std::memcpy(bytes + sizeof(MeshCacheHeader), entries.data(), entries.size() * sizeof(MeshCacheEntry));
+	std::memcpy(bytes + sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry), textures.data(), textures.size() * sizeof(MeshCacheTexture));
+	std::memcpy(bytes + tables, lods.data(), lods.size() * sizeof(MeshCacheLod));
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		std::memcpy(bytes + entries[i].vertex_offset, meshes[i].vertex_data, (size_t)meshes[i].num_vertices * sizeof(Vertex));
+		std::memcpy(bytes + entries[i].index_offset, meshes[i].index_data, (size_t)meshes[i].num_indices * sizeof(unsigned int));
+	}
+	return true;
+}
+
+bool MeshCache::write(const std::string& path, uint64_t source_hash, unsigned int import_flags, const std::vector<MeshData>& meshes, unsigned int material_flags) {
+	std::vector<unsigned char> bytes;
+	if (!serialize(source_hash, import_flags, meshes, material_flags, bytes)) {
+		return false;
+	}
+
+	std::error_code error;
+	std::filesystem::path parent = std::filesystem::path(path).parent_path();
+	if (!parent.empty()) {
+		std::filesystem::create_directories(parent, error);
+	}
+
+	// Written under a temporary name and renamed, so a crash mid-write never
+	// leaves a cache that passes the header check.
+	std::string temp_path = path + ".tmp";
+	std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		std::cout << "WARNING::MESH_CACHE::WRITE_FAILED " << path << std::endl;
+		return false;
+	}
+	out.write((const char*)bytes.data(), bytes.size());
+	out.close();
+
+	if (!out) {
+		std::remove(temp_path.c_str());
+		std::cout << "WARNING::MESH_CACHE::WRITE_FAILED " << path << std::endl;
+		return false;
+	}
+	std::remove(path.c_str());
+	if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void MeshCache::setDirectory(const std::string& path) {
+	directory = path;
+}
+
+std::string MeshCache::pathFor(const std::string& source_path) {
+	if (directory.empty()) {
+		return source_path + ".meshcache";
+	}
+	std::error_code error;
+	std::filesystem::path source = std::filesystem::absolute(source_path, error).lexically_normal();
+	std::string key = source.generic_string();
+	char hash[17];
+	std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashBytes(key.data(), key.size()));
+	return (std::filesystem::path(directory) / (source.filename().string() + "." + hash + ".meshcache")).generic_string();
+}
@@ -0,0 +1,106 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Mesh.h"
+#include "Frustum.h"
+#include "MappedFile.h"
+
+#define MESH_CACHE_MAGIC 0x4843534Du // "MSCH"
+// Bump whenever the layout below, the Vertex struct or the import time
+// processing (MeshOptimizer) changes.
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_ALIGNMENT 16
+#define MESH_CACHE_HAS_DIFFUSE 1u
+#define MESH_CACHE_HAS_SPECULAR 2u
+
+// File layout: header, mesh entries, texture records, LOD records, then the
+// vertex and index blobs of each mesh, each aligned to MESH_CACHE_ALIGNMENT.
+// The blobs are byte for byte what Mesh uploads, so they go to glBufferData
+// as mapped; the index blob holds every LOD level back to back.
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_size;
+	uint32_t import_flags;
+	uint64_t source_hash;
+	uint32_t mesh_count;
+	uint32_t texture_count;
+	uint32_t material_flags;
+	uint32_t lod_count;
+	uint32_t pad[2];
+};
+
+struct MeshCacheEntry {
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t first_texture;
+	uint32_t texture_count;
+	uint32_t first_lod;
+	uint32_t lod_count;
+	AABB bounds;
+	BoundingSphere sphere;
+};
+
+struct MeshCacheTexture {
+	char type[32];
+	char path[224];
+};
+
+struct MeshCacheLod {
+	uint32_t index_offset;
+	uint32_t index_count;
+	float error;
+	uint32_t pad;
+};
+
+class MeshCache {
+
+	public:
+		MeshCache();
+
+		// Maps the cache and checks it was built from this source with these flags.
+		bool open(const std::string& path, uint64_t source_hash, unsigned int import_flags);
+		// Cache image that lives in memory owned by someone else (an asset
+		// archive). Only the layout is checked, the archive checks the source.
+		bool open(const unsigned char* data, size_t size);
+		void close();
+
+		unsigned int getMeshCount();
+		unsigned int getMaterialFlags();
+		const MeshCacheEntry& getEntry(unsigned int mesh);
+		const Vertex* getVertices(unsigned int mesh);
+		const unsigned int* getIndices(unsigned int mesh);
+		const MeshCacheTexture* getTextures(unsigned int mesh);
+		const MeshCacheLod* getLods(unsigned int mesh);
+
+		static bool write(const std::string& path, uint64_t source_hash, unsigned int import_flags, const std::vector<MeshData>& meshes, unsigned int material_flags);
+		// Same bytes write puts in the file.
+		static bool serialize(uint64_t source_hash, unsigned int import_flags, const std::vector<MeshData>& meshes, unsigned int material_flags, std::vector<unsigned char>& out);
+
+		// Caches go next to their source unless a directory is set, then
+		// into it under the source's file name and a hash of its path.
+		static void setDirectory(const std::string& path);
+		static std::string pathFor(const std::string& source_path);
+
+	private:
+		MappedFile file;
+		const unsigned char* base;
+		size_t size;
+		const MeshCacheHeader* header;
+		const MeshCacheEntry* entries;
+		const MeshCacheTexture* textures;
+		const MeshCacheLod* lods;
+
+		static std::string directory;
+
+		bool attach(const unsigned char* data, size_t size);
+		bool validate();
+};
+
+#endif
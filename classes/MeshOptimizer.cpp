@@ -0,0 +1,325 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "MappedFile.h"
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t num_indices, size_t num_vertices, unsigned int cache_size) {
+	VertexCacheStats stats;
+	stats.acmr = 0.0f;
+	stats.atvr = 0.0f;
+	stats.misses = 0;
+	if (num_indices < 3 || num_vertices == 0) {
+		return stats;
+	}
+
+	// A vertex is in the FIFO while fewer than cache_size misses happened
+	// since it went in.
+	std::vector<unsigned int> inserted(num_vertices, 0);
+	std::vector<unsigned char> referenced(num_vertices, 0);
+	unsigned int timestamp = cache_size + 1;
+	size_t unique = 0;
+	for (size_t i = 0; i < num_indices; i++) {
+		unsigned int index = indices[i];
+		if (!referenced[index]) {
+			referenced[index] = 1;
+			unique++;
+		}
+		if (timestamp - inserted[index] > cache_size) {
+			inserted[index] = timestamp++;
+			stats.misses++;
+		}
+	}
+
+	stats.acmr = (float)stats.misses / (float)(num_indices / 3);
+	stats.atvr = (float)stats.misses / (float)unique;
+	return stats;
+}
+
+size_t weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	size_t capacity = 1;
+	while (capacity < vertices.size() * 2) {
+		capacity <<= 1;
+	}
+	const unsigned int empty = ~0u;
+	std::vector<unsigned int> table(capacity, empty);
+	std::vector<unsigned int> remap(vertices.size());
+	std::vector<Vertex> welded;
+	welded.reserve(vertices.size());
+
+	// Vertex is eight floats with no padding, so bytes compare as values do
+	// (short of -0 and NaN, which only cost a missed weld).
+	for (size_t i = 0; i < vertices.size(); i++) {
+		size_t slot = (size_t)hashBytes(&vertices[i], sizeof(Vertex)) & (capacity - 1);
+		while (table[slot] != empty && std::memcmp(&welded[table[slot]], &vertices[i], sizeof(Vertex)) != 0) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if (table[slot] == empty) {
+			table[slot] = (unsigned int)welded.size();
+			welded.push_back(vertices[i]);
+		}
+		remap[i] = table[slot];
+	}
+
+	for (size_t i = 0; i < indices.size(); i++) {
+		indices[i] = remap[indices[i]];
+	}
+	vertices.swap(welded);
+	return vertices.size();
+}
+
+static float forsythScore(int cache_position, unsigned int remaining) {
+	if (remaining == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cache_position >= 0) {
+		// The last triangle's vertices get a fixed score so the next pick
+		// does not favour one of its edges over another.
+		if (cache_position < 3) {
+			score = 0.75f;
+		} else {
+			float scale = 1.0f / (MESH_OPTIMIZER_FORSYTH_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cache_position - 3) * scale, 1.5f);
+		}
+	}
+	// Vertices with few triangles left are finished off first.
+	return score + 2.0f / std::sqrt((float)remaining);
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t num_vertices) {
+	size_t num_triangles = indices.size() / 3;
+	if (num_triangles < 2) {
+		return;
+	}
+
+	// Triangle lists per vertex; the live part of each list shrinks as
+	// triangles are emitted.
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	for (size_t i = 0; i < num_triangles * 3; i++) {
+		remaining[indices[i]]++;
+	}
+	std::vector<unsigned int> offsets(num_vertices + 1, 0);
+	for (size_t v = 0; v < num_vertices; v++) {
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+	std::vector<unsigned int> adjacency(offsets[num_vertices]);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < num_triangles; t++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+		}
+	}
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (size_t v = 0; v < num_vertices; v++) {
+		vertex_score[v] = forsythScore(-1, remaining[v]);
+	}
+	std::vector<unsigned char> emitted(num_triangles, 0);
+
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+	unsigned int cache[MESH_OPTIMIZER_FORSYTH_CACHE_SIZE + 3];
+	unsigned int next_cache[MESH_OPTIMIZER_FORSYTH_CACHE_SIZE + 3];
+	unsigned int cache_count = 0;
+	size_t cursor = 0;
+	long best = -1;
+
+	for (size_t emitted_count = 0; emitted_count < num_triangles; emitted_count++) {
+		if (best < 0) {
+			// Nothing in the cache has triangles left, restart from the
+			// next triangle in input order.
+			while (emitted[cursor]) {
+				cursor++;
+			}
+			best = (long)cursor;
+		}
+
+		const unsigned int* triangle = &indices[best * 3];
+		result.push_back(triangle[0]);
+		result.push_back(triangle[1]);
+		result.push_back(triangle[2]);
+		emitted[best] = 1;
+
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = triangle[k];
+			unsigned int* list = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++) {
+				if (list[j] == (unsigned int)best) {
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// New LRU order: the triangle's vertices in front, then the old
+		// entries. Anything past the cache size falls out.
+		unsigned int next_count = 0;
+		for (int k = 0; k < 3; k++) {
+			// Degenerate triangles repeat a vertex, it only takes one slot.
+			if ((k < 1 || triangle[k] != triangle[0]) && (k < 2 || triangle[k] != triangle[1])) {
+				next_cache[next_count++] = triangle[k];
+			}
+		}
+		for (unsigned int j = 0; j < cache_count; j++) {
+			unsigned int v = cache[j];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+				next_cache[next_count++] = v;
+			}
+		}
+		for (unsigned int j = MESH_OPTIMIZER_FORSYTH_CACHE_SIZE; j < next_count; j++) {
+			cache_position[next_cache[j]] = -1;
+			vertex_score[next_cache[j]] = forsythScore(-1, remaining[next_cache[j]]);
+		}
+		cache_count = std::min(next_count, (unsigned int)MESH_OPTIMIZER_FORSYTH_CACHE_SIZE);
+		for (unsigned int j = 0; j < cache_count; j++) {
+			cache[j] = next_cache[j];
+			cache_position[cache[j]] = (int)j;
+			vertex_score[cache[j]] = forsythScore((int)j, remaining[cache[j]]);
+		}
+
+		// Only triangles touching the cache changed score, and the best
+		// one is among them unless the cache has run dry.
+		best = -1;
+		float best_score = -1.0f;
+		for (unsigned int j = 0; j < cache_count; j++) {
+			unsigned int v = cache[j];
+			const unsigned int* list = &adjacency[offsets[v]];
+			for (unsigned int n = 0; n < remaining[v]; n++) {
+				unsigned int t = list[n];
+				float score = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+				if (score > best_score) {
+					best_score = score;
+					best = (long)t;
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+struct OverdrawCluster {
+	unsigned int first;
+	unsigned int count;
+	float sort_key;
+};
+
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold) {
+	size_t num_triangles = indices.size() / 3;
+	if (num_triangles < 2) {
+		return;
+	}
+	VertexCacheStats input = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	// A triangle that misses on all three vertices starts a new cluster,
+	// moving clusters around then costs nothing the order didn't already pay.
+	std::vector<OverdrawCluster> clusters;
+	std::vector<unsigned int> inserted(vertices.size(), 0);
+	unsigned int timestamp = MESH_OPTIMIZER_CACHE_SIZE + 1;
+	for (size_t t = 0; t < num_triangles; t++) {
+		int misses = 0;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = indices[t * 3 + k];
+			if (timestamp - inserted[v] > MESH_OPTIMIZER_CACHE_SIZE) {
+				inserted[v] = timestamp++;
+				misses++;
+			}
+		}
+		if (misses == 3 || clusters.empty()) {
+			OverdrawCluster cluster;
+			cluster.first = (unsigned int)t;
+			cluster.count = 0;
+			cluster.sort_key = 0.0f;
+			clusters.push_back(cluster);
+		}
+		clusters.back().count++;
+	}
+	if (clusters.size() < 2) {
+		return;
+	}
+
+	// Area weighted centroid and normal per cluster. Clusters far out along
+	// their own normal are likely to cover the rest, so they go first.
+	std::vector<glm::vec3> centroids(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (unsigned int c = 0; c < clusters.size(); c++) {
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for (unsigned int t = clusters[c].first; t < clusters[c].first + clusters[c].count; t++) {
+			const glm::vec3& a = vertices[indices[t * 3]].position;
+			const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& p = vertices[indices[t * 3 + 2]].position;
+			glm::vec3 cross = glm::cross(b - a, p - a);
+			float triangle_area = glm::length(cross);
+			centroid += (a + b + p) * (triangle_area / 3.0f);
+			normal += cross;
+			area += triangle_area;
+		}
+		centroids[c] = area > 0.0f ? centroid / area : glm::vec3(0.0f);
+		normals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f);
+		mesh_centroid += centroid;
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f) {
+		mesh_centroid /= mesh_area;
+	}
+	for (unsigned int c = 0; c < clusters.size(); c++) {
+		clusters[c].sort_key = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster& a, const OverdrawCluster& b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (unsigned int c = 0; c < clusters.size(); c++) {
+		result.insert(result.end(), indices.begin() + clusters[c].first * 3, indices.begin() + (clusters[c].first + clusters[c].count) * 3);
+	}
+
+	VertexCacheStats output = analyzeVertexCache(result.data(), result.size(), vertices.size());
+	if (output.acmr <= input.acmr * threshold) {
+		indices.swap(result);
+	}
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+	const unsigned int unused = ~0u;
+	std::vector<unsigned int> remap(vertices.size(), unused);
+	std::vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++) {
+		unsigned int& target = remap[indices[i]];
+		if (target == unused) {
+			target = (unsigned int)ordered.size();
+			ordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = target;
+	}
+	vertices.swap(ordered);
+}
+
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, MeshOptimizeReport& report) {
+	auto start = std::chrono::high_resolution_clock::now();
+	report.vertices_before = (unsigned int)vertices.size();
+	report.before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+
+	weldVertices(vertices, indices);
+	optimizeVertexCache(indices, vertices.size());
+	optimizeOverdraw(indices, vertices);
+	optimizeVertexFetch(vertices, indices);
+
+	report.vertices_after = (unsigned int)vertices.size();
+	report.after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+	auto end = std::chrono::high_resolution_clock::now();
+	report.time = std::chrono::duration<double, std::milli>(end - start).count();
+}
@@ -0,0 +1,49 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Mesh.h"
+
+// FIFO size the stats are measured with, close to what post-transform
+// caches behave like on current hardware.
+#define MESH_OPTIMIZER_CACHE_SIZE 16
+// LRU size the Forsyth scoring is tuned for.
+#define MESH_OPTIMIZER_FORSYTH_CACHE_SIZE 32
+// Overdraw ordering may cost at most this much ACMR over the cache order.
+#define MESH_OPTIMIZER_OVERDRAW_THRESHOLD 1.05f
+
+struct VertexCacheStats {
+	// Cache misses per triangle, 0.5 is the ideal for a regular grid, 3 the worst.
+	float acmr;
+	// Cache misses per referenced vertex, 1.0 is the ideal.
+	float atvr;
+	unsigned int misses;
+};
+
+struct MeshOptimizeReport {
+	VertexCacheStats before;
+	VertexCacheStats after;
+	unsigned int vertices_before;
+	unsigned int vertices_after;
+	double time;
+};
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t num_indices, size_t num_vertices, unsigned int cache_size = MESH_OPTIMIZER_CACHE_SIZE);
+
+// Merges bit identical vertices, returns the new vertex count.
+size_t weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+// Tom Forsyth's linear-speed vertex cache optimisation.
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t num_vertices);
+// Cuts the cache ordered triangles into clusters at hard cache boundaries and
+// sorts the clusters front to back as seen from outside the mesh (Sander et
+// al. 2007), as long as the ACMR stays within threshold of the input order.
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, float threshold = MESH_OPTIMIZER_OVERDRAW_THRESHOLD);
+// Renumbers vertices in order of first use and drops unreferenced ones.
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// All of the above in order, stats taken before and after.
+void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, MeshOptimizeReport& report);
+
+#endif
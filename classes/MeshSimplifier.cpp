@@ -0,0 +1,357 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+// Fraction of the full triangle count for each level past 0.
+static const float lod_ratios[MESH_MAX_LODS - 1] = { 0.5f, 0.25f, 0.1f };
+
+// Symmetric 4x4 plane quadric, upper triangle only. weight is the summed
+// triangle area so the error can be turned back into a distance.
+struct Quadric {
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+	double weight;
+};
+
+static void addPlane(Quadric& q, const glm::dvec3& n, double d, double w) {
+	q.a00 += w * n.x * n.x;
+	q.a01 += w * n.x * n.y;
+	q.a02 += w * n.x * n.z;
+	q.a03 += w * n.x * d;
+	q.a11 += w * n.y * n.y;
+	q.a12 += w * n.y * n.z;
+	q.a13 += w * n.y * d;
+	q.a22 += w * n.z * n.z;
+	q.a23 += w * n.z * d;
+	q.a33 += w * d * d;
+	q.weight += w;
+}
+
+static void addQuadric(Quadric& q, const Quadric& r) {
+	q.a00 += r.a00;
+	q.a01 += r.a01;
+	q.a02 += r.a02;
+	q.a03 += r.a03;
+	q.a11 += r.a11;
+	q.a12 += r.a12;
+	q.a13 += r.a13;
+	q.a22 += r.a22;
+	q.a23 += r.a23;
+	q.a33 += r.a33;
+	q.weight += r.weight;
+}
+
+// Squared distance to the planes, averaged by area.
+static double evaluate(const Quadric& q, const glm::vec3& p) {
+	double x = p.x, y = p.y, z = p.z;
+	double e = q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x
+		+ q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y
+		+ q.a22 * z * z + 2.0 * q.a23 * z
+		+ q.a33;
+	return q.weight > 0.0 ? std::max(e, 0.0) / q.weight : 0.0;
+}
+
+struct Collapse {
+	unsigned int from;
+	unsigned int to;
+	double cost;
+};
+
+// Working state of one simplifyMesh call. Collapses work on positions, a
+// position's wedges (vertices that share it but differ in normal or UV) are
+// remapped one by one.
+struct Simplifier {
+	std::vector<unsigned int> triangles;
+	std::vector<unsigned char> triangle_alive;
+	std::vector<unsigned int> position_of;
+	std::vector<glm::vec3> positions;
+	std::vector<std::vector<unsigned int>> adjacency;
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned char> locked;
+	std::vector<unsigned char> removed;
+	std::vector<std::pair<unsigned int, unsigned int>> wedge_map;
+	size_t live;
+
+	double cost(unsigned int from, unsigned int to) {
+		Quadric q = this->quadrics[from];
+		addQuadric(q, this->quadrics[to]);
+		return evaluate(q, this->positions[to]);
+	}
+
+	int cornerOf(unsigned int t, unsigned int position) {
+		for (int k = 0; k < 3; k++) {
+			if (this->position_of[this->triangles[t * 3 + k]] == position) {
+				return k;
+			}
+		}
+		return -1;
+	}
+
+	const unsigned int* mappedWedge(unsigned int wedge) {
+		for (unsigned int i = 0; i < this->wedge_map.size(); i++) {
+			if (this->wedge_map[i].first == wedge) {
+				return &this->wedge_map[i].second;
+			}
+		}
+		return nullptr;
+	}
+
+	// Every wedge of from has to find its counterpart on a triangle that
+	// spans the edge, and no triangle may flip.
+	bool canCollapse(unsigned int from, unsigned int to) {
+		this->wedge_map.clear();
+		const std::vector<unsigned int>& around = this->adjacency[from];
+		for (unsigned int i = 0; i < around.size(); i++) {
+			unsigned int t = around[i];
+			if (!this->triangle_alive[t]) {
+				continue;
+			}
+			int corner_to = this->cornerOf(t, to);
+			if (corner_to < 0) {
+				continue;
+			}
+			unsigned int wedge_from = this->triangles[t * 3 + this->cornerOf(t, from)];
+			unsigned int wedge_to = this->triangles[t * 3 + corner_to];
+			const unsigned int* mapped = this->mappedWedge(wedge_from);
+			if (mapped && *mapped != wedge_to) {
+				return false;
+			}
+			if (!mapped) {
+				this->wedge_map.push_back(std::make_pair(wedge_from, wedge_to));
+			}
+		}
+		if (this->wedge_map.empty()) {
+			return false;
+		}
+
+		for (unsigned int i = 0; i < around.size(); i++) {
+			unsigned int t = around[i];
+			if (!this->triangle_alive[t] || this->cornerOf(t, to) >= 0) {
+				continue;
+			}
+			int corner = this->cornerOf(t, from);
+			if (!this->mappedWedge(this->triangles[t * 3 + corner])) {
+				return false;
+			}
+
+			glm::vec3 p[3];
+			for (int k = 0; k < 3; k++) {
+				p[k] = this->positions[this->position_of[this->triangles[t * 3 + k]]];
+			}
+			glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			p[corner] = this->positions[to];
+			glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float lengths = glm::length(before) * glm::length(after);
+			if (lengths > 0.0f && glm::dot(before, after) < 0.25f * lengths) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Expects canCollapse to have just filled wedge_map for this pair.
+	void collapse(unsigned int from, unsigned int to) {
+		std::vector<unsigned int>& around = this->adjacency[from];
+		for (unsigned int i = 0; i < around.size(); i++) {
+			unsigned int t = around[i];
+			if (!this->triangle_alive[t]) {
+				continue;
+			}
+			if (this->cornerOf(t, to) >= 0) {
+				this->triangle_alive[t] = 0;
+				this->live--;
+				continue;
+			}
+			int corner = this->cornerOf(t, from);
+			this->triangles[t * 3 + corner] = *this->mappedWedge(this->triangles[t * 3 + corner]);
+			this->adjacency[to].push_back(t);
+		}
+		around.clear();
+		addQuadric(this->quadrics[to], this->quadrics[from]);
+		this->removed[from] = 1;
+	}
+};
+
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, size_t target_index_count, float& error) {
+	error = 0.0f;
+	size_t num_triangles = indices.size() / 3;
+	if (target_index_count >= indices.size() || num_triangles == 0) {
+		return indices;
+	}
+
+	Simplifier s;
+	s.triangles = indices;
+	s.triangle_alive.assign(num_triangles, 1);
+	s.live = num_triangles;
+
+	// Weld by position only, through an open addressed table.
+	size_t capacity = 1;
+	while (capacity < vertices.size() * 2) {
+		capacity <<= 1;
+	}
+	std::vector<unsigned int> table(capacity, ~0u);
+	s.position_of.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		const glm::vec3& p = vertices[i].position;
+		size_t slot = (size_t)hashBytes(&p, sizeof(glm::vec3)) & (capacity - 1);
+		while (table[slot] != ~0u && std::memcmp(&s.positions[table[slot]], &p, sizeof(glm::vec3)) != 0) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		if (table[slot] == ~0u) {
+			table[slot] = (unsigned int)s.positions.size();
+			s.positions.push_back(p);
+		}
+		s.position_of[i] = table[slot];
+	}
+	size_t num_positions = s.positions.size();
+
+	Quadric zero;
+	std::memset(&zero, 0, sizeof(Quadric));
+	s.adjacency.resize(num_positions);
+	s.quadrics.assign(num_positions, zero);
+	s.locked.assign(num_positions, 0);
+	s.removed.assign(num_positions, 0);
+
+	std::unordered_map<uint64_t, unsigned int> edge_uses;
+	for (size_t t = 0; t < num_triangles; t++) {
+		unsigned int p[3];
+		for (int k = 0; k < 3; k++) {
+			p[k] = s.position_of[s.triangles[t * 3 + k]];
+		}
+		for (int k = 0; k < 3; k++) {
+			if (k == 0 || (p[k] != p[0] && (k < 2 || p[k] != p[1]))) {
+				s.adjacency[p[k]].push_back((unsigned int)t);
+			}
+			unsigned int a = std::min(p[k], p[(k + 1) % 3]);
+			unsigned int b = std::max(p[k], p[(k + 1) % 3]);
+			if (a != b) {
+				edge_uses[((uint64_t)a << 32) | b]++;
+			}
+		}
+
+		glm::dvec3 p0(s.positions[p[0]]);
+		glm::dvec3 cross = glm::cross(glm::dvec3(s.positions[p[1]]) - p0, glm::dvec3(s.positions[p[2]]) - p0);
+		double length = glm::length(cross);
+		if (length > 0.0) {
+			glm::dvec3 normal = cross / length;
+			for (int k = 0; k < 3; k++) {
+				addPlane(s.quadrics[p[k]], normal, -glm::dot(normal, p0), length * 0.5);
+			}
+		}
+	}
+	// Open borders and non-manifold edges keep their vertices, which holds
+	// silhouettes and holes in place without border quadrics.
+	for (auto iter = edge_uses.begin(); iter != edge_uses.end(); ++iter) {
+		if (iter->second != 2) {
+			s.locked[iter->first >> 32] = 1;
+			s.locked[iter->first & 0xFFFFFFFFu] = 1;
+		}
+	}
+
+	// Each pass ranks every edge once and takes the cheapest collapses that
+	// don't share a vertex; costs change after that, so the next pass re-ranks.
+	size_t target_triangles = target_index_count / 3;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned char> touched(num_positions);
+	double max_cost = 0.0;
+	const double infinite = std::numeric_limits<double>::max();
+	while (s.live > target_triangles) {
+		collapses.clear();
+		for (size_t t = 0; t < num_triangles; t++) {
+			if (!s.triangle_alive[t]) {
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = s.position_of[s.triangles[t * 3 + k]];
+				unsigned int b = s.position_of[s.triangles[t * 3 + (k + 1) % 3]];
+				// Consistently wound neighbours see the edge once each way.
+				if (a >= b) {
+					continue;
+				}
+				double cost_ab = s.locked[a] ? infinite : s.cost(a, b);
+				double cost_ba = s.locked[b] ? infinite : s.cost(b, a);
+				if (cost_ab == infinite && cost_ba == infinite) {
+					continue;
+				}
+				Collapse c;
+				c.from = cost_ab <= cost_ba ? a : b;
+				c.to = cost_ab <= cost_ba ? b : a;
+				c.cost = std::min(cost_ab, cost_ba);
+				collapses.push_back(c);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.cost < y.cost;
+		});
+
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t collapsed = 0;
+		for (size_t i = 0; i < collapses.size() && s.live > target_triangles; i++) {
+			const Collapse& c = collapses[i];
+			if (touched[c.from] || touched[c.to] || s.removed[c.from] || s.removed[c.to]) {
+				continue;
+			}
+			if (!s.canCollapse(c.from, c.to)) {
+				continue;
+			}
+			s.collapse(c.from, c.to);
+			touched[c.from] = 1;
+			touched[c.to] = 1;
+			max_cost = std::max(max_cost, c.cost);
+			collapsed++;
+		}
+		if (collapsed == 0) {
+			break;
+		}
+	}
+
+	std::vector<unsigned int> result;
+	result.reserve(s.live * 3);
+	for (size_t t = 0; t < num_triangles; t++) {
+		if (s.triangle_alive[t]) {
+			result.insert(result.end(), s.triangles.begin() + t * 3, s.triangles.begin() + t * 3 + 3);
+		}
+	}
+	error = (float)std::sqrt(max_cost);
+	return result;
+}
+
+void buildLodChain(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<MeshLod>& lods) {
+	lods.clear();
+	MeshLod full;
+	full.index_offset = 0;
+	full.index_count = (unsigned int)indices.size();
+	full.error = 0.0f;
+	lods.push_back(full);
+
+	// Each level starts from the one before, which is far cheaper than going
+	// back to the full mesh; the errors add up along the chain.
+	std::vector<unsigned int> source(indices);
+	float error = 0.0f;
+	for (int level = 0; level < MESH_MAX_LODS - 1; level++) {
+		size_t target = (size_t)(full.index_count / 3 * lod_ratios[level]) * 3;
+		float level_error;
+		std::vector<unsigned int> simplified = simplifyMesh(vertices, source, target, level_error);
+		if (simplified.empty() || simplified.size() > source.size() * MESH_LOD_MIN_REDUCTION) {
+			break;
+		}
+		optimizeVertexCache(simplified, vertices.size());
+		error += level_error;
+
+		MeshLod lod;
+		lod.index_offset = (unsigned int)indices.size();
+		lod.index_count = (unsigned int)simplified.size();
+		lod.error = error;
+		lods.push_back(lod);
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		source.swap(simplified);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Mesh.h"
+
+// A level is dropped from the chain unless it has at most this fraction of
+// the previous level's triangles.
+#define MESH_LOD_MIN_REDUCTION 0.9f
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997) restricted
+// to existing vertices, so every level can index the original vertex buffer.
+// Vertices on open borders stay put; attribute seams only collapse along
+// themselves. error receives the largest deviation introduced, in model units.
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, size_t target_index_count, float& error);
+
+// Appends the coarser levels (50%, 25% and 10% of the triangles) to indices
+// and describes every level, the full mesh included, in lods.
+void buildLodChain(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<MeshLod>& lods);
+
+#endif
@@ -1,60 +1,349 @@
 #include "Model.h"
 
-Model::Model(std::string path) {
-	loadModel(path);
+#include <algorithm>
+#include <chrono>
+
+Model::Model() {
+	this->asset = this;
+	this->proxy = -1;
+	this->dirty = false;
+	this->moved = false;
+	this->is_static = false;
+	this->dirty_list = nullptr;
+	this->ready = false;
+	this->lod = 0;
+	this->load_time = 0.0;
+	this->from_cache = false;
+	this->has_diffuse = false;
+	this->has_specular = false;
+	this->bounds.min = glm::vec3(0.0f);
+	this->bounds.max = glm::vec3(0.0f);
+	this->sphere.center = glm::vec3(0.0f);
+	this->sphere.radius = 0.0f;
+	this->setPosition(glm::vec3(0.0f, 0.0f, 0.0f));
+	this->setColor(glm::vec3(0.5f, 0.5f, 0.5f));
+	this->setScale(glm::vec3(1.0f));
 }
 
-void Model::draw(Shader& shader) {
-	for (unsigned int i = 0; i < meshes.size(); i++) {
-		meshes[i].draw(shader);
+Model::Model(std::string path, int loader) : Model() {
+	loadModel(path, loader);
+}
+
+Model::Model(Model* asset) : Model() {
+	this->asset = asset;
+	this->directory = asset->directory;
+}
+
+Model::~Model() {
+	for (unsigned int i = 0; i < this->texture_refs.size(); i++) {
+		TextureCache::get().release(this->texture_refs[i]);
+	}
+	// Instances have no meshes of their own.
+	for (unsigned int i = 0; i < this->meshes.size(); i++) {
+		this->meshes[i].release();
 	}
 }
 
 void Model::bindArrayBuffer() {
+	std::vector<Mesh>& meshes = this->getMeshes();
 	for (unsigned int i = 0; i < meshes.size(); i++) {
 		meshes[i].bindArrayBuffer();
 	}
 }
 
 void Model::unbindArrayBuffer() {
+	std::vector<Mesh>& meshes = this->getMeshes();
 	for (unsigned int i = 0; i < meshes.size(); i++) {
 		meshes[i].bindArrayBuffer();
 	}
 }
 
-void Model::loadModel(std::string path) {
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+void Model::loadModel(std::string path, int loader) {
+	ModelData data;
+	prepare(path, loader, data);
+	while (!this->uploadStep(data)) {
+	}
+	this->finishLoad(data);
+}
 
-	this->has_diffuse = false;
-	this->has_specular = false;
+// Runs on worker threads for async loads, so only data is written to.
+void Model::prepare(std::string path, int loader, ModelData& data, unsigned int parse_threads) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	data.path = path;
+	data.directory = path.substr(0, path.find_last_of('/'));
+	data.loader = loader;
+	data.loaded = false;
+	data.prepare_time = 0.0;
+	data.from_cache = false;
+	data.from_archive = false;
+	data.has_diffuse = false;
+	data.has_specular = false;
+	data.uploaded_textures = 0;
+	data.uploaded_meshes = 0;
+
+	// A cooked archive wins over the loose file whichever loader was asked
+	// for. The source is only stat'ed then, and hashed when its size or
+	// modification time changed since it was cooked.
+	if (AssetArchive::get().loadMesh(path, data.cache)) {
+		data.from_cache = loadFromCache(data);
+		data.from_archive = data.from_cache;
+	}
+
+	// The cache is keyed by the source contents, so edits to the file are
+	// picked up without having to compare timestamps.
+	unsigned int import_flags = loader == MODEL_LOADER_OBJ ? OBJ_LOADER_CACHE_FLAGS : MODEL_IMPORT_FLAGS;
+	uint64_t source_hash = 0;
+	std::string cache_path = MeshCache::pathFor(path);
+	MappedFile source;
+	if (!data.from_archive && source.open(path)) {
+		source_hash = hashBytes(source.data(), source.size());
+		source.close();
+
+		if (data.cache.open(cache_path, source_hash, import_flags)) {
+			data.from_cache = loadFromCache(data);
+		}
+	}
+
+	if (!data.from_cache) {
+		data.meshes.clear();
+		data.textures.clear();
+
+		bool loaded = loader == MODEL_LOADER_OBJ ? loadObj(data, parse_threads) : loadAssimp(data);
+		if (!loaded) {
+			return;
+		}
+
+		for (unsigned int i = 0; i < data.meshes.size(); i++) {
+			MeshData& mesh = data.meshes[i];
+			// Done once per import, the mesh cache keeps the result.
+			MeshOptimizeReport report;
+			optimizeMesh(mesh.vertices, mesh.indices, report);
+			std::cout << "Optimized " << data.path << " mesh " << i << ": ACMR " << report.before.acmr << " -> " << report.after.acmr
+				<< ", ATVR " << report.before.atvr << " -> " << report.after.atvr
+				<< ", vertices " << report.vertices_before << " -> " << report.vertices_after << " (" << report.time << " ms)" << std::endl;
+			buildLodChain(mesh.vertices, mesh.indices, mesh.lods);
+
+			mesh.vertex_data = mesh.vertices.data();
+			mesh.index_data = mesh.indices.data();
+			mesh.num_vertices = (unsigned int)mesh.vertices.size();
+			mesh.num_indices = (unsigned int)mesh.indices.size();
+			computeMeshBounds(mesh.vertex_data, mesh.num_vertices, mesh.bounds, mesh.sphere);
+		}
+
+		unsigned int material_flags = (data.has_diffuse ? MESH_CACHE_HAS_DIFFUSE : 0) | (data.has_specular ? MESH_CACHE_HAS_SPECULAR : 0);
+		if (source_hash != 0) {
+			MeshCache::write(cache_path, source_hash, import_flags, data.meshes, material_flags);
+		}
+	}
+
+	// Images another model already uploaded are only referenced at upload,
+	// the rest are decoded and mipped side by side.
+	std::vector<std::string> filenames;
+	std::vector<TextureData*> images;
+	for (unsigned int i = 0; i < data.textures.size(); i++) {
+		std::string filename = data.directory + '/' + data.textures[i].path;
+		if (TextureCache::get().contains(filename)) {
+			continue;
+		}
+		if (!AssetArchive::get().loadTexture(filename, TEXTURE_FLIP_Y, data.textures[i])) {
+			filenames.push_back(filename);
+			images.push_back(&data.textures[i]);
+		}
+	}
+	if (!images.empty()) {
+		TextureCache::get().decodeAll(filenames, images, true, true);
+	}
+
+	data.loaded = true;
+	auto end = std::chrono::high_resolution_clock::now();
+	data.prepare_time = std::chrono::duration<double, std::milli>(end - start).count();
+	data.load_time = data.prepare_time;
+}
+
+// Textures go first so meshes can take their ids, then one mesh per call.
+bool Model::uploadStep(ModelData& data) {
+	if (!data.loaded) {
+		return true;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (data.uploaded_textures < data.textures.size()) {
+		TextureData& image = data.textures[data.uploaded_textures];
+		std::string filename = data.directory + '/' + image.path;
+		if (image.pixels) {
+			TextureCache::get().insert(filename, TEXTURE_FLIP_Y, image);
+		} else {
+			image.id = TextureCache::get().acquire(filename);
+		}
+		this->texture_refs.push_back(image.id);
+		data.uploaded_textures++;
+	} else if (data.uploaded_meshes < data.meshes.size()) {
+		MeshData& mesh = data.meshes[data.uploaded_meshes];
+		for (unsigned int t = 0; t < mesh.textures.size(); t++) {
+			for (unsigned int j = 0; j < data.textures.size(); j++) {
+				if (data.textures[j].path == mesh.textures[t].path) {
+					mesh.textures[t].id = data.textures[j].id;
+					break;
+				}
+			}
+		}
+		this->meshes.push_back(Mesh(mesh.vertex_data, mesh.num_vertices, mesh.index_data, mesh.num_indices, mesh.textures, mesh.bounds, mesh.sphere, mesh.lods));
+		data.uploaded_meshes++;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	data.load_time += std::chrono::duration<double, std::milli>(end - start).count();
+	return data.uploaded_textures == data.textures.size() && data.uploaded_meshes == data.meshes.size();
+}
+
+void Model::finishLoad(ModelData& data) {
+	this->directory = data.directory;
+	this->has_diffuse = data.has_diffuse;
+	this->has_specular = data.has_specular;
+	this->from_cache = data.from_cache;
+	this->load_time = data.load_time;
+
+	// CPU copies are done with once the buffers exist.
+	data.meshes.clear();
+	data.textures.clear();
+	data.cache.close();
+
+	this->computeBounds();
+	this->computeLodErrors();
+	this->ready = true;
+
+	if (data.loaded) {
+		const char* source_name = data.from_archive ? "archive" : this->from_cache ? "mesh cache" : (data.loader == MODEL_LOADER_OBJ ? "obj" : "assimp");
+		std::cout << "Loaded " << data.path << " in " << this->load_time << " ms (" << source_name << ", " << data.prepare_time << " ms before upload)" << std::endl;
+	}
+}
+
+bool Model::loadAssimp(ModelData& data) {
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(data.path, MODEL_IMPORT_FLAGS);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 		std::cout << "Error::ASSIMP::" << importer.GetErrorString() << std::endl;
-		return;
+		return false;
 	}
-	directory = path.substr(0, path.find_last_of('/'));
-	
-	processNode(scene->mRootNode, scene);
-	this->setPosition(glm::vec3(0.0f, 0.0f, 0.0f));
-	this->setColor(glm::vec3(0.5f, 0.5f, 0.5f));
-	this->setScale(glm::vec3(1.0f));
+
+	processNode(scene->mRootNode, scene, data);
+	return true;
+}
+
+bool Model::loadObj(ModelData& data, unsigned int num_threads) {
+	ObjLoader loader(num_threads);
+	if (!loader.load(data.path)) {
+		return false;
+	}
+
+	std::vector<ObjMesh>& obj_meshes = loader.getMeshes();
+	for (unsigned int i = 0; i < obj_meshes.size(); i++) {
+		MeshData mesh;
+		mesh.vertices = std::move(obj_meshes[i].vertices);
+		mesh.indices = std::move(obj_meshes[i].indices);
+
+		const ObjMaterial* material = loader.findMaterial(obj_meshes[i].material);
+		// Same per mesh material flags as processMesh.
+		data.has_diffuse = material != nullptr && !material->diffuse_map.empty();
+		data.has_specular = material != nullptr && !material->specular_map.empty();
+		if (data.has_diffuse) {
+			mesh.textures.push_back(addTexture(data, material->diffuse_map.c_str(), "texture_diffuse"));
+		}
+		if (data.has_specular) {
+			mesh.textures.push_back(addTexture(data, material->specular_map.c_str(), "texture_specular"));
+		}
+		data.meshes.push_back(std::move(mesh));
+	}
+	return true;
+}
+
+// Vertex and index data stay in the mapping until they are uploaded.
+bool Model::loadFromCache(ModelData& data) {
+	MeshCache& cache = data.cache;
+	unsigned int material_flags = cache.getMaterialFlags();
+	data.has_diffuse = (material_flags & MESH_CACHE_HAS_DIFFUSE) != 0;
+	data.has_specular = (material_flags & MESH_CACHE_HAS_SPECULAR) != 0;
+
+	for (unsigned int i = 0; i < cache.getMeshCount(); i++) {
+		const MeshCacheEntry& entry = cache.getEntry(i);
+		const MeshCacheTexture* records = cache.getTextures(i);
+
+		MeshData mesh;
+		mesh.vertex_data = cache.getVertices(i);
+		mesh.index_data = cache.getIndices(i);
+		mesh.num_vertices = entry.vertex_count;
+		mesh.num_indices = entry.index_count;
+		mesh.bounds = entry.bounds;
+		mesh.sphere = entry.sphere;
+		for (unsigned int t = 0; t < entry.texture_count; t++) {
+			mesh.textures.push_back(addTexture(data, records[t].path, records[t].type));
+		}
+		const MeshCacheLod* lods = cache.getLods(i);
+		for (unsigned int l = 0; l < entry.lod_count; l++) {
+			MeshLod lod;
+			lod.index_offset = lods[l].index_offset;
+			lod.index_count = lods[l].index_count;
+			lod.error = lods[l].error;
+			mesh.lods.push_back(lod);
+		}
+		data.meshes.push_back(std::move(mesh));
+	}
+	return true;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene) {
+void Model::computeBounds() {
+	this->bounds.min = glm::vec3(0.0f);
+	this->bounds.max = glm::vec3(0.0f);
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		if (i == 0) {
+			this->bounds = meshes[i].getBounds();
+		} else {
+			this->bounds = mergeAABB(this->bounds, meshes[i].getBounds());
+		}
+	}
+
+	this->sphere.center = (this->bounds.min + this->bounds.max) * 0.5f;
+	this->sphere.radius = 0.0f;
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		const BoundingSphere& s = meshes[i].getSphere();
+		this->sphere.radius = glm::max(this->sphere.radius, glm::length(s.center - this->sphere.center) + s.radius);
+	}
+}
+
+// A model level is every mesh at that level, or at its coarsest if its chain
+// is shorter, so the level error is the worst of them.
+void Model::computeLodErrors() {
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		count = std::max(count, meshes[i].getLodCount());
+	}
+	this->lod_errors.assign(count, 0.0f);
+	for (unsigned int level = 0; level < count; level++) {
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			this->lod_errors[level] = std::max(this->lod_errors[level], meshes[i].getLod(level).error);
+		}
+	}
+}
+
+void Model::processNode(aiNode* node, const aiScene* scene, ModelData& data) {
 	for (unsigned int i = 0; i < node->mNumMeshes; i++) {
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		data.meshes.push_back(processMesh(mesh, scene, data));
 	}
 	for (unsigned int i = 0; i < node->mNumChildren; i++) {
-		processNode(node->mChildren[i], scene);
+		processNode(node->mChildren[i], scene, data);
 	}
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<Texture> textures;
+MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene, ModelData& data) {
+	MeshData result;
+	std::vector<Vertex>& vertices = result.vertices;
+	std::vector<unsigned int>& indices = result.indices;
+	std::vector<Texture>& textures = result.textures;
+	vertices.reserve(mesh->mNumVertices);
+	indices.reserve(mesh->mNumFaces * 3);
 
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
 		Vertex vertex;
@@ -65,10 +354,12 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
 		position.z = mesh->mVertices[i].z;
 		vertex.position = position;
 
-		glm::vec3 normal;
-		normal.x = mesh->mNormals[i].x;
-		normal.y = mesh->mNormals[i].y;
-		normal.z = mesh->mNormals[i].z;
+		glm::vec3 normal = glm::vec3(0.0f);
+		if (mesh->mNormals) {
+			normal.x = mesh->mNormals[i].x;
+			normal.y = mesh->mNormals[i].y;
+			normal.z = mesh->mNormals[i].z;
+		}
 		vertex.normal = normal;
 
 		if (mesh->mTextureCoords[0]) {
@@ -93,92 +384,67 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
 	
 	if (mesh->mMaterialIndex >= 0) {
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-		std::vector<Texture> diffuse_maps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+		std::vector<Texture> diffuse_maps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data);
 		int curr_size = 0;
 		textures.insert(textures.end(), diffuse_maps.begin(), diffuse_maps.end());
-		this->has_diffuse = (bool)(textures.size() > curr_size);
-		std::vector<Texture> specular_maps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+		data.has_diffuse = (bool)(textures.size() > curr_size);
+		std::vector<Texture> specular_maps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data);
 		curr_size = (int)textures.size();
 		textures.insert(textures.end(), specular_maps.begin(), specular_maps.end());
-		this->has_specular = (bool)(textures.size() > curr_size);
+		data.has_specular = (bool)(textures.size() > curr_size);
 	}
 	
-	return Mesh(vertices, indices, textures);
+	return result;
 }
 
-std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName) {
+std::vector<Texture> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, ModelData& data) {
 	std::vector<Texture> textures;
 	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
 		aiString str;
 		mat->GetTexture(type, i, &str);
-		bool skip = false;
-		for (unsigned int j = 0; j < textures_loaded.size(); j++) {
-			if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-				textures.push_back(textures_loaded[j]);
-				skip = true;
-				break; 
-			}
-		}
-		if (!skip) {
-			Texture texture;
-			texture.id = TextureFromFile(str.C_Str(), this->directory);
-			texture.type = typeName;
-			texture.path = str.C_Str();
-			textures.push_back(texture);
-			textures_loaded.push_back(texture);
-		}
+		textures.push_back(addTexture(data, str.C_Str(), typeName));
 	}
 	return textures;
 }
 
+// Each image is decoded at most once per model no matter how many meshes use it.
+Texture Model::addTexture(ModelData& data, const char* path, std::string type_name) {
+	Texture texture;
+	texture.id = 0;
+	texture.type = type_name;
+	texture.path = path;
+
+	for (unsigned int j = 0; j < data.textures.size(); j++) {
+		if (data.textures[j].path == texture.path) {
+			return texture;
+		}
+	}
+	TextureData image;
+	image.path = path;
+	data.textures.push_back(image);
+	return texture;
+}
+
 bool Model::hasDiffuse() {
-	return this->has_diffuse;
+	return this->asset->has_diffuse;
 }
 
 bool Model::hasSpecular() {
-	return this->has_specular;
+	return this->asset->has_specular;
 }
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma) {
-	std::string filename = directory + '/' + std::string(path);
-
-	unsigned int texture_id;
-	glGenTextures(1, &texture_id);
-
-	int width, height, num_components;
-	stbi_set_flip_vertically_on_load(1);
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &num_components, 0);
-	if (data) {
-		GLenum format;
-		if (num_components == 1) {
-			format = GL_RED;
-		} else if (num_components == 3) {
-			format = GL_RGB;
-		} else if (num_components == 4) {
-			format = GL_RGBA;
-		}
-
-		glBindTexture(GL_TEXTURE_2D, texture_id);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-
-	} else {
-		std::cout << "Texture load failed." << std::endl;
-		stbi_image_free(data);
-	}
+bool Model::isReady() {
+	return this->asset->ready;
+}
 
-	return texture_id;
+unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma) {
+	return TextureCache::get().acquire(directory + '/' + std::string(path));
 }
 
 void Model::setPosition(glm::vec3 pos) {
 	this->_position = pos;
+	this->moved = true;
+	this->markDirty();
 }
 
 glm::vec3 Model::getPosition() {
@@ -187,6 +453,10 @@ glm::vec3 Model::getPosition() {
 
 void Model::setColor(glm::vec3 color) {
 	this->_color = color;
+	// The GPU culler keeps its own copy of static instances.
+	if (this->is_static) {
+		this->markDirty();
+	}
 }
 
 glm::vec3 Model::getColor() {
@@ -195,8 +465,97 @@ glm::vec3 Model::getColor() {
 
 void Model::setScale(glm::vec3 scale) {
 	this->_scale = scale;
+	this->moved = true;
+	this->markDirty();
 }
 
 glm::vec3 Model::getScale() {
 	return this->_scale;
+}
+
+std::vector<Mesh>& Model::getMeshes() {
+	return this->asset->meshes;
+}
+
+Model* Model::getAsset() {
+	return this->asset;
+}
+
+AABB Model::getBounds() {
+	return this->asset->bounds;
+}
+
+double Model::getLoadTime() {
+	return this->load_time;
+}
+
+bool Model::loadedFromCache() {
+	return this->from_cache;
+}
+
+unsigned int Model::getLodCount() {
+	return (unsigned int)this->asset->lod_errors.size();
+}
+
+float Model::getLodError(unsigned int level) {
+	return this->asset->lod_errors[level];
+}
+
+unsigned int Model::getLod() {
+	return this->lod;
+}
+
+void Model::setLod(unsigned int level) {
+	this->lod = level;
+}
+
+AABB Model::getWorldBounds() {
+	return transformAABB(this->asset->bounds, this->_position, this->_scale);
+}
+
+BoundingSphere Model::getWorldSphere() {
+	BoundingSphere world;
+	const BoundingSphere& sphere = this->asset->sphere;
+	world.center = sphere.center * this->_scale + this->_position;
+	glm::vec3 scale = glm::abs(this->_scale);
+	world.radius = sphere.radius * glm::max(scale.x, glm::max(scale.y, scale.z));
+	return world;
+}
+
+void Model::setSceneProxy(int proxy, std::vector<Model*>* dirty_list) {
+	this->proxy = proxy;
+	this->dirty_list = dirty_list;
+}
+
+int Model::getSceneProxy() {
+	return this->proxy;
+}
+
+bool Model::isDirty() {
+	return this->dirty;
+}
+
+bool Model::hasMoved() {
+	return this->moved;
+}
+
+void Model::clearDirty() {
+	this->dirty = false;
+	this->moved = false;
+}
+
+void Model::setStatic(bool is_static) {
+	this->is_static = is_static;
+}
+
+bool Model::isStatic() {
+	return this->is_static;
+}
+
+void Model::markDirty() {
+	if (this->dirty || this->dirty_list == nullptr) {
+		return;
+	}
+	this->dirty = true;
+	this->dirty_list->push_back(this);
 }
\ No newline at end of file
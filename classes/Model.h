@@ -20,13 +20,60 @@
 
 #include "Mesh.h"
 #include "Shader.h"
+#include "MeshCache.h"
+#include "ObjLoader.h"
+#include "TextureCache.h"
+#include "AssetArchive.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 
+// Assimp post processing used for every import, part of the mesh cache key.
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_FlipUVs)
+
+// Importer used for a model file, chosen per asset.
+#define MODEL_LOADER_ASSIMP 0
+#define MODEL_LOADER_OBJ 1
+
+// Output of Model::prepare. Nothing in here touches GL, so it can be filled
+// on a worker thread and uploaded later on the render thread.
+struct ModelData {
+	std::string path;
+	std::string directory;
+	int loader;
+	bool loaded;
+	bool from_cache;
+	bool from_archive;
+	bool has_diffuse;
+	bool has_specular;
+	std::vector<MeshData> meshes;
+	std::vector<TextureData> textures;
+	// Keeps mapped vertex and index blobs alive until they are uploaded.
+	MeshCache cache;
+	// Milliseconds in prepare, load_time adds the uploads on top.
+	double prepare_time;
+	double load_time;
+	unsigned int uploaded_textures;
+	unsigned int uploaded_meshes;
+};
+
+// Goes through the texture cache, the caller owns one reference.
 unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma = false);
 
 class Model {
 	public:
-		Model(std::string path);
-		void draw(Shader& shader);
+		// Empty asset, filled in through prepare/uploadStep/finishLoad.
+		Model();
+		Model(std::string path, int loader = MODEL_LOADER_ASSIMP);
+		Model(Model* asset);
+		~Model();
+		// Reads, parses and decodes without touching GL or the model.
+		// parse_threads caps the threads the OBJ parser starts, 0 for one
+		// per hardware thread. Loads that already run side by side pass 1.
+		static void prepare(std::string path, int loader, ModelData& data, unsigned int parse_threads = 0);
+		// Does one GL upload, returns true once nothing is left.
+		bool uploadStep(ModelData& data);
+		void finishLoad(ModelData& data);
+		bool isReady();
 		bool hasDiffuse();
 		bool hasSpecular();
 		void bindArrayBuffer();
@@ -37,18 +84,72 @@ class Model {
 		glm::vec3 getColor();
 		void setScale(glm::vec3 scale);
 		glm::vec3 getScale();
+		std::vector<Mesh>& getMeshes();
+		Model* getAsset();
+		AABB getBounds();
+		// Milliseconds of loading work (parse plus uploads) and whether the mesh
+		// cache served it.
+		double getLoadTime();
+		bool loadedFromCache();
+		// Levels of detail shared by all meshes, errors in model units.
+		unsigned int getLodCount();
+		float getLodError(unsigned int level);
+		// Level the scene last picked for this instance.
+		unsigned int getLod();
+		void setLod(unsigned int level);
+		AABB getWorldBounds();
+		BoundingSphere getWorldSphere();
+		// Links the model to its leaf in the scene BVH. Transform changes
+		// queue the model on dirty_list so the scene refits only what moved.
+		void setSceneProxy(int proxy, std::vector<Model*>* dirty_list);
+		int getSceneProxy();
+		bool isDirty();
+		// Dirty because of a new position or scale, not just a new color.
+		bool hasMoved();
+		void clearDirty();
+		// Static models are expected to rarely move. The scene keeps them in
+		// their own tree and, with GPU culling on, culls them on the GPU.
+		void setStatic(bool is_static);
+		bool isStatic();
 
 	private:
-		std::vector<Texture> textures_loaded;
 		std::vector<Mesh> meshes;
+		// References held on the texture cache, given back on destruction.
+		std::vector<unsigned int> texture_refs;
 		std::string directory;
+		// Model that owns the meshes, this for loaded models. Instances share
+		// the GPU data of their asset and only carry a transform and color.
+		Model* asset;
+		// Local space bounds over all meshes, filled in at load time. Instances
+		// read them from their asset.
+		AABB bounds;
+		BoundingSphere sphere;
+		std::vector<float> lod_errors;
+		unsigned int lod;
+		int proxy;
+		bool dirty;
+		bool moved;
+		bool is_static;
+		std::vector<Model*>* dirty_list;
+
+		void markDirty();
 		bool has_diffuse;
 		bool has_specular;
+		bool ready;
+
+		double load_time;
+		bool from_cache;
 
-		void loadModel(std::string path);
-		void processNode(aiNode* node, const aiScene* scene);
-		Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-		std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName);
+		void loadModel(std::string path, int loader);
+		void computeBounds();
+		void computeLodErrors();
+		static bool loadFromCache(ModelData& data);
+		static bool loadAssimp(ModelData& data);
+		static bool loadObj(ModelData& data, unsigned int num_threads);
+		static Texture addTexture(ModelData& data, const char* path, std::string type_name);
+		static void processNode(aiNode* node, const aiScene* scene, ModelData& data);
+		static MeshData processMesh(aiMesh* mesh, const aiScene* scene, ModelData& data);
+		static std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName, ModelData& data);
 		glm::vec3 _position;
 		glm::vec3 _color;
 		glm::vec3 _scale;
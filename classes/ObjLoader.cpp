@@ -0,0 +1,562 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+
+// Below this a file is parsed on the calling thread, spawning costs more.
+#define OBJ_MIN_CHUNK_SIZE (64 * 1024)
+
+struct ObjCorner {
+	int position;
+	int tex_coord;
+	int normal;
+};
+
+// Group name or material switch taking effect at corner first_corner.
+struct ObjEvent {
+	size_t first_corner;
+	bool is_material;
+	std::string value;
+};
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+	unsigned int num_positions;
+	unsigned int num_tex_coords;
+	unsigned int num_normals;
+	unsigned int base_position;
+	unsigned int base_tex_coord;
+	unsigned int base_normal;
+	// Triangulated, three corners per triangle.
+	std::vector<ObjCorner> corners;
+	std::vector<ObjEvent> events;
+	std::vector<std::string> material_libs;
+	bool error;
+};
+
+struct ObjSpan {
+	unsigned int chunk;
+	size_t begin;
+	size_t end;
+};
+
+struct ObjPart {
+	std::string name;
+	std::string material;
+	std::vector<ObjSpan> spans;
+	size_t num_corners;
+};
+
+// Runs fn(0) to fn(count - 1) on at most num_threads threads, the calling one
+// included. Workers pull indices from a shared counter, so a file with
+// hundreds of parts still only starts num_threads - 1 threads.
+template<typename Function>
+static void parallelFor(unsigned int count, unsigned int num_threads, Function fn) {
+	if (count <= 1 || num_threads <= 1) {
+		for (unsigned int i = 0; i < count; i++) {
+			fn(i);
+		}
+		return;
+	}
+	std::atomic<unsigned int> next(0);
+	auto worker = [&next, count, &fn]() {
+		for (unsigned int i = next++; i < count; i = next++) {
+			fn(i);
+		}
+	};
+	unsigned int num_workers = count < num_threads ? count : num_threads;
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < num_workers; i++) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (unsigned int i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+static inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipBlanks(const char* p, const char* end) {
+	while (p < end && isBlank(*p)) {
+		p++;
+	}
+	return p;
+}
+
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal float without locale or strtod overhead. Digits past the 19th are
+// dropped, which is far below float precision.
+static const char* parseFloat(const char* p, const char* end, float& out) {
+	p = skipBlanks(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits++;
+		} else {
+			exponent++;
+		}
+		p++;
+	}
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				digits++;
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = *p == '-';
+			p++;
+		}
+		int e = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			e = e * 10 + (*p - '0');
+			p++;
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+
+	double value = (double)mantissa;
+	if (exponent < 0) {
+		value = exponent >= -22 ? value / powers_of_ten[-exponent] : value * std::pow(10.0, exponent);
+	} else if (exponent > 0) {
+		value = exponent <= 22 ? value * powers_of_ten[exponent] : value * std::pow(10.0, exponent);
+	}
+	out = (float)(negative ? -value : value);
+	return p;
+}
+
+static const char* parseInt(const char* p, const char* end, int& out) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	int value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	out = negative ? -value : value;
+	return p;
+}
+
+// OBJ indices are 1-based, negative ones count back from the current end.
+// Missing or zero indices become -1.
+static inline int resolveIndex(int index, unsigned int count) {
+	if (index > 0) {
+		return index - 1;
+	}
+	if (index < 0) {
+		return (int)count + index;
+	}
+	return -1;
+}
+
+static std::string restOfLine(const char* p, const char* end) {
+	p = skipBlanks(p, end);
+	while (end > p && isBlank(end[-1])) {
+		end--;
+	}
+	return std::string(p, end);
+}
+
+static inline const char* lineEnd(const char* p, const char* end) {
+	const char* newline = (const char*)std::memchr(p, '\n', end - p);
+	return newline ? newline : end;
+}
+
+static void countAttributes(ObjChunk& chunk) {
+	chunk.num_positions = 0;
+	chunk.num_tex_coords = 0;
+	chunk.num_normals = 0;
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		const char* eol = lineEnd(p, chunk.end);
+		p = skipBlanks(p, eol);
+		if (eol - p >= 2 && p[0] == 'v') {
+			if (isBlank(p[1])) {
+				chunk.num_positions++;
+			} else if (p[1] == 't') {
+				chunk.num_tex_coords++;
+			} else if (p[1] == 'n') {
+				chunk.num_normals++;
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+static void parseChunk(ObjChunk& chunk, glm::vec3* positions, glm::vec2* tex_coords, glm::vec3* normals) {
+	unsigned int num_positions = chunk.base_position;
+	unsigned int num_tex_coords = chunk.base_tex_coord;
+	unsigned int num_normals = chunk.base_normal;
+	std::vector<ObjCorner> face;
+	chunk.error = false;
+
+	const char* p = chunk.begin;
+	while (p < chunk.end) {
+		const char* eol = lineEnd(p, chunk.end);
+		p = skipBlanks(p, eol);
+		if (p == eol) {
+			p = eol + 1;
+			continue;
+		}
+
+		if (p[0] == 'v' && eol - p >= 2) {
+			if (isBlank(p[1])) {
+				glm::vec3& v = positions[num_positions++];
+				p = parseFloat(p + 1, eol, v.x);
+				p = parseFloat(p, eol, v.y);
+				parseFloat(p, eol, v.z);
+			} else if (p[1] == 't') {
+				glm::vec2& t = tex_coords[num_tex_coords++];
+				p = parseFloat(p + 2, eol, t.x);
+				parseFloat(p, eol, t.y);
+			} else if (p[1] == 'n') {
+				glm::vec3& n = normals[num_normals++];
+				p = parseFloat(p + 2, eol, n.x);
+				p = parseFloat(p, eol, n.y);
+				parseFloat(p, eol, n.z);
+			}
+		} else if (p[0] == 'f' && eol - p >= 2 && isBlank(p[1])) {
+			face.clear();
+			p = skipBlanks(p + 1, eol);
+			while (p < eol) {
+				int position = 0, tex_coord = 0, normal = 0;
+				p = parseInt(p, eol, position);
+				if (p < eol && *p == '/') {
+					p++;
+					if (p < eol && *p != '/') {
+						p = parseInt(p, eol, tex_coord);
+					}
+					if (p < eol && *p == '/') {
+						p = parseInt(p + 1, eol, normal);
+					}
+				}
+				ObjCorner corner;
+				corner.position = resolveIndex(position, num_positions);
+				corner.tex_coord = resolveIndex(tex_coord, num_tex_coords);
+				corner.normal = resolveIndex(normal, num_normals);
+				if (corner.position < 0) {
+					chunk.error = true;
+				}
+				face.push_back(corner);
+				while (p < eol && !isBlank(*p)) {
+					p++;
+				}
+				p = skipBlanks(p, eol);
+			}
+			// Fan triangulation, same as aiProcess_Triangulate for convex faces.
+			for (size_t i = 2; i < face.size(); i++) {
+				chunk.corners.push_back(face[0]);
+				chunk.corners.push_back(face[i - 1]);
+				chunk.corners.push_back(face[i]);
+			}
+		} else if ((p[0] == 'g' || p[0] == 'o') && eol - p >= 1 && (eol - p == 1 || isBlank(p[1]))) {
+			ObjEvent event;
+			event.first_corner = chunk.corners.size();
+			event.is_material = false;
+			event.value = restOfLine(p + 1, eol);
+			chunk.events.push_back(event);
+		} else if (eol - p > 6 && std::strncmp(p, "usemtl", 6) == 0) {
+			ObjEvent event;
+			event.first_corner = chunk.corners.size();
+			event.is_material = true;
+			event.value = restOfLine(p + 6, eol);
+			chunk.events.push_back(event);
+		} else if (eol - p > 6 && std::strncmp(p, "mtllib", 6) == 0) {
+			chunk.material_libs.push_back(restOfLine(p + 6, eol));
+		}
+
+		p = eol + 1;
+	}
+}
+
+ObjLoader::ObjLoader() : ObjLoader(0) {
+}
+
+ObjLoader::ObjLoader(unsigned int num_threads) {
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+	this->num_threads = num_threads > 0 ? num_threads : 1;
+}
+
+bool ObjLoader::load(const std::string& path) {
+	this->meshes.clear();
+	this->materials.clear();
+
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "ERROR::OBJ::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+		return false;
+	}
+	const char* data = (const char*)file.data();
+	const char* data_end = data + file.size();
+
+	// Line aligned chunks, one per thread for large files.
+	unsigned int num_chunks = (unsigned int)glm::clamp(file.size() / OBJ_MIN_CHUNK_SIZE, (size_t)1, (size_t)this->num_threads);
+	std::vector<ObjChunk> chunks(num_chunks);
+	const char* chunk_begin = data;
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		const char* chunk_end = i + 1 == num_chunks ? data_end : data + file.size() * (i + 1) / num_chunks;
+		if (chunk_end < chunk_begin) {
+			chunk_end = chunk_begin;
+		}
+		if (chunk_end < data_end) {
+			chunk_end = lineEnd(chunk_end, data_end);
+			chunk_end = chunk_end < data_end ? chunk_end + 1 : data_end;
+		}
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	parallelFor(num_chunks, this->num_threads, [&chunks](unsigned int i) {
+		countAttributes(chunks[i]);
+	});
+
+	unsigned int total_positions = 0, total_tex_coords = 0, total_normals = 0;
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		chunks[i].base_position = total_positions;
+		chunks[i].base_tex_coord = total_tex_coords;
+		chunks[i].base_normal = total_normals;
+		total_positions += chunks[i].num_positions;
+		total_tex_coords += chunks[i].num_tex_coords;
+		total_normals += chunks[i].num_normals;
+	}
+	this->positions.resize(total_positions);
+	this->tex_coords.resize(total_tex_coords);
+	this->normals.resize(total_normals);
+
+	glm::vec3* positions = this->positions.data();
+	glm::vec2* tex_coords = this->tex_coords.data();
+	glm::vec3* normals = this->normals.data();
+	parallelFor(num_chunks, this->num_threads, [&chunks, positions, tex_coords, normals](unsigned int i) {
+		parseChunk(chunks[i], positions, tex_coords, normals);
+	});
+
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		bool in_range = !chunks[i].error;
+		for (size_t c = 0; c < chunks[i].corners.size() && in_range; c++) {
+			const ObjCorner& corner = chunks[i].corners[c];
+			in_range = corner.position < (int)total_positions && corner.tex_coord < (int)total_tex_coords && corner.normal < (int)total_normals;
+		}
+		if (!in_range) {
+			std::cout << "ERROR::OBJ::INDEX_OUT_OF_RANGE " << path << std::endl;
+			return false;
+		}
+	}
+
+	std::string directory = path.substr(0, path.find_last_of('/'));
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		for (unsigned int j = 0; j < chunks[i].material_libs.size(); j++) {
+			this->loadMaterials(directory + '/' + chunks[i].material_libs[j]);
+		}
+	}
+
+	// Split into meshes wherever the group or material changes.
+	std::vector<ObjPart> parts;
+	ObjPart current;
+	current.num_corners = 0;
+	for (unsigned int i = 0; i < num_chunks; i++) {
+		size_t position = 0;
+		for (unsigned int e = 0; e <= chunks[i].events.size(); e++) {
+			size_t next = e < chunks[i].events.size() ? chunks[i].events[e].first_corner : chunks[i].corners.size();
+			if (next > position) {
+				ObjSpan span;
+				span.chunk = i;
+				span.begin = position;
+				span.end = next;
+				current.spans.push_back(span);
+				current.num_corners += next - position;
+				position = next;
+			}
+			if (e == chunks[i].events.size()) {
+				break;
+			}
+			if (current.num_corners > 0) {
+				parts.push_back(current);
+				current.spans.clear();
+				current.num_corners = 0;
+			}
+			const ObjEvent& event = chunks[i].events[e];
+			if (event.is_material) {
+				current.material = event.value;
+			} else {
+				current.name = event.value;
+			}
+		}
+	}
+	if (current.num_corners > 0) {
+		parts.push_back(current);
+	}
+
+	this->generateNormals(chunks);
+
+	this->meshes.resize(parts.size());
+	parallelFor((unsigned int)parts.size(), this->num_threads, [this, &parts, &chunks](unsigned int i) {
+		this->buildMesh(this->meshes[i], parts[i], chunks);
+	});
+
+	this->positions.clear();
+	this->tex_coords.clear();
+	this->normals.clear();
+	this->generated_normals.clear();
+	return true;
+}
+
+// Area weighted vertex normals, only computed when some face has no vn.
+void ObjLoader::generateNormals(std::vector<ObjChunk>& chunks) {
+	bool needed = false;
+	for (unsigned int i = 0; i < chunks.size() && !needed; i++) {
+		for (size_t c = 0; c < chunks[i].corners.size(); c++) {
+			if (chunks[i].corners[c].normal < 0) {
+				needed = true;
+				break;
+			}
+		}
+	}
+	if (!needed) {
+		return;
+	}
+
+	this->generated_normals.assign(this->positions.size(), glm::vec3(0.0f));
+	for (unsigned int i = 0; i < chunks.size(); i++) {
+		const std::vector<ObjCorner>& corners = chunks[i].corners;
+		for (size_t c = 0; c + 2 < corners.size(); c += 3) {
+			glm::vec3 a = this->positions[corners[c].position];
+			glm::vec3 b = this->positions[corners[c + 1].position];
+			glm::vec3 d = this->positions[corners[c + 2].position];
+			glm::vec3 n = glm::cross(b - a, d - a);
+			for (int k = 0; k < 3; k++) {
+				this->generated_normals[corners[c + k].position] += n;
+			}
+		}
+	}
+	for (size_t i = 0; i < this->generated_normals.size(); i++) {
+		float length = glm::length(this->generated_normals[i]);
+		this->generated_normals[i] = length > 0.0f ? this->generated_normals[i] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+}
+
+// Welds identical v/vt/vn triples through an open addressing table sized to
+// at least twice the corner count.
+void ObjLoader::buildMesh(ObjMesh& mesh, const ObjPart& part, const std::vector<ObjChunk>& chunks) {
+	mesh.name = part.name;
+	mesh.material = part.material;
+	mesh.indices.reserve(part.num_corners);
+
+	size_t capacity = 16;
+	while (capacity < part.num_corners * 2) {
+		capacity <<= 1;
+	}
+	std::vector<ObjCorner> keys(capacity);
+	std::vector<unsigned int> slots(capacity, 0xFFFFFFFF);
+	size_t mask = capacity - 1;
+
+	for (unsigned int s = 0; s < part.spans.size(); s++) {
+		const ObjSpan& span = part.spans[s];
+		const std::vector<ObjCorner>& corners = chunks[span.chunk].corners;
+		for (size_t c = span.begin; c < span.end; c++) {
+			const ObjCorner& corner = corners[c];
+			size_t hash = ((size_t)corner.position * 73856093u) ^ ((size_t)(corner.tex_coord + 1) * 19349663u) ^ ((size_t)(corner.normal + 1) * 83492791u);
+			size_t slot = hash & mask;
+			while (slots[slot] != 0xFFFFFFFF) {
+				const ObjCorner& key = keys[slot];
+				if (key.position == corner.position && key.tex_coord == corner.tex_coord && key.normal == corner.normal) {
+					break;
+				}
+				slot = (slot + 1) & mask;
+			}
+
+			if (slots[slot] == 0xFFFFFFFF) {
+				Vertex vertex;
+				vertex.position = this->positions[corner.position];
+				vertex.normal = corner.normal >= 0 ? this->normals[corner.normal] : this->generated_normals[corner.position];
+				if (corner.tex_coord >= 0) {
+					// Flipped like aiProcess_FlipUVs.
+					vertex.tex_coords = glm::vec2(this->tex_coords[corner.tex_coord].x, 1.0f - this->tex_coords[corner.tex_coord].y);
+				} else {
+					vertex.tex_coords = glm::vec2(0.0f, 0.0f);
+				}
+				keys[slot] = corner;
+				slots[slot] = (unsigned int)mesh.vertices.size();
+				mesh.vertices.push_back(vertex);
+			}
+			mesh.indices.push_back(slots[slot]);
+		}
+	}
+}
+
+bool ObjLoader::loadMaterials(const std::string& path) {
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "WARNING::OBJ::MATERIAL_LIBRARY_NOT_FOUND " << path << std::endl;
+		return false;
+	}
+
+	const char* p = (const char*)file.data();
+	const char* end = p + file.size();
+	while (p < end) {
+		const char* eol = lineEnd(p, end);
+		p = skipBlanks(p, eol);
+		if (eol - p > 6 && std::strncmp(p, "newmtl", 6) == 0) {
+			ObjMaterial material;
+			material.name = restOfLine(p + 6, eol);
+			this->materials.push_back(material);
+		} else if (!this->materials.empty() && eol - p > 6 && std::strncmp(p, "map_Kd", 6) == 0) {
+			this->materials.back().diffuse_map = restOfLine(p + 6, eol);
+		} else if (!this->materials.empty() && eol - p > 6 && std::strncmp(p, "map_Ks", 6) == 0) {
+			this->materials.back().specular_map = restOfLine(p + 6, eol);
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+std::vector<ObjMesh>& ObjLoader::getMeshes() {
+	return this->meshes;
+}
+
+const ObjMaterial* ObjLoader::findMaterial(const std::string& name) {
+	for (unsigned int i = 0; i < this->materials.size(); i++) {
+		if (this->materials[i].name == name) {
+			return &this->materials[i];
+		}
+	}
+	return nullptr;
+}
+
+unsigned int ObjLoader::getThreadCount() {
+	return this->num_threads;
+}
@@ -0,0 +1,66 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+
+// Bump when the loader output changes, it is part of the mesh cache key.
+#define OBJ_LOADER_VERSION 1
+// High bit keeps the key apart from any set of Assimp import flags.
+#define OBJ_LOADER_CACHE_FLAGS (0x80000000u | OBJ_LOADER_VERSION)
+
+struct ObjMaterial {
+	std::string name;
+	std::string diffuse_map;
+	std::string specular_map;
+};
+
+// One mesh per group/material run, laid out the way Mesh uploads it.
+struct ObjMesh {
+	std::string name;
+	std::string material;
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+};
+
+struct ObjChunk;
+struct ObjPart;
+
+// Wavefront OBJ/MTL loader. The file is mapped and cut into line aligned
+// chunks; a counting pass gives every chunk its base v/vt/vn offsets so the
+// parse pass can write attributes in place and resolve relative indices
+// without a fix-up. Corners are then welded per mesh through a hash table.
+class ObjLoader {
+
+	public:
+		ObjLoader();
+		// 0 uses one thread per hardware thread.
+		ObjLoader(unsigned int num_threads);
+
+		bool load(const std::string& path);
+		std::vector<ObjMesh>& getMeshes();
+		const ObjMaterial* findMaterial(const std::string& name);
+		unsigned int getThreadCount();
+
+	private:
+		unsigned int num_threads;
+		std::vector<ObjMesh> meshes;
+		std::vector<ObjMaterial> materials;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> tex_coords;
+		std::vector<glm::vec3> normals;
+		// Smooth normals for corners that don't reference one.
+		std::vector<glm::vec3> generated_normals;
+
+		bool loadMaterials(const std::string& path);
+		void generateNormals(std::vector<ObjChunk>& chunks);
+		void buildMesh(ObjMesh& mesh, const ObjPart& part, const std::vector<ObjChunk>& chunks);
+};
+
+#endif
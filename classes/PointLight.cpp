@@ -1,5 +1,8 @@
 #include "PointLight.h"
 
+#include <cmath>
+#include <cfloat>
+
 PointLight::PointLight() {
 	this->_position = glm::vec3(0.0f, 1.0f, -1.5f);
 	this->_ambient = glm::vec3(0.075f);
@@ -64,4 +67,21 @@ float PointLight::getKL() {
 }
 float PointLight::getKQ() {
 	return this->_kq;
-}
\ No newline at end of file
+}
+
+// Solves intensity / (kc + kl * d + kq * d * d) = POINT_LIGHT_CUTOFF for d.
+float PointLight::getRadius() {
+	glm::vec3 brightest = glm::max(this->_ambient, glm::max(this->_diffuse, this->_specular));
+	float intensity = glm::max(brightest.x, glm::max(brightest.y, brightest.z));
+	float c = this->_kc - intensity / POINT_LIGHT_CUTOFF;
+	if (c >= 0.0f) {
+		return 0.0f;
+	}
+	if (this->_kq > 0.0f) {
+		return (-this->_kl + std::sqrt(this->_kl * this->_kl - 4.0f * this->_kq * c)) / (2.0f * this->_kq);
+	}
+	if (this->_kl > 0.0f) {
+		return -c / this->_kl;
+	}
+	return FLT_MAX;
+}
@@ -5,6 +5,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// Light below this part of its full intensity counts as none, see getRadius.
+#define POINT_LIGHT_CUTOFF (5.0f / 256.0f)
+
 class PointLight {
 
 	public:
@@ -29,6 +32,9 @@ class PointLight {
 		float getKC();
 		float getKL();
 		float getKQ();
+		// Distance where the brightest of the light's colors falls below
+		// POINT_LIGHT_CUTOFF. FLT_MAX without attenuation.
+		float getRadius();
 
 	private:
 
@@ -0,0 +1,184 @@
+#include "PointShadows.h"
+
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cfloat>
+
+// Looking direction and up vector of each cube map face.
+static const glm::vec3 FACE_DIRECTIONS[6] = {
+	glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+	glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+};
+static const glm::vec3 FACE_UPS[6] = {
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+	glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+	glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+};
+
+PointShadows::PointShadows() {
+	for (int i = 0; i < MAX_POINT_SHADOWS; i++) {
+		this->shadows[i].light = -1;
+		this->shadows[i].position = glm::vec3(0.0f);
+		this->shadows[i].far_plane = 0.0f;
+		this->shadows[i].layer = i;
+		this->shadows[i].level = 0;
+		this->shadows[i].resolution = 0;
+		this->shadows[i].active = false;
+		for (int f = 0; f < 6; f++) {
+			this->shadows[i].face_matrices[f] = glm::mat4(1.0f);
+		}
+		this->shadows[i].cull_matrix = glm::mat4(1.0f);
+	}
+	this->shadow_count = 0;
+	this->resolution = 512;
+	this->texture = 0;
+	this->fbo = 0;
+	this->allocated_resolution = 0;
+}
+
+bool PointShadows::isSupported() {
+	return GLAD_GL_VERSION_4_0 != 0;
+}
+
+void PointShadows::setResolution(int resolution) {
+	if (resolution < (1 << POINT_SHADOW_LEVELS)) {
+		std::cout << "ERROR::POINT_SHADOWS::INVALID_RESOLUTION " << resolution << std::endl;
+		return;
+	}
+	this->resolution = resolution;
+}
+
+void PointShadows::allocate(int size) {
+	if (this->texture == 0) {
+		glGenTextures(1, &this->texture);
+		glGenFramebuffers(1, &this->fbo);
+	}
+	this->allocated_resolution = size;
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, this->texture);
+	for (int level = 0; level < POINT_SHADOW_LEVELS; level++) {
+		int level_size = size >> level;
+		glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, level, GL_DEPTH_COMPONENT24, level_size, level_size, 6 * MAX_POINT_SHADOWS, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAX_LEVEL, POINT_SHADOW_LEVELS - 1);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "ERROR::POINT_SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void PointShadows::update(Camera* camera, const std::vector<PointLight*>& lights, int viewport_height) {
+	if (this->texture == 0 || this->allocated_resolution != this->resolution) {
+		this->allocate(this->resolution);
+	}
+
+	Frustum view_frustum(camera->getProjection() * camera->getView());
+	glm::vec3 camera_pos = camera->getPosition();
+	// Pixels covered by one world unit at distance 1.
+	float pixels_per_unit = (float)viewport_height / (2.0f * glm::tan(glm::radians(camera->getFov()) * 0.5f));
+
+	this->candidates.clear();
+	for (unsigned int i = 0; i < lights.size(); i++) {
+		float radius = glm::min(lights[i]->getRadius(), POINT_SHADOW_MAX_RADIUS);
+		BoundingSphere sphere = { lights[i]->getPosition(), radius };
+		if (radius <= POINT_SHADOW_NEAR || !view_frustum.testSphere(sphere)) {
+			continue;
+		}
+		float distance = glm::length(sphere.center - camera_pos);
+		float screen_size = distance > radius ? 2.0f * radius * pixels_per_unit / distance : FLT_MAX;
+		this->candidates.push_back(std::make_pair(screen_size, (int)i));
+	}
+	this->shadow_count = glm::min((int)this->candidates.size(), MAX_POINT_SHADOWS);
+	std::partial_sort(this->candidates.begin(), this->candidates.begin() + this->shadow_count, this->candidates.end(), std::greater<std::pair<float, int>>());
+
+	for (int i = 0; i < this->shadow_count; i++) {
+		PointShadow& shadow = this->shadows[i];
+		PointLight* light = lights[this->candidates[i].second];
+		shadow.light = this->candidates[i].second;
+		shadow.position = light->getPosition();
+		shadow.far_plane = glm::min(light->getRadius(), POINT_SHADOW_MAX_RADIUS);
+		shadow.active = true;
+
+		// A face spans 90 degrees, so it needs about as many texels across
+		// as the sphere covers pixels. Full size once the camera is inside.
+		shadow.level = 0;
+		float screen_size = this->candidates[i].first;
+		while (shadow.level + 1 < POINT_SHADOW_LEVELS && (float)(this->resolution >> (shadow.level + 1)) >= screen_size) {
+			shadow.level++;
+		}
+		shadow.resolution = this->resolution >> shadow.level;
+
+		glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, shadow.far_plane);
+		for (int f = 0; f < 6; f++) {
+			shadow.face_matrices[f] = proj * glm::lookAt(shadow.position, shadow.position + FACE_DIRECTIONS[f], FACE_UPS[f]);
+		}
+		float r = shadow.far_plane;
+		shadow.cull_matrix = glm::ortho(-r, r, -r, r, -r, r) * glm::translate(glm::mat4(1.0f), -shadow.position);
+	}
+	for (int i = this->shadow_count; i < MAX_POINT_SHADOWS; i++) {
+		this->shadows[i].light = -1;
+		this->shadows[i].active = false;
+	}
+}
+
+void PointShadows::begin(int level) {
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, level);
+	int size = this->allocated_resolution >> level;
+	glViewport(0, 0, size, size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(POINT_SHADOW_SLOPE_BIAS, POINT_SHADOW_CONSTANT_BIAS);
+}
+
+void PointShadows::end() {
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+int PointShadows::getShadowCount() {
+	return this->shadow_count;
+}
+
+const PointShadow& PointShadows::getShadow(int cube) {
+	return this->shadows[cube];
+}
+
+bool PointShadows::isLevelUsed(int level) {
+	for (int i = 0; i < this->shadow_count; i++) {
+		if (this->shadows[i].active && this->shadows[i].level == level) {
+			return true;
+		}
+	}
+	return false;
+}
+
+unsigned int PointShadows::getTexture() {
+	return this->texture;
+}
+
+void PointShadows::clear() {
+	if (this->texture != 0) {
+		glDeleteTextures(1, &this->texture);
+		glDeleteFramebuffers(1, &this->fbo);
+		this->texture = 0;
+		this->fbo = 0;
+	}
+	this->allocated_resolution = 0;
+	this->shadow_count = 0;
+}
@@ -0,0 +1,106 @@
+#ifndef POINT_SHADOWS_H
+#define POINT_SHADOWS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <utility>
+
+#include "Camera.h"
+#include "Frustum.h"
+#include "PointLight.h"
+
+// Cubes in the atlas, matches MAX_POINT_SHADOWS in fragment_standard.glsl.
+#define MAX_POINT_SHADOWS 4
+// Resolution tiers, each half the size of the one before.
+#define POINT_SHADOW_LEVELS 4
+// Near plane of the faces, also in fragment_standard.glsl. Geometry closer
+// to the light than this, like its own gizmo, casts no shadow.
+#define POINT_SHADOW_NEAR 0.2f
+// Caps the far plane of lights that never fade out.
+#define POINT_SHADOW_MAX_RADIUS 100.0f
+// glPolygonOffset while casters are drawn.
+#define POINT_SHADOW_SLOPE_BIAS 2.0f
+#define POINT_SHADOW_CONSTANT_BIAS 4.0f
+// Unit the atlas is bound to, next to SHADOW_MAP_TEXTURE_UNIT.
+#define POINT_SHADOW_TEXTURE_UNIT 13
+
+struct PointShadow {
+	// Index of the light in the list given to update.
+	int light;
+	glm::vec3 position;
+	// Attenuation radius of the light, the far plane of every face.
+	float far_plane;
+	// Cube of the atlas, the faces are layers layer * 6 to layer * 6 + 5.
+	int layer;
+	// Mip level of the atlas the light renders to and is sampled from.
+	int level;
+	int resolution;
+	// False when the cube is unused.
+	bool active;
+	// View projection of each face, in cube map face order.
+	glm::mat4 face_matrices[6];
+	// Box around the light's sphere, casters outside of it are culled.
+	glm::mat4 cull_matrix;
+};
+
+// Cube shadow maps of point lights, drawn in one pass per light. A geometry
+// shader sends each triangle to the faces it touches through gl_Layer, so a
+// caster is submitted once instead of six times.
+//
+// Lights get a cube of a shared depth cube map array, those covering most of
+// the screen first when there are more in view than cubes. The cubes of an
+// array share a size, so resolution tiers are its mip levels: a light that
+// covers little of the screen renders to and samples from a smaller level.
+// Lights of a level are drawn together, begin clears the whole level.
+//
+// Depth is stored without compare mode, the shader reads it through a
+// samplerCubeArray with an explicit level and compares itself. Needs a
+// GL 4.0 context and a 4.x shader header.
+class PointShadows {
+
+	public:
+		PointShadows();
+
+		static bool isSupported();
+
+		// Size of level 0, takes effect at the next update.
+		void setResolution(int resolution);
+
+		// Hands out the cubes, places their faces and picks their levels
+		// from the size of each sphere on a viewport viewport_height
+		// pixels tall.
+		void update(Camera* camera, const std::vector<PointLight*>& lights, int viewport_height);
+		// Binds one level of every cube as a layered depth target, cleared.
+		// Depth bias stays on until end().
+		void begin(int level);
+		void end();
+
+		// Cubes in use, the first getShadowCount of getShadow.
+		int getShadowCount();
+		const PointShadow& getShadow(int cube);
+		// Whether a cube in use has the level.
+		bool isLevelUsed(int level);
+		// GL_TEXTURE_CUBE_MAP_ARRAY, sample it through a samplerCubeArray.
+		unsigned int getTexture();
+		void clear();
+
+	private:
+		PointShadow shadows[MAX_POINT_SHADOWS];
+		int shadow_count;
+		int resolution;
+		// Screen size and index of the lights in view.
+		std::vector<std::pair<float, int>> candidates;
+
+		unsigned int texture;
+		unsigned int fbo;
+		int allocated_resolution;
+
+		void allocate(int size);
+};
+
+#endif
@@ -0,0 +1,483 @@
+#include "RenderQueue.h"
+
+#include <cstring>
+
+RenderQueue::RenderQueue() {
+	std::memset(&this->stats, 0, sizeof(RenderQueueStats));
+	this->sorted = false;
+	this->instance_buffer = 0;
+	this->multi_draw = false;
+	this->draw_data_buffer = 0;
+	this->indirect_buffer = 0;
+	this->counts.resize(1 << 16);
+}
+
+void RenderQueue::clear() {
+	this->items.clear();
+	this->sorted = false;
+}
+
+void RenderQueue::reset() {
+	this->clear();
+	this->program_ids.clear();
+	this->mesh_texture_sets.clear();
+	this->mesh_ids.clear();
+	this->texture_sets.clear();
+}
+
+void RenderQueue::push(RenderPass pass, Mesh* mesh, Shader* shader, const SceneUniforms* uniforms, glm::mat4 model, glm::vec3 color, bool has_diffuse, bool has_specular, float depth, unsigned int lod) {
+	DrawItem item;
+	item.mesh = mesh;
+	item.shader = shader;
+	item.uniforms = uniforms;
+	item.instance.model = model;
+	item.instance.color = color;
+	item.instance.draw_id = 0;
+	item.depth_only = pass == PASS_SHADOW;
+	item.has_diffuse = item.depth_only ? 0 : (int)has_diffuse;
+	item.has_specular = item.depth_only ? 0 : (int)has_specular;
+	item.material = (item.has_diffuse ? 1 : 0) | (item.has_specular ? 2 : 0);
+	item.lod = lod;
+
+	// depth is expected in [0, 1], front to back
+	const uint64_t depth_max = (1ull << DRAW_KEY_DEPTH_BITS) - 1;
+	depth = glm::clamp(depth, 0.0f, 1.0f);
+
+	uint64_t key = 0;
+	key |= ((uint64_t)pass & 0xF) << DRAW_KEY_PASS_SHIFT;
+	key |= ((uint64_t)this->programId(shader) & 0xFFF) << DRAW_KEY_PROGRAM_SHIFT;
+	key |= ((uint64_t)item.material & 0x3F) << DRAW_KEY_MATERIAL_SHIFT;
+	// Casters of any texture set can share a batch.
+	if (!item.depth_only) {
+		key |= ((uint64_t)this->textureSetId(mesh) & 0xFFF) << DRAW_KEY_TEXTURE_SHIFT;
+	}
+	key |= ((uint64_t)this->meshId(mesh) & 0xFFF) << DRAW_KEY_MESH_SHIFT;
+	key |= ((uint64_t)lod & 0x3) << DRAW_KEY_LOD_SHIFT;
+	key |= (uint64_t)(depth * depth_max) & depth_max;
+	item.key = key;
+
+	this->items.push_back(item);
+}
+
+uint32_t RenderQueue::programId(Shader* shader) {
+	auto iter = this->program_ids.find(shader);
+	if (iter != this->program_ids.end()) {
+		return iter->second;
+	}
+	uint32_t id = (uint32_t)this->program_ids.size();
+	this->program_ids.insert(std::make_pair(shader, id));
+	return id;
+}
+
+uint32_t RenderQueue::textureSetId(Mesh* mesh) {
+	auto iter = this->mesh_texture_sets.find(mesh);
+	if (iter != this->mesh_texture_sets.end()) {
+		return iter->second;
+	}
+
+	std::vector<unsigned int> ids;
+	for (unsigned int i = 0; i < mesh->textures.size(); i++) {
+		ids.push_back(mesh->textures[i].id);
+	}
+	auto set_iter = this->texture_sets.find(ids);
+	uint32_t id;
+	if (set_iter != this->texture_sets.end()) {
+		id = set_iter->second;
+	} else {
+		id = (uint32_t)this->texture_sets.size();
+		this->texture_sets.insert(std::make_pair(ids, id));
+	}
+	this->mesh_texture_sets.insert(std::make_pair(mesh, id));
+	return id;
+}
+
+uint32_t RenderQueue::meshId(Mesh* mesh) {
+	auto iter = this->mesh_ids.find(mesh);
+	if (iter != this->mesh_ids.end()) {
+		return iter->second;
+	}
+	uint32_t id = (uint32_t)this->mesh_ids.size();
+	this->mesh_ids.insert(std::make_pair(mesh, id));
+	return id;
+}
+
+void RenderQueue::sort() {
+	this->radixSort();
+	this->sorted = true;
+}
+
+// LSD radix sort over the keys, 16 bits per pass. Passes whose digit is the
+// same for every item are skipped, which is most of them for small queues.
+void RenderQueue::radixSort() {
+	size_t n = this->items.size();
+	this->order.resize(n);
+	this->scratch.resize(n);
+	this->keys.resize(n);
+	this->scratch_keys.resize(n);
+
+	for (size_t i = 0; i < n; i++) {
+		this->order[i] = (uint32_t)i;
+		this->keys[i] = this->items[i].key;
+	}
+
+	std::vector<uint32_t>& counts = this->counts;
+	for (int shift = 0; shift < 64; shift += 16) {
+		std::fill(counts.begin(), counts.end(), 0);
+		for (size_t i = 0; i < n; i++) {
+			counts[(this->keys[i] >> shift) & 0xFFFF]++;
+		}
+		if (n == 0 || counts[(this->keys[0] >> shift) & 0xFFFF] == n) {
+			continue;
+		}
+
+		uint32_t sum = 0;
+		for (size_t d = 0; d < counts.size(); d++) {
+			uint32_t c = counts[d];
+			counts[d] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			uint32_t dst = counts[(this->keys[i] >> shift) & 0xFFFF]++;
+			this->scratch[dst] = this->order[i];
+			this->scratch_keys[dst] = this->keys[i];
+		}
+		this->order.swap(this->scratch);
+		this->keys.swap(this->scratch_keys);
+	}
+}
+
+void RenderQueue::submit() {
+	std::memset(&this->stats, 0, sizeof(RenderQueueStats));
+
+	if (!this->sorted) {
+		this->sort();
+	}
+	if (this->order.empty()) {
+		return;
+	}
+
+	// Lay the instances out in draw order so every batch is a contiguous
+	// range, then upload them all at once.
+	this->instances.resize(this->order.size());
+	for (size_t n = 0; n < this->order.size(); n++) {
+		this->instances[n] = this->items[this->order[n]].instance;
+	}
+	this->buildBatches();
+	if (this->multi_draw) {
+		// Every instance of a batch points at the batch's per-draw entry.
+		for (unsigned int b = 0; b < this->batches.size(); b++) {
+			for (size_t n = this->batches[b].first; n < this->batches[b].first + this->batches[b].count; n++) {
+				this->instances[n].draw_id = b;
+			}
+		}
+	}
+	if (this->instance_buffer == 0) {
+		glGenBuffers(1, &this->instance_buffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, this->instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, this->instances.size() * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, this->instances.size() * sizeof(InstanceData), &this->instances[0]);
+
+	// State outside the queue is unknown, so the first bind of each kind always happens.
+	SubmitState state;
+	state.shader = nullptr;
+	state.material = 0xFFFFFFFF;
+	state.texture_set = 0xFFFFFFFF;
+	state.vao = 0xFFFFFFFF;
+	state.mesh = nullptr;
+	for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+		state.textures[i] = 0xFFFFFFFF;
+	}
+	state.active_unit = -1;
+
+	if (this->multi_draw) {
+		this->submitMultiDraw(state);
+	} else {
+		this->submitBatches(state);
+	}
+
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void RenderQueue::buildBatches() {
+	this->batches.clear();
+	size_t n = 0;
+	while (n < this->order.size()) {
+		DrawItem& item = this->items[this->order[n]];
+
+		// Everything above the depth bits matches for the whole batch. Ids wrap
+		// past their bit width, so the mesh and program are compared as well.
+		uint64_t batch_key = item.key >> DRAW_KEY_DEPTH_BITS;
+		size_t count = 1;
+		while (n + count < this->order.size()) {
+			DrawItem& next = this->items[this->order[n + count]];
+			if ((next.key >> DRAW_KEY_DEPTH_BITS) != batch_key || next.mesh != item.mesh || next.shader != item.shader || next.lod != item.lod) {
+				break;
+			}
+			count++;
+		}
+
+		Batch batch;
+		batch.first = n;
+		batch.count = count;
+		batch.first_command = 0;
+		batch.command_count = 0;
+		this->batches.push_back(batch);
+		n += count;
+	}
+}
+
+// Binds program, material, textures and VAO for the item, skipping what is
+// already set.
+void RenderQueue::applyState(DrawItem& item, SubmitState& state) {
+	Shader* shader = item.shader;
+	const SceneUniforms* u = item.uniforms;
+
+	bool program_changed = shader != state.shader;
+	if (program_changed) {
+		shader->use();
+		state.shader = shader;
+		state.material = 0xFFFFFFFF;
+		this->stats.program_binds++;
+	} else {
+		this->stats.program_binds_skipped++;
+	}
+
+	if (item.depth_only) {
+		// Nothing a depth pass reads.
+	} else if (item.material != state.material) {
+		shader->setInt(u->has_diffuse, item.has_diffuse);
+		shader->setInt(u->has_specular, item.has_specular);
+		state.material = item.material;
+		this->stats.material_updates++;
+	} else {
+		this->stats.material_updates_skipped++;
+	}
+
+	// Sampler uniforms are program state, they only need setting when the
+	// program or the texture set (and with it the sampler names) changes.
+	uint64_t texture_set = (item.key >> DRAW_KEY_TEXTURE_SHIFT) & 0xFFF;
+	bool samplers_changed = program_changed || texture_set != state.texture_set;
+	state.texture_set = texture_set;
+
+	const std::vector<Texture>& textures = item.mesh->textures;
+	const std::vector<IntUniform>& samplers = item.mesh->getSamplerUniforms(*shader);
+	for (unsigned int i = 0; !item.depth_only && i < textures.size() && i < MAX_TEXTURE_UNITS; i++) {
+		if (samplers_changed) {
+			shader->setInt(samplers[i], i);
+		}
+		if (state.textures[i] == textures[i].id) {
+			this->stats.texture_binds_skipped++;
+			continue;
+		}
+		if (state.active_unit != (int)i) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			state.active_unit = i;
+		}
+		glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		state.textures[i] = textures[i].id;
+		this->stats.texture_binds++;
+	}
+
+	// Program state as well, so a new program needs them again. Multi-draw
+	// shaders read them from the per-draw buffer instead.
+	if (!this->multi_draw && (program_changed || item.mesh != state.mesh)) {
+		shader->setVector(u->position_offset, item.mesh->getPositionOffset());
+		shader->setVector(u->position_scale, item.mesh->getPositionScale());
+		state.mesh = item.mesh;
+		this->stats.vertex_format_updates++;
+	}
+
+	unsigned int vao = itemVAO(item);
+	if (vao != state.vao) {
+		glBindVertexArray(vao);
+		state.vao = vao;
+		this->stats.vao_binds++;
+	} else {
+		this->stats.vao_binds_skipped++;
+	}
+}
+
+void RenderQueue::submitBatches(SubmitState& state) {
+	for (unsigned int b = 0; b < this->batches.size(); b++) {
+		const Batch& batch = this->batches[b];
+		DrawItem& item = this->items[this->order[batch.first]];
+		this->applyState(item, state);
+
+		item.mesh->bindInstanceData(this->instance_buffer, batch.first * sizeof(InstanceData));
+		item.mesh->drawLod(item.lod, (unsigned int)batch.count);
+		const MeshLod& lod = item.mesh->getLod(item.lod);
+		this->stats.draws++;
+		this->stats.instances += (unsigned int)batch.count;
+		this->stats.triangles += lod.index_count / 3 * (unsigned int)batch.count;
+	}
+}
+
+bool RenderQueue::sameTextures(Mesh* a, Mesh* b) {
+	if (a->textures.size() != b->textures.size()) {
+		return false;
+	}
+	for (unsigned int i = 0; i < a->textures.size(); i++) {
+		if (a->textures[i].id != b->textures[i].id) {
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned int RenderQueue::itemVAO(const DrawItem& item) {
+	return item.depth_only ? item.mesh->getDepthVAO() : item.mesh->getVAO();
+}
+
+// Instance attributes are bound once per VAO at offset 0, each command's
+// base instance selects its range and the instances' draw_id its entry in
+// the per-draw buffer.
+void RenderQueue::submitMultiDraw(SubmitState& state) {
+	this->draw_data.resize(this->batches.size());
+	this->commands.clear();
+	for (unsigned int b = 0; b < this->batches.size(); b++) {
+		Batch& batch = this->batches[b];
+		DrawItem& item = this->items[this->order[batch.first]];
+		batch.first_command = this->commands.size();
+		this->draw_data[b].position_offset = glm::vec4(item.mesh->getPositionOffset(), 0.0f);
+		this->draw_data[b].position_scale = glm::vec4(item.mesh->getPositionScale(), 0.0f);
+		item.mesh->appendDrawCommands(item.lod, (unsigned int)batch.count, (unsigned int)batch.first, this->commands);
+		batch.command_count = this->commands.size() - batch.first_command;
+	}
+
+	if (this->draw_data_buffer == 0) {
+		glGenBuffers(1, &this->draw_data_buffer);
+		glGenBuffers(1, &this->indirect_buffer);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->draw_data_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, this->draw_data.size() * sizeof(DrawDataBlock), this->draw_data.data(), GL_STREAM_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_SSBO_BINDING, this->draw_data_buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirect_buffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, this->commands.size() * sizeof(DrawElementsIndirectCommand), this->commands.data(), GL_STREAM_DRAW);
+
+	unsigned int b = 0;
+	while (b < this->batches.size()) {
+		DrawItem& item = this->items[this->order[this->batches[b].first]];
+		GLenum index_type = item.mesh->getIndexType();
+
+		unsigned int run = 0;
+		size_t command_count = 0;
+		while (b + run < this->batches.size()) {
+			const Batch& batch = this->batches[b + run];
+			DrawItem& next = this->items[this->order[batch.first]];
+			if (run > 0 && (next.shader != item.shader || next.material != item.material || next.depth_only != item.depth_only
+				|| itemVAO(next) != itemVAO(item) || next.mesh->getIndexType() != index_type
+				|| (!item.depth_only && !sameTextures(next.mesh, item.mesh)))) {
+				break;
+			}
+			command_count += batch.command_count;
+			this->stats.draws++;
+			this->stats.instances += (unsigned int)batch.count;
+			this->stats.triangles += next.mesh->getLod(next.lod).index_count / 3 * (unsigned int)batch.count;
+			run++;
+		}
+
+		unsigned int vao = state.vao;
+		this->applyState(item, state);
+		if (state.vao != vao) {
+			item.mesh->bindInstanceData(this->instance_buffer, 0);
+		}
+		// Runs are consecutive batches, so their commands are too.
+		size_t first_command = this->batches[b].first_command;
+		glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, (void*)(first_command * sizeof(DrawElementsIndirectCommand)), (GLsizei)command_count, 0);
+		this->stats.multi_draws++;
+		this->stats.indirect_commands += (unsigned int)command_count;
+
+		b += run;
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void RenderQueue::submitIndirect(const std::vector<IndirectRun>& runs, unsigned int instance_buffer, unsigned int draw_data_buffer, unsigned int indirect_buffer) {
+	if (!this->multi_draw || runs.empty()) {
+		return;
+	}
+
+	SubmitState state;
+	state.shader = nullptr;
+	state.material = 0xFFFFFFFF;
+	state.texture_set = 0xFFFFFFFF;
+	state.vao = 0xFFFFFFFF;
+	state.mesh = nullptr;
+	for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+		state.textures[i] = 0xFFFFFFFF;
+	}
+	state.active_unit = -1;
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_SSBO_BINDING, draw_data_buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+	size_t r = 0;
+	while (r < runs.size()) {
+		const IndirectRun& run = runs[r];
+		DrawItem item;
+		item.mesh = run.mesh;
+		item.shader = run.shader;
+		item.uniforms = run.uniforms;
+		item.depth_only = run.depth_only;
+		item.has_diffuse = run.depth_only ? 0 : (int)run.has_diffuse;
+		item.has_specular = run.depth_only ? 0 : (int)run.has_specular;
+		item.material = (item.has_diffuse ? 1 : 0) | (item.has_specular ? 2 : 0);
+		item.lod = 0;
+		item.key = run.depth_only ? 0 : ((uint64_t)this->textureSetId(run.mesh) & 0xFFF) << DRAW_KEY_TEXTURE_SHIFT;
+		GLenum index_type = run.mesh->getIndexType();
+
+		size_t count = 1;
+		size_t command_count = run.command_count;
+		while (r + count < runs.size()) {
+			const IndirectRun& next = runs[r + count];
+			unsigned int material = next.depth_only ? 0 : (next.has_diffuse ? 1 : 0) | (next.has_specular ? 2 : 0);
+			unsigned int next_vao = next.depth_only ? next.mesh->getDepthVAO() : next.mesh->getVAO();
+			if (next.shader != run.shader || material != item.material || next.depth_only != run.depth_only || next_vao != itemVAO(item)
+				|| next.mesh->getIndexType() != index_type || (!run.depth_only && !sameTextures(next.mesh, run.mesh))
+				|| next.first_command != run.first_command + command_count) {
+				break;
+			}
+			command_count += next.command_count;
+			count++;
+		}
+
+		unsigned int vao = state.vao;
+		this->applyState(item, state);
+		if (state.vao != vao) {
+			run.mesh->bindInstanceData(instance_buffer, 0);
+		}
+		glMultiDrawElementsIndirect(GL_TRIANGLES, index_type, (void*)(run.first_command * sizeof(DrawElementsIndirectCommand)), (GLsizei)command_count, 0);
+		this->stats.draws += (unsigned int)count;
+		this->stats.multi_draws++;
+		this->stats.indirect_commands += (unsigned int)command_count;
+
+		r += count;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+unsigned int RenderQueue::size() {
+	return (unsigned int)this->items.size();
+}
+
+const RenderQueueStats& RenderQueue::getStats() {
+	return this->stats;
+}
+
+void RenderQueue::setMultiDraw(bool enabled) {
+	this->multi_draw = enabled && isMultiDrawSupported();
+}
+
+bool RenderQueue::getMultiDraw() {
+	return this->multi_draw;
+}
+
+// glMultiDrawElementsIndirect with base instances and shader storage buffers.
+bool RenderQueue::isMultiDrawSupported() {
+	return GLAD_GL_VERSION_4_3 != 0;
+}
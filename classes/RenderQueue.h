@@ -0,0 +1,198 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Mesh.h"
+#include "Shader.h"
+
+// Draw key layout, most significant bits first:
+//   pass (4) | program (12) | material (6) | texture set (12) | mesh (12) | lod (2) | depth (16)
+// Items that only differ in depth share a mesh, level of detail and all
+// state, and are drawn as one instanced batch.
+#define DRAW_KEY_PASS_SHIFT 60
+#define DRAW_KEY_PROGRAM_SHIFT 48
+#define DRAW_KEY_MATERIAL_SHIFT 42
+#define DRAW_KEY_TEXTURE_SHIFT 30
+#define DRAW_KEY_MESH_SHIFT 18
+#define DRAW_KEY_LOD_SHIFT 16
+#define DRAW_KEY_DEPTH_BITS 16
+
+#define MAX_TEXTURE_UNITS 16
+
+// Binding of the per-draw buffer read by shaders compiled with MULTI_DRAW,
+// matches the binding qualifier of their Draws block.
+#define DRAW_DATA_SSBO_BINDING 0
+
+enum RenderPass {
+	PASS_SHADOW = 0,
+	PASS_OPAQUE = 1,
+	PASS_TRANSPARENT = 2
+};
+
+// Per-draw uniforms, resolved once when the shader is added so the render
+// loop never looks anything up by name. Camera and lights come from the
+// shared uniform buffers, transforms and colors from the instance buffer.
+struct SceneUniforms {
+	IntUniform has_diffuse;
+	IntUniform has_specular;
+	// Dequantization of packed vertex positions, per mesh.
+	Vec3Uniform position_offset;
+	Vec3Uniform position_scale;
+};
+
+// std430 mirror of DrawData in the model vertex shaders, one per batch.
+struct DrawDataBlock {
+	glm::vec4 position_offset;
+	glm::vec4 position_scale;
+};
+
+struct DrawItem {
+	uint64_t key;
+	Mesh* mesh;
+	Shader* shader;
+	const SceneUniforms* uniforms;
+	InstanceData instance;
+	int has_diffuse;
+	int has_specular;
+	unsigned int material;
+	unsigned int lod;
+	// Shadow pass items draw positions only and set no material or textures.
+	bool depth_only;
+};
+
+// Indirect commands of one mesh whose instance counts, instances and
+// per-draw entries were written on the GPU.
+struct IndirectRun {
+	Mesh* mesh;
+	Shader* shader;
+	const SceneUniforms* uniforms;
+	bool has_diffuse;
+	bool has_specular;
+	bool depth_only;
+	size_t first_command;
+	size_t command_count;
+};
+
+// State changes issued and skipped during the last submit().
+struct RenderQueueStats {
+	unsigned int draws;
+	unsigned int instances;
+	unsigned int triangles;
+	unsigned int program_binds;
+	unsigned int program_binds_skipped;
+	unsigned int material_updates;
+	unsigned int material_updates_skipped;
+	unsigned int texture_binds;
+	unsigned int texture_binds_skipped;
+	unsigned int vao_binds;
+	unsigned int vao_binds_skipped;
+	unsigned int vertex_format_updates;
+	// glMultiDrawElementsIndirect calls and the commands they carried, draws
+	// counts the batches either way.
+	unsigned int multi_draws;
+	unsigned int indirect_commands;
+};
+
+class RenderQueue {
+
+	public:
+		RenderQueue();
+
+		void clear();
+		// Also forgets the program, mesh and texture set ids. Call it before
+		// meshes or shaders are freed, the ids are keyed by address and a new
+		// object at the same one would inherit a stale id.
+		void reset();
+		void push(RenderPass pass, Mesh* mesh, Shader* shader, const SceneUniforms* uniforms, glm::mat4 model, glm::vec3 color, bool has_diffuse, bool has_specular, float depth, unsigned int lod = 0);
+		void sort();
+		void submit();
+
+		unsigned int size();
+		const RenderQueueStats& getStats();
+
+		// Submits runs of batches that share program, material, textures,
+		// VAO and index type with one glMultiDrawElementsIndirect each. Needs
+		// a GL 4.3 context and shaders compiled with MULTI_DRAW defined, which
+		// read the per-mesh state from a buffer instead of uniforms.
+		void setMultiDraw(bool enabled);
+		bool getMultiDraw();
+		// Reads GLAD_GL_VERSION_4_3, so glad has to be generated for GL 4.3
+		// or later. A 3.3 loader neither declares the flag nor loads the
+		// indirect and shader storage entry points.
+		static bool isMultiDrawSupported();
+		// Draws runs out of buffers filled by someone else, merging neighbours
+		// the same way the multi-draw path does. Needs multi-draw, adds to the
+		// stats of the last submit() except for instances and triangles, which
+		// only the GPU knows.
+		void submitIndirect(const std::vector<IndirectRun>& runs, unsigned int instance_buffer, unsigned int draw_data_buffer, unsigned int indirect_buffer);
+
+	private:
+		std::vector<DrawItem> items;
+		std::vector<uint32_t> order;
+		std::vector<uint32_t> scratch;
+		std::vector<uint64_t> keys;
+		std::vector<uint64_t> scratch_keys;
+		// Digit histogram of one radix pass, sized once.
+		std::vector<uint32_t> counts;
+		std::vector<InstanceData> instances;
+		unsigned int instance_buffer;
+
+		// Contiguous range of the sorted order drawn as one instanced draw.
+		struct Batch {
+			size_t first;
+			size_t count;
+			// Indirect commands of the batch, more than one for chunked meshes.
+			size_t first_command;
+			size_t command_count;
+		};
+		std::vector<Batch> batches;
+
+		// Last state set during submit, anything outside the queue is unknown.
+		struct SubmitState {
+			Shader* shader;
+			unsigned int material;
+			uint64_t texture_set;
+			unsigned int vao;
+			Mesh* mesh;
+			unsigned int textures[MAX_TEXTURE_UNITS];
+			int active_unit;
+		};
+
+		bool multi_draw;
+		std::vector<DrawDataBlock> draw_data;
+		std::vector<DrawElementsIndirectCommand> commands;
+		unsigned int draw_data_buffer;
+		unsigned int indirect_buffer;
+
+		// Ids that stay stable across frames so keys sort the same way.
+		std::unordered_map<Shader*, uint32_t> program_ids;
+		std::unordered_map<const Mesh*, uint32_t> mesh_texture_sets;
+		std::unordered_map<const Mesh*, uint32_t> mesh_ids;
+		std::map<std::vector<unsigned int>, uint32_t> texture_sets;
+
+		RenderQueueStats stats;
+		bool sorted;
+
+		uint32_t programId(Shader* shader);
+		uint32_t textureSetId(Mesh* mesh);
+		uint32_t meshId(Mesh* mesh);
+		void radixSort();
+		void buildBatches();
+		void applyState(DrawItem& item, SubmitState& state);
+		void submitBatches(SubmitState& state);
+		void submitMultiDraw(SubmitState& state);
+		static bool sameTextures(Mesh* a, Mesh* b);
+		static unsigned int itemVAO(const DrawItem& item);
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "Scene.h"
 
+#include <filesystem>
+
 Scene::Scene() {
 	this->render_window = nullptr;
 	this->num_models = 0;
@@ -7,28 +9,37 @@ Scene::Scene() {
 	this->num_dlights = 0;
 	this->num_cameras = 0;
 	this->active_camera = "";
+	this->camera_ubo = nullptr;
+	this->lights_ubo = nullptr;
+	this->asset_loader = nullptr;
+	this->cull_stats = CullStats();
+	this->lod_pixel_error = LOD_PIXEL_ERROR;
+	this->viewport_height = 0;
+	this->lod_stats = LodStats();
+	this->gpu_culling = false;
+	this->cull_debug = false;
+	this->cull_debug_view_proj = glm::mat4(1.0f);
+	this->occlusion_culling = false;
+	this->occlusion_depth = 0;
+	this->occlusion_width = 0;
+	this->occlusion_height = 0;
+	this->pyramid_view_proj = glm::mat4(1.0f);
+	this->static_revision = 0;
 }
 
-Scene::Scene(GLFWwindow* window) {
-	this->render_window = window;
-	this->num_models = 0;
-	this->num_shaders = 0;
-	this->num_dlights = 0;
-	this->num_cameras = 0;
-	this->active_camera = "";
+Scene::Scene(GLFWwindow* window) : Scene() {
+	this->init(window);
 }
 
-Scene::Scene(const Scene& scene) {
-	this->render_window = scene.render_window;
-	this->num_models = scene.num_models;
-	this->num_shaders = scene.num_shaders;
-	this->num_dlights = scene.num_dlights;
-	this->num_cameras = scene.num_cameras;
-	this->models = scene.models;
-	this->shaders = scene.shaders;
-	this->cameras = scene.cameras;
-	this->dlights = scene.dlights;
-	this->active_camera = scene.active_camera;
+void Scene::init(GLFWwindow* window) {
+	if (this->camera_ubo != nullptr) {
+		std::cout << "ERROR::SCENE::ALREADY_INITIALISED" << std::endl;
+		return;
+	}
+	this->render_window = window;
+	this->camera_ubo = new UniformBuffer(CAMERA_UBO_BINDING, sizeof(CameraBlock));
+	this->lights_ubo = new UniformBuffer(LIGHTS_UBO_BINDING, sizeof(LightsBlock));
+	this->asset_loader = new AssetLoader();
 }
 
 void Scene::updateCameras() {
@@ -41,97 +52,442 @@ void Scene::updateCameras() {
 }
 
 void Scene::prepareShaders() {
-	auto shader_iter = this->shaders.begin();
+	Camera* camera = this->getActiveCamera();
 
-	while (shader_iter != this->shaders.end()) {
-		shader_iter->second->use();
-		shader_iter->second->setVector("cameraPos", this->getActiveCamera()->getPosition());
-		shader_iter->second->setMatrix("mat_view", this->getActiveCamera()->getView());
-		shader_iter->second->setMatrix("mat_proj", this->getActiveCamera()->getProjection());
-		this->prepareLights(shader_iter->first);
-		++shader_iter;
-	}
+	CameraBlock block;
+	block.mat_view = camera->getView();
+	block.mat_proj = camera->getProjection();
+	block.camera_pos = camera->getPosition();
+	block.pad = 0.0f;
+	this->camera_ubo->update(&block, sizeof(CameraBlock));
+
+	this->prepareLights();
 }
 
-void Scene::prepareLights(std::string shader_id) {
-	
-	Shader* shader = this->getShader(shader_id);
-	std::stringstream ss;
-	std::string num;
-	std::string base_id;
+void Scene::prepareLights() {
+	LightsBlock block = {};
 
 	auto dlight_iter = this->dlights.begin();
 	int i = 0;
 
-	while (dlight_iter != this->dlights.end()) {
-		ss << i;
-		num = ss.str();
-		base_id = "dLights[" + num + "].";
-
-		shader->setVector((base_id + "direction").c_str(), dlight_iter->second->getDirection());
-		shader->setVector((base_id + "ambient").c_str(), dlight_iter->second->getAmbient());
-		shader->setVector((base_id + "diffuse").c_str(), dlight_iter->second->getDiffuse());
-		shader->setVector((base_id + "specular").c_str(), dlight_iter->second->getSpecular());
+	while (dlight_iter != this->dlights.end() && i < MAX_DIR_LIGHTS) {
+		block.dlights[i].direction = dlight_iter->second->getDirection();
+		block.dlights[i].ambient = dlight_iter->second->getAmbient();
+		block.dlights[i].diffuse = dlight_iter->second->getDiffuse();
+		block.dlights[i].specular = dlight_iter->second->getSpecular();
 
-		ss.str("");
 		i++;
 		++dlight_iter;
 	}
+	block.num_dlights = i;
 
-	auto plight_iter = this->plights.begin();
-	i = 0;
+	this->getPointLights(this->point_light_list);
+	this->light_clusters.update(this->getActiveCamera(), this->point_light_list, this->point_shadow_layers);
+	block.num_plights = (int)this->point_light_list.size();
+	block.cluster_scale = this->light_clusters.getDepthScale();
+	block.cluster_bias = this->light_clusters.getDepthBias();
 
-	while (plight_iter != this->plights.end()) {
-		ss << i;
-		num = ss.str();
-		base_id = "pLights[" + num + "].";
-
-		shader->setVector((base_id + "position").c_str(), plight_iter->second->getPosition());
-		shader->setVector((base_id + "ambient").c_str(), plight_iter->second->getAmbient());
-		shader->setVector((base_id + "diffuse").c_str(), plight_iter->second->getDiffuse());
-		shader->setVector((base_id + "specular").c_str(), plight_iter->second->getSpecular());
-		shader->setFloat((base_id + "kc").c_str(), plight_iter->second->getKC());
-		shader->setFloat((base_id + "kl").c_str(), plight_iter->second->getKL());
-		shader->setFloat((base_id + "kq").c_str(), plight_iter->second->getKQ());
-
-		ss.str("");
-		i++;
-		++plight_iter;
-	}
+	this->lights_ubo->update(&block, sizeof(LightsBlock));
+	this->light_clusters.bind();
 }
 
 void Scene::renderModels() {
-	auto model_iter = this->models.begin();
-	while (model_iter != this->models.end()) {
-		Shader* shader = this->getAssignedShader(model_iter->first);
-		shader->use();
-		shader->setInt("material.diffuse", 0);
-		shader->setInt("material.specular", 1);
-		shader->setFloat("material.shininess", 256.0f);
-		shader->setVector("output_color", model_iter->second->getColor());
-		shader->setInt("has_diffuse", (int)model_iter->second->hasDiffuse());
-		shader->setInt("has_specular", (int)model_iter->second->hasSpecular());
+	Camera* camera = this->getActiveCamera();
+	this->renderView(this->cull_debug ? this->cull_debug_view_proj : camera->getProjection() * camera->getView(), true);
+}
+
+void Scene::renderModels(glm::mat4 cull_view_proj) {
+	this->renderView(cull_view_proj, false);
+}
+
+bool Scene::getShadowCasterBounds(AABB& out) {
+	this->updateBounds();
+	AABB dynamic_bounds;
+	AABB static_bounds;
+	bool has_dynamic = this->bvh.getBounds(dynamic_bounds);
+	bool has_static = this->static_bvh.getBounds(static_bounds);
+	if (has_dynamic && has_static) {
+		out.min = glm::min(dynamic_bounds.min, static_bounds.min);
+		out.max = glm::max(dynamic_bounds.max, static_bounds.max);
+	} else if (has_dynamic || has_static) {
+		out = has_dynamic ? dynamic_bounds : static_bounds;
+	}
+	return has_dynamic || has_static;
+}
+
+unsigned int Scene::getStaticRevision() {
+	this->updateBounds();
+	return this->static_revision;
+}
+
+void Scene::renderShadowCasters(Shader* shader, glm::mat4 light_view_proj, int casters) {
+	if (this->shader_uniforms.find(shader) == this->shader_uniforms.end()) {
+		this->resolveUniforms(shader);
+	}
+	this->renderView(light_view_proj, false, shader, casters);
+}
+
+void Scene::renderView(glm::mat4 cull_view_proj, bool main_view, Shader* caster_shader, int casters) {
+	Camera* camera = this->getActiveCamera();
+	glm::vec3 camera_pos = camera->getPosition();
+
+	this->updateBounds();
+
+	this->render_queue.clear();
+	this->cull_frustum.update(cull_view_proj);
+	this->cull_bounds.clear();
+	this->cull_candidates.clear();
+	this->cull_query.clear();
+
+	// The BVH rejects whole subtrees, the survivors get the exact batch test
+	// against their tight bounds.
+	bool gpu_culling = this->gpu_culling && this->getMultiDraw();
+	if (casters & SHADOW_CASTERS_DYNAMIC) {
+		this->bvh.queryFrustum(this->cull_frustum, this->cull_query);
+	}
+	if (!gpu_culling && (casters & SHADOW_CASTERS_STATIC)) {
+		this->static_bvh.queryFrustum(this->cull_frustum, this->cull_query);
+	}
+	for (unsigned int i = 0; i < this->cull_query.size(); i++) {
+		auto entry = static_cast<std::pair<const std::string, Model*>*>(this->cull_query[i]);
+		if (!entry->second->isReady()) {
+			continue;
+		}
+		this->cull_bounds.add(entry->second->getWorldBounds());
+		this->cull_candidates.push_back(std::make_pair(entry->second, this->getAssignedShader(entry->first)));
+	}
+
+	this->cull_frustum.cull(this->cull_bounds, this->cull_visible);
+
+	// Pixels covered by one world unit at distance 1.
+	float pixels_per_unit = (float)this->viewport_height / (2.0f * glm::tan(glm::radians(camera->getFov()) * 0.5f));
+	this->lod_stats = LodStats();
+
+	this->cull_stats.models_tested = (unsigned int)this->models.size() - (gpu_culling ? this->gpu_culler.size() : 0);
+	this->cull_stats.models_visible = 0;
+	this->cull_stats.meshes_tested = 0;
+	this->cull_stats.meshes_visible = 0;
+
+	for (unsigned int c = 0; c < this->cull_candidates.size(); c++) {
+		if (!this->cull_visible[c]) {
+			continue;
+		}
+		this->cull_stats.models_visible++;
+
+		Model* m = this->cull_candidates[c].first;
+		Shader* shader = caster_shader != nullptr ? caster_shader : this->cull_candidates[c].second;
+		const SceneUniforms* u = &this->shader_uniforms[shader];
+		RenderPass pass = caster_shader != nullptr ? PASS_SHADOW : PASS_OPAQUE;
+
 		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, model_iter->second->getPosition());
-		model = glm::scale(model, model_iter->second->getScale());
-		shader->setMatrix("mat_model", model);
-		model_iter->second->draw(*shader);
-		++model_iter;
+		model = glm::translate(model, m->getPosition());
+		model = glm::scale(model, m->getScale());
+
+		float depth = glm::length(m->getPosition() - camera_pos) / camera->getFar();
+		unsigned int lod = this->selectLod(m, camera_pos, pixels_per_unit);
+		this->lod_stats.instances[lod]++;
+
+		std::vector<Mesh>& meshes = m->getMeshes();
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			// A single mesh has the model's bounds, only split models need the finer test.
+			if (meshes.size() > 1) {
+				this->cull_stats.meshes_tested++;
+				if (!this->cull_frustum.testAABB(transformAABB(meshes[i].getBounds(), m->getPosition(), m->getScale()))) {
+					continue;
+				}
+			}
+			this->cull_stats.meshes_visible++;
+			this->render_queue.push(pass, &meshes[i], shader, u, model, m->getColor(), m->hasDiffuse(), m->hasSpecular(), depth, lod);
+		}
 	}
+
+	this->render_queue.sort();
+	this->render_queue.submit();
+
+	if (!gpu_culling || !(casters & SHADOW_CASTERS_STATIC)) {
+		return;
+	}
+	GpuCullView view;
+	view.view_proj = cull_view_proj;
+	view.camera_pos = camera_pos;
+	view.near_plane = camera->getNear();
+	view.pixels_per_unit = pixels_per_unit;
+	view.lod_pixel_error = this->lod_pixel_error;
+	view.lod_hysteresis = LOD_HYSTERESIS;
+	view.occlusion = false;
+	view.hiz_texture = 0;
+	view.hiz_view_proj = glm::mat4(1.0f);
+	view.shadow = caster_shader != nullptr;
+	this->renderStatic(view, main_view, caster_shader);
 }
+
+// Occlusion only applies to the main view, whose depth the pyramid is built
+// from. Dynamic models were drawn before, so they count as occluders.
+void Scene::renderStatic(GpuCullView& view, bool main_view, Shader* caster_shader) {
+	if (caster_shader != nullptr) {
+		this->gpu_culler.cull(view, GPU_CULL_PHASE_ALL, false);
+		this->gpu_culler.draw(this->render_queue, caster_shader, &this->shader_uniforms[caster_shader]);
+		return;
+	}
+	if (!main_view || !this->occlusion_culling || this->occlusion_depth == 0) {
+		this->gpu_culler.cull(view, GPU_CULL_PHASE_ALL, main_view);
+		this->gpu_culler.draw(this->render_queue);
+		return;
+	}
+
+	view.occlusion = this->depth_pyramid.isValid();
+	view.hiz_texture = this->depth_pyramid.getTexture();
+	view.hiz_view_proj = this->pyramid_view_proj;
+
+	// The pyramid stays as it was when the view froze, so what it hides can
+	// be looked at from elsewhere.
+	if (this->cull_debug) {
+		this->gpu_culler.cull(view, GPU_CULL_PHASE_ALL, true);
+		this->gpu_culler.draw(this->render_queue);
+		return;
+	}
+
+	this->gpu_culler.cull(view, GPU_CULL_PHASE_FIRST, false);
+	this->gpu_culler.draw(this->render_queue);
+
+	this->depth_pyramid.build(this->occlusion_depth, this->occlusion_width, this->occlusion_height);
+	this->pyramid_view_proj = view.view_proj;
+	view.occlusion = true;
+	view.hiz_texture = this->depth_pyramid.getTexture();
+	view.hiz_view_proj = this->pyramid_view_proj;
+	this->gpu_culler.cull(view, GPU_CULL_PHASE_SECOND, true);
+	this->gpu_culler.draw(this->render_queue);
+}
+
 void Scene::renderScene() {
 	this->updateCameras();
 	this->renderModels();
 }
 
-void Scene::addModel(std::string id, std::string path) {
-	this->models.insert(std::make_pair(id, new Model(path)));
+void Scene::renderScene(glm::mat4 cull_view_proj) {
+	this->updateCameras();
+	this->renderModels(cull_view_proj);
+}
+
+void Scene::addModel(std::string id, std::string path, int loader) {
+	this->addInstance(id, this->getAsset(path, loader));
+}
+
+AssetHandle Scene::addModelAsync(std::string id, std::string path, int loader) {
+	if (this->asset_loader == nullptr) {
+		this->addModel(id, path, loader);
+		return ASSET_INVALID_HANDLE;
+	}
+
+	std::string key = std::filesystem::path(path).lexically_normal().generic_string();
+	auto handle_iter = this->asset_handles.find(key);
+	AssetHandle handle;
+	if (handle_iter != this->asset_handles.end()) {
+		handle = handle_iter->second;
+	} else {
+		auto asset_iter = this->assets.find(key);
+		if (asset_iter != this->assets.end()) {
+			handle = this->asset_loader->adopt(asset_iter->second);
+		} else {
+			Model* asset = new Model();
+			this->assets.insert(std::make_pair(key, asset));
+			handle = this->asset_loader->loadModel(asset, path, loader);
+		}
+		this->asset_handles.insert(std::make_pair(key, handle));
+	}
+
+	this->addInstance(id, this->asset_loader->getModel(handle));
+	return handle;
+}
+
+int Scene::getAssetState(AssetHandle handle) {
+	if (this->asset_loader == nullptr) {
+		return ASSET_FAILED;
+	}
+	return this->asset_loader->getState(handle);
+}
+
+void Scene::updateAssets(double budget_ms) {
+	if (this->asset_loader == nullptr) {
+		return;
+	}
+	this->assets_ready.clear();
+	this->asset_loader->update(budget_ms, this->assets_ready);
+	if (this->assets_ready.empty()) {
+		return;
+	}
+
+	// Instances were inserted with empty bounds, refit them now that the
+	// asset has its meshes.
+	auto model_iter = this->models.begin();
+	while (model_iter != this->models.end()) {
+		Model* model = model_iter->second;
+		for (unsigned int i = 0; i < this->assets_ready.size(); i++) {
+			if (model->getAsset() == this->assets_ready[i]) {
+				this->getTree(model).update(model->getSceneProxy(), model->getWorldBounds());
+				break;
+			}
+		}
+		++model_iter;
+	}
+	// Groups of the GPU culler follow the meshes of the assets.
+	this->gpu_culler.invalidate();
+	this->static_revision++;
+}
+
+void Scene::addInstance(std::string id, Model* asset) {
+	auto result = this->models.insert(std::make_pair(id, new Model(asset)));
+	Model* model = result.first->second;
+	// The map entry doubles as BVH user data, std::map nodes never move.
+	int proxy = this->bvh.insert(model->getWorldBounds(), &(*result.first));
+	model->setSceneProxy(proxy, &this->dirty_models);
 	this->num_models++;
 }
+
+void Scene::updateBounds() {
+	for (unsigned int i = 0; i < this->dirty_models.size(); i++) {
+		Model* model = this->dirty_models[i];
+		this->getTree(model).update(model->getSceneProxy(), model->getWorldBounds());
+		if (model->isStatic()) {
+			this->gpu_culler.update(model);
+			if (model->hasMoved()) {
+				this->static_revision++;
+			}
+		}
+		model->clearDirty();
+	}
+	this->dirty_models.clear();
+}
+
+BVH& Scene::getTree(Model* model) {
+	return model->isStatic() ? this->static_bvh : this->bvh;
+}
+
+void Scene::setStatic(std::string model_id, bool is_static) {
+	auto iter = this->models.find(model_id);
+	if (iter == this->models.end() || iter->second->isStatic() == is_static) {
+		return;
+	}
+	Model* model = iter->second;
+	this->getTree(model).remove(model->getSceneProxy());
+	model->setStatic(is_static);
+	int proxy = this->getTree(model).insert(model->getWorldBounds(), &(*iter));
+	model->setSceneProxy(proxy, &this->dirty_models);
+	this->static_revision++;
+
+	if (is_static) {
+		Shader* shader = this->findAssignedShader(model_id);
+		this->gpu_culler.add(model, shader, shader != nullptr ? &this->shader_uniforms[shader] : nullptr);
+	} else {
+		this->gpu_culler.remove(model);
+	}
+}
+
+std::string Scene::pick(glm::vec3 origin, glm::vec3 direction) {
+	this->updateBounds();
+
+	std::vector<void*> hits;
+	this->bvh.queryRay(origin, direction, this->getActiveCamera()->getFar(), hits);
+	this->static_bvh.queryRay(origin, direction, this->getActiveCamera()->getFar(), hits);
+
+	glm::vec3 inv_direction = glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	std::string nearest_id = "";
+	float nearest_t = this->getActiveCamera()->getFar();
+	for (unsigned int i = 0; i < hits.size(); i++) {
+		auto entry = static_cast<std::pair<const std::string, Model*>*>(hits[i]);
+		if (!entry->second->isReady()) {
+			continue;
+		}
+		float t;
+		if (intersectRayAABB(origin, inv_direction, entry->second->getWorldBounds(), nearest_t, t) && t < nearest_t) {
+			nearest_t = t;
+			nearest_id = entry->first;
+		}
+	}
+	return nearest_id;
+}
+
+std::string Scene::pickModel(double xpos, double ypos) {
+	glm::vec3 origin, direction;
+	this->getActiveCamera()->getRay(xpos, ypos, origin, direction);
+	return this->pick(origin, direction);
+}
+
+void Scene::queryModels(const AABB& box, std::vector<std::string>& out) {
+	this->updateBounds();
+
+	std::vector<void*> hits;
+	this->bvh.queryAABB(box, hits);
+	this->static_bvh.queryAABB(box, hits);
+	for (unsigned int i = 0; i < hits.size(); i++) {
+		auto entry = static_cast<std::pair<const std::string, Model*>*>(hits[i]);
+		if (overlapAABB(entry->second->getWorldBounds(), box)) {
+			out.push_back(entry->first);
+		}
+	}
+}
+
+void Scene::queryModels(glm::mat4 view_proj, std::vector<std::string>& out) {
+	this->updateBounds();
+
+	Frustum frustum(view_proj);
+	std::vector<void*> hits;
+	this->bvh.queryFrustum(frustum, hits);
+	this->static_bvh.queryFrustum(frustum, hits);
+	for (unsigned int i = 0; i < hits.size(); i++) {
+		auto entry = static_cast<std::pair<const std::string, Model*>*>(hits[i]);
+		if (frustum.testAABB(entry->second->getWorldBounds())) {
+			out.push_back(entry->first);
+		}
+	}
+}
+
+// The first loader asked for a file wins, later requests share that asset.
+Model* Scene::getAsset(std::string path, int loader) {
+	std::string key = std::filesystem::path(path).lexically_normal().generic_string();
+	auto asset_iter = this->assets.find(key);
+	if (asset_iter != this->assets.end()) {
+		return asset_iter->second;
+	}
+	Model* asset = new Model(path, loader);
+	this->assets.insert(std::make_pair(key, asset));
+	return asset;
+}
 void Scene::addShader(std::string id, const char* vpath, const char* fpath) {
-	this->shaders.insert(std::make_pair(id, new Shader(vpath, fpath)));
+	Shader* shader = new Shader(vpath, fpath);
+	this->shaders.insert(std::make_pair(id, shader));
+	this->resolveUniforms(shader);
+	this->num_shaders++;
+}
+
+void Scene::addShader(std::string id, const char* vpath, const char* gpath, const char* fpath) {
+	Shader* shader = new Shader(vpath, gpath, fpath);
+	this->shaders.insert(std::make_pair(id, shader));
+	this->resolveUniforms(shader);
 	this->num_shaders++;
 }
+
+void Scene::resolveUniforms(Shader* shader) {
+	shader->bindUniformBlock("Camera", CAMERA_UBO_BINDING);
+	shader->bindUniformBlock("Lights", LIGHTS_UBO_BINDING);
+
+	SceneUniforms u;
+	u.has_diffuse = shader->getIntUniform("has_diffuse");
+	u.has_specular = shader->getIntUniform("has_specular");
+	u.position_offset = shader->getVec3Uniform("positionOffset");
+	u.position_scale = shader->getVec3Uniform("positionScale");
+
+	this->shader_uniforms[shader] = u;
+
+	// Material samplers and shininess never change, set them once here.
+	shader->use();
+	shader->setInt(shader->getIntUniform("material.diffuse"), 0);
+	shader->setInt(shader->getIntUniform("material.specular"), 1);
+	shader->setFloat(shader->getFloatUniform("material.shininess"), 256.0f);
+	shader->setInt(shader->getIntUniform("pointLightData"), LIGHT_DATA_TEXTURE_UNIT);
+	shader->setInt(shader->getIntUniform("clusterGrid"), CLUSTER_GRID_TEXTURE_UNIT);
+	shader->setInt(shader->getIntUniform("clusterLights"), CLUSTER_INDEX_TEXTURE_UNIT);
+}
 void Scene::addCamera(std::string id) {
 	this->cameras.insert(std::make_pair(id, new Camera(this->render_window)));
 	this->num_cameras++;
@@ -164,15 +520,143 @@ DirectionalLight* Scene::getDirectionalLight(std::string id) {
 PointLight* Scene::getPointLight(std::string id) {
 	return this->plights[id];
 }
+void Scene::getPointLights(std::vector<PointLight*>& out) {
+	out.clear();
+	for (auto plight_iter = this->plights.begin(); plight_iter != this->plights.end(); plight_iter++) {
+		out.push_back(plight_iter->second);
+	}
+}
+void Scene::setPointLightShadows(const std::vector<int>& layers) {
+	this->point_shadow_layers = layers;
+}
 
 void Scene::assignShader(std::string model_id, std::string shader_id) {
 	this->assigned_shaders.insert(std::make_pair(model_id, shader_id));
+
+	auto iter = this->models.find(model_id);
+	if (iter != this->models.end() && iter->second->isStatic()) {
+		Shader* shader = this->findAssignedShader(model_id);
+		this->gpu_culler.setShader(iter->second, shader, shader != nullptr ? &this->shader_uniforms[shader] : nullptr);
+	}
+}
+
+// Unlike getAssignedShader, doesn't add entries for unknown ids.
+Shader* Scene::findAssignedShader(const std::string& model_id) {
+	auto iter = this->assigned_shaders.find(model_id);
+	if (iter == this->assigned_shaders.end()) {
+		return nullptr;
+	}
+	auto shader_iter = this->shaders.find(iter->second);
+	return shader_iter != this->shaders.end() ? shader_iter->second : nullptr;
 }
 
 Shader* Scene::getAssignedShader(std::string model_id) {
 	return this->shaders[this->assigned_shaders[model_id]];
 }
 
+const RenderQueueStats& Scene::getRenderStats() {
+	return this->render_queue.getStats();
+}
+
+void Scene::setMultiDraw(bool enabled) {
+	this->render_queue.setMultiDraw(enabled);
+}
+
+bool Scene::getMultiDraw() {
+	return this->render_queue.getMultiDraw();
+}
+
+void Scene::setGpuCulling(bool enabled) {
+	this->gpu_culling = enabled && this->getMultiDraw() && GpuCuller::isSupported();
+}
+
+bool Scene::getGpuCulling() {
+	return this->gpu_culling;
+}
+
+void Scene::setCullDebug(bool enabled) {
+	if (enabled && !this->cull_debug) {
+		Camera* camera = this->getActiveCamera();
+		this->cull_debug_view_proj = camera->getProjection() * camera->getView();
+	}
+	this->cull_debug = enabled;
+	this->gpu_culler.setDebugView(enabled);
+}
+
+bool Scene::getCullDebug() {
+	return this->cull_debug;
+}
+
+const GpuCullStats& Scene::getGpuCullStats() {
+	return this->gpu_culler.getStats();
+}
+
+void Scene::setOcclusionCulling(bool enabled) {
+	this->occlusion_culling = enabled;
+}
+
+bool Scene::getOcclusionCulling() {
+	return this->occlusion_culling && this->gpu_culling;
+}
+
+void Scene::setOcclusionDepth(unsigned int depth_texture, int width, int height) {
+	this->occlusion_depth = depth_texture;
+	this->occlusion_width = width;
+	this->occlusion_height = height;
+}
+
+const CullStats& Scene::getCullStats() {
+	return this->cull_stats;
+}
+
+const LodStats& Scene::getLodStats() {
+	return this->lod_stats;
+}
+
+const LightClusterStats& Scene::getLightClusterStats() {
+	return this->light_clusters.getStats();
+}
+
+void Scene::setLodPixelError(float pixels) {
+	this->lod_pixel_error = pixels;
+}
+
+void Scene::setViewportHeight(int pixels) {
+	this->viewport_height = pixels;
+}
+
+// Projects each level's error at the nearest point of the bounding sphere
+// and takes the coarsest one under the pixel budget. Going finer happens as
+// soon as the current level is over budget, going coarser only once the new
+// level is well under it.
+unsigned int Scene::selectLod(Model* m, glm::vec3 camera_pos, float pixels_per_unit) {
+	unsigned int count = m->getLodCount();
+	if (count <= 1 || this->lod_pixel_error <= 0.0f || pixels_per_unit <= 0.0f) {
+		m->setLod(0);
+		return 0;
+	}
+
+	BoundingSphere sphere = m->getWorldSphere();
+	float distance = glm::max(glm::length(sphere.center - camera_pos) - sphere.radius, this->getActiveCamera()->getNear());
+	glm::vec3 scale = glm::abs(m->getScale());
+	float to_pixels = glm::max(scale.x, glm::max(scale.y, scale.z)) * pixels_per_unit / distance;
+
+	unsigned int current = glm::min(m->getLod(), count - 1);
+	unsigned int desired = 0;
+	for (unsigned int level = count - 1; level > 0; level--) {
+		if (m->getLodError(level) * to_pixels <= this->lod_pixel_error) {
+			desired = level;
+			break;
+		}
+	}
+	while (desired > current && m->getLodError(desired) * to_pixels > this->lod_pixel_error * (1.0f - LOD_HYSTERESIS)) {
+		desired--;
+	}
+
+	m->setLod(desired);
+	return desired;
+}
+
 void Scene::setActiveCamera(std::string id) {
 	this->active_camera = id;
 }
@@ -186,6 +670,15 @@ void Scene::clearAll() {
 	this->clearModels();
 	this->clearCameras();
 	this->clearLights();
+
+	delete this->camera_ubo;
+	delete this->lights_ubo;
+	delete this->asset_loader;
+	this->depth_pyramid.clear();
+	this->light_clusters.clear();
+	this->camera_ubo = nullptr;
+	this->lights_ubo = nullptr;
+	this->asset_loader = nullptr;
 }
 
 void Scene::clearShaders() {
@@ -196,9 +689,25 @@ void Scene::clearShaders() {
 		++shader_iter;
 	}
 	this->shaders.erase(this->shaders.begin(), this->shaders.end());
+	this->render_queue.reset();
+
+	// The culler holds the shaders and their uniforms, static models are
+	// skipped until a shader is assigned again.
+	for (auto model_iter = this->models.begin(); model_iter != this->models.end(); ++model_iter) {
+		if (model_iter->second->isStatic()) {
+			this->gpu_culler.setShader(model_iter->second, nullptr, nullptr);
+		}
+	}
+	this->shader_uniforms.clear();
 }
 
 void Scene::clearModels() {
+	// Background loads write into assets deleted below.
+	if (this->asset_loader != nullptr) {
+		this->asset_loader->clear();
+	}
+	this->asset_handles.clear();
+
 	auto model_iter = this->models.begin();
 
 	while (model_iter != this->models.end()) {
@@ -206,6 +715,20 @@ void Scene::clearModels() {
 		++model_iter;
 	}
 	this->models.erase(this->models.begin(), this->models.end());
+	this->render_queue.reset();
+	this->bvh.clear();
+	this->static_bvh.clear();
+	this->dirty_models.clear();
+	this->gpu_culler.clear();
+	this->static_revision++;
+
+	auto asset_iter = this->assets.begin();
+
+	while (asset_iter != this->assets.end()) {
+		delete asset_iter->second;
+		++asset_iter;
+	}
+	this->assets.erase(this->assets.begin(), this->assets.end());
 }
 
 void Scene::clearCameras() {
@@ -12,27 +12,102 @@
 #include "PointLight.h"
 #include "Shader.h"
 #include "Camera.h"
+#include "UniformBuffer.h"
+#include "RenderQueue.h"
+#include "BVH.h"
+#include "AssetLoader.h"
+#include "GpuCuller.h"
+#include "LightClusters.h"
 
 #include <vector>
 #include <string>
 #include <map>
 #include <utility>
 
+#define MAX_DIR_LIGHTS 4
+
+// Screen space error in pixels a level of detail may show before a finer one
+// is used. A coarser level is only taken once its error is LOD_HYSTERESIS
+// below that, so instances sitting at a threshold don't switch every frame.
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.25f
+
+// Which models a shadow pass draws, static ones can be cached.
+#define SHADOW_CASTERS_DYNAMIC 1
+#define SHADOW_CASTERS_STATIC 2
+#define SHADOW_CASTERS_ALL 3
+
+// Visible instances drawn at each level during the last renderModels.
+struct LodStats {
+	unsigned int instances[MESH_MAX_LODS];
+};
+
+// std140 mirror of the Camera block in the shaders.
+struct CameraBlock {
+	glm::mat4 mat_view;
+	glm::mat4 mat_proj;
+	glm::vec3 camera_pos;
+	float pad;
+};
+
+struct DirLightBlock {
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+// std140 mirror of the Lights block in the shaders. Point lights live in
+// the buffer textures of LightClusters.
+struct LightsBlock {
+	DirLightBlock dlights[MAX_DIR_LIGHTS];
+	int num_dlights;
+	int num_plights;
+	// Depth slicing of the clusters, see LightClusters::getDepthScale.
+	float cluster_scale;
+	float cluster_bias;
+};
+
 class Scene {
 
 	public:
 
 		Scene();
 		Scene(GLFWwindow* window);
-		Scene(const Scene &scene);
+		// Models register their tree proxies and dirty list with the scene
+		// holding them, which a copy can't share.
+		Scene(const Scene &scene) = delete;
+		Scene& operator=(const Scene &scene) = delete;
+		// Sets a default constructed scene up for window.
+		void init(GLFWwindow* window);
 
 		void prepareShaders();
-		void prepareLights(std::string shader_id);
+		// Uploads the directional lights and builds the point light
+		// clusters of the active camera.
+		void prepareLights();
 		void renderModels();
+		void renderModels(glm::mat4 cull_view_proj);
 		void renderScene();
+		void renderScene(glm::mat4 cull_view_proj);
+		// Depth only pass of everything inside the light's frustum, drawn with
+		// shader from the position stream. Sets up no camera, lights or
+		// materials, the caller sets the light's matrix on shader. casters
+		// is a mask of SHADOW_CASTERS values.
+		void renderShadowCasters(Shader* shader, glm::mat4 light_view_proj, int casters = SHADOW_CASTERS_ALL);
 
-		void addModel(std::string id, std::string path);
+		void addModel(std::string id, std::string path, int loader = MODEL_LOADER_ASSIMP);
+		// Returns at once, the model is placed and transformable right away but
+		// only drawn once its asset has been uploaded by updateAssets.
+		AssetHandle addModelAsync(std::string id, std::string path, int loader = MODEL_LOADER_ASSIMP);
+		int getAssetState(AssetHandle handle);
+		// Spends up to budget_ms on GL uploads of finished background loads.
+		void updateAssets(double budget_ms);
 		void addShader(std::string id, const char* vpath, const char* fpath);
+		void addShader(std::string id, const char* vpath, const char* gpath, const char* fpath);
 		void addCamera(std::string id);
 		void addDirectionalLight(std::string id, glm::vec3 dir, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec);
 		void addPointLight(std::string id, glm::vec3 pos, glm::vec3 amb, glm::vec3 diff, glm::vec3 spec, float kc, float kl, float kq);
@@ -42,9 +117,60 @@ class Scene {
 		Camera* getCamera(std::string id);
 		DirectionalLight* getDirectionalLight(std::string id);
 		PointLight* getPointLight(std::string id);
+		// Every point light, in the order the shaders index them.
+		void getPointLights(std::vector<PointLight*>& out);
+		// Point shadow cube of each light of getPointLights, -1 for none.
+		// Read by the next prepareLights.
+		void setPointLightShadows(const std::vector<int>& layers);
+
+		// Spatial queries over the scene BVH, results are model ids.
+		std::string pick(glm::vec3 origin, glm::vec3 direction);
+		std::string pickModel(double xpos, double ypos);
+		void queryModels(const AABB& box, std::vector<std::string>& out);
+		void queryModels(glm::mat4 view_proj, std::vector<std::string>& out);
+		void updateBounds();
+		// Box around every model that can cast a shadow, false when empty.
+		bool getShadowCasterBounds(AABB& out);
+		// Changes whenever static models move, load, join or leave, so
+		// anything drawn from static casters alone can be kept until then.
+		unsigned int getStaticRevision();
 
 		void assignShader(std::string model_id, std::string shader_id);
 		Shader* getAssignedShader(std::string model_id);
+		// Static models sit in a tree of their own. With GPU culling on they
+		// are culled and drawn without any per-model work on the CPU, moving
+		// one costs an upload of its instance.
+		void setStatic(std::string model_id, bool is_static);
+
+		const RenderQueueStats& getRenderStats();
+		// See RenderQueue::setMultiDraw, the shaders have to match.
+		void setMultiDraw(bool enabled);
+		bool getMultiDraw();
+		const CullStats& getCullStats();
+		const LodStats& getLodStats();
+		const LightClusterStats& getLightClusterStats();
+		// 0 keeps every instance at full detail.
+		void setLodPixelError(float pixels);
+		// Height of the target the main view is drawn into, levels of detail
+		// are picked for it. Every instance stays at full detail until set.
+		void setViewportHeight(int pixels);
+		// Culls static models in a compute pass, needs multi-draw and a 4.3
+		// context. Dynamic models keep going through the BVH.
+		void setGpuCulling(bool enabled);
+		bool getGpuCulling();
+		// Freezes the frustum of the main view where it is. With GPU culling
+		// the rejected static instances are drawn in red, the rest colored by
+		// level of detail.
+		void setCullDebug(bool enabled);
+		bool getCullDebug();
+		// Read back a few frames late, zero until the first pass landed.
+		const GpuCullStats& getGpuCullStats();
+		// Tests static instances against a depth pyramid in two phases, see
+		// GpuCuller. Needs GPU culling and the depth the main view renders
+		// into, which must be a texture.
+		void setOcclusionCulling(bool enabled);
+		bool getOcclusionCulling();
+		void setOcclusionDepth(unsigned int depth_texture, int width, int height);
 
 		void setActiveCamera(std::string id);
 		Camera* getActiveCamera();
@@ -59,12 +185,66 @@ class Scene {
 	private:
 
 		std::map<std::string, Model*> models;
+		// Loaded models by normalised path, every scene model is an instance of one.
+		std::map<std::string, Model*> assets;
 		std::map<std::string, Shader*> shaders;
 		std::map<std::string, Camera*> cameras;
 		std::map<std::string, DirectionalLight*> dlights;
 		std::map<std::string, PointLight*> plights;
 
 		std::map<std::string, std::string> assigned_shaders;
+		std::map<Shader*, SceneUniforms> shader_uniforms;
+
+		UniformBuffer* camera_ubo;
+		UniformBuffer* lights_ubo;
+
+		LightClusters light_clusters;
+		std::vector<PointLight*> point_light_list;
+		std::vector<int> point_shadow_layers;
+
+		RenderQueue render_queue;
+
+		AssetLoader* asset_loader;
+		std::map<std::string, AssetHandle> asset_handles;
+		std::vector<Model*> assets_ready;
+
+		BVH bvh;
+		BVH static_bvh;
+		unsigned int static_revision;
+		std::vector<Model*> dirty_models;
+
+		GpuCuller gpu_culler;
+		bool gpu_culling;
+		bool cull_debug;
+		glm::mat4 cull_debug_view_proj;
+
+		DepthPyramid depth_pyramid;
+		bool occlusion_culling;
+		unsigned int occlusion_depth;
+		int occlusion_width;
+		int occlusion_height;
+		// View the pyramid was last built from.
+		glm::mat4 pyramid_view_proj;
+
+		// Scratch space for culling, kept around to avoid per-frame allocations.
+		Frustum cull_frustum;
+		std::vector<void*> cull_query;
+		BoundsList cull_bounds;
+		std::vector<unsigned char> cull_visible;
+		std::vector<std::pair<Model*, Shader*>> cull_candidates;
+		CullStats cull_stats;
+
+		float lod_pixel_error;
+		int viewport_height;
+		LodStats lod_stats;
+
+		unsigned int selectLod(Model* m, glm::vec3 camera_pos, float pixels_per_unit);
+		// Only the main view reads back GPU culling counters. A caster
+		// shader turns the view into a shadow pass drawn with it.
+		void renderView(glm::mat4 cull_view_proj, bool main_view, Shader* caster_shader = nullptr, int casters = SHADOW_CASTERS_ALL);
+		void renderStatic(GpuCullView& view, bool main_view, Shader* caster_shader);
+		BVH& getTree(Model* model);
+		Shader* findAssignedShader(const std::string& model_id);
 
 		unsigned int num_models;
 		unsigned int num_shaders;
@@ -74,6 +254,10 @@ class Scene {
 
 		GLFWwindow* render_window;
 		std::string active_camera;
+
+		void resolveUniforms(Shader* shader);
+		Model* getAsset(std::string path, int loader);
+		void addInstance(std::string id, Model* asset);
 		
 
 };
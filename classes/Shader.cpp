@@ -1,30 +1,104 @@
 #include "Shader.h"
+#include "AssetArchive.h"
+
+#include <algorithm>
+#include <cstring>
+
+unsigned int Shader::lookup_count = 0;
+std::string Shader::header;
+
+static bool acceptsInt(GLenum type) {
+	switch (type) {
+		case GL_INT:
+		case GL_BOOL:
+		case GL_SAMPLER_2D:
+		case GL_SAMPLER_3D:
+		case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_2D_SHADOW:
+		case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_CUBE_MAP_ARRAY:
+		case GL_SAMPLER_BUFFER:
+		case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool acceptsFloat(GLenum type) {
+	return type == GL_FLOAT;
+}
+
+static bool acceptsVec3(GLenum type) {
+	return type == GL_FLOAT_VEC3;
+}
+
+static bool acceptsMat4(GLenum type) {
+	return type == GL_FLOAT_MAT4;
+}
 
 
 Shader::Shader(const char* vertex_path, const char* fragment_path) {
+	this->geometry_shader = 0;
 	this->loadShaders(vertex_path, fragment_path);
 	this->linkShaders();
 }
 
-void Shader::loadShaders(const char* vertex_path, const char* fragment_path) {
+Shader::Shader(const char* vertex_path, const char* geometry_path, const char* fragment_path) {
+	this->geometry_shader = 0;
+	this->loadShaders(vertex_path, fragment_path);
+	this->loadGeometry(geometry_path);
+	this->linkShaders();
+}
+
+Shader::Shader(const char* compute_path) {
+	this->vertex_source = nullptr;
+	this->fragment_source = nullptr;
+	this->vertex_shader = 0;
+	this->fragment_shader = 0;
+	this->geometry_shader = 0;
+	this->loadCompute(compute_path);
+	this->reflectUniforms();
+}
+
+// The archive copy is used when one is mounted, the loose file otherwise.
+static std::string readSource(const char* path) {
+	std::string source;
+	if (AssetArchive::get().loadText(path, source)) {
+		return source;
+	}
+
 	std::string line;
 	std::stringstream ss;
-	std::ifstream vfile(vertex_path);
-	while (std::getline(vfile, line)) {
+	std::ifstream file(path);
+	while (std::getline(file, line)) {
 		ss << line << "\n";
 	}
-	std::string vsource = ss.str();
+	return ss.str();
+}
+
+static std::string applyHeader(const std::string& source, const std::string& header) {
+	if (header.empty()) {
+		return source;
+	}
+	size_t version = source.find("#version");
+	if (version == std::string::npos) {
+		return header + source;
+	}
+	size_t line_end = source.find('\n', version);
+	line_end = line_end == std::string::npos ? source.size() : line_end + 1;
+	return source.substr(0, version) + header + source.substr(line_end);
+}
+
+void Shader::loadShaders(const char* vertex_path, const char* fragment_path) {
+	std::string vsource = applyHeader(readSource(vertex_path), header);
 	this->vertex_source = vsource.c_str();
 	this->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(this->vertex_shader, 1, &(this->vertex_source), NULL);
 	glCompileShader(this->vertex_shader);
 
-	ss.str("");
-	std::ifstream ffile(fragment_path);
-	while (std::getline(ffile, line)) {
-		ss << line << "\n";
-	}
-	std::string fsource = ss.str();
+	std::string fsource = applyHeader(readSource(fragment_path), header);
 	this->fragment_source = fsource.c_str();
 	this->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(this->fragment_shader, 1, &(this->fragment_source), NULL);
@@ -46,10 +120,55 @@ void Shader::loadShaders(const char* vertex_path, const char* fragment_path) {
 	}
 }
 
+void Shader::loadGeometry(const char* geometry_path) {
+	std::string source = applyHeader(readSource(geometry_path), header);
+	const char* geometry_source = source.c_str();
+	this->geometry_shader = glCreateShader(GL_GEOMETRY_SHADER);
+	glShaderSource(this->geometry_shader, 1, &geometry_source, NULL);
+	glCompileShader(this->geometry_shader);
+
+	int success;
+	char infoLog[512];
+	glGetShaderiv(this->geometry_shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		glGetShaderInfoLog(this->geometry_shader, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+	}
+}
+
+void Shader::loadCompute(const char* compute_path) {
+	std::string source = readSource(compute_path);
+	const char* compute_source = source.c_str();
+	unsigned int compute_shader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(compute_shader, 1, &compute_source, NULL);
+	glCompileShader(compute_shader);
+
+	int success;
+	char infoLog[512];
+	glGetShaderiv(compute_shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		glGetShaderInfoLog(compute_shader, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+	}
+
+	this->shader_program = glCreateProgram();
+	glAttachShader(this->shader_program, compute_shader);
+	glLinkProgram(this->shader_program);
+	glGetProgramiv(this->shader_program, GL_LINK_STATUS, &success);
+	if (!success) {
+		glGetProgramInfoLog(this->shader_program, 512, NULL, infoLog);
+		std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+	}
+	glDeleteShader(compute_shader);
+}
+
 void Shader::linkShaders() {
 	this->shader_program = glCreateProgram();
 	glAttachShader(this->shader_program, this->vertex_shader);
 	glAttachShader(this->shader_program, this->fragment_shader);
+	if (this->geometry_shader != 0) {
+		glAttachShader(this->shader_program, this->geometry_shader);
+	}
 	glLinkProgram(this->shader_program);
 	// check for linking errors
 	int success;
@@ -61,6 +180,68 @@ void Shader::linkShaders() {
 	}
 	glDeleteShader(this->vertex_shader);
 	glDeleteShader(this->fragment_shader);
+	if (this->geometry_shader != 0) {
+		glDeleteShader(this->geometry_shader);
+	}
+
+	this->reflectUniforms();
+}
+
+void Shader::reflectUniforms() {
+	this->uniforms.clear();
+
+	int count = 0;
+	int max_length = 0;
+	glGetProgramiv(this->shader_program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(this->shader_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	std::vector<char> name(max_length > 0 ? max_length : 1);
+	for (int i = 0; i < count; i++) {
+		UniformInfo info;
+		int length = 0;
+		glGetActiveUniform(this->shader_program, (GLuint)i, (GLsizei)name.size(), &length, &info.size, &info.type, name.data());
+		info.name = std::string(name.data(), length);
+		info.location = glGetUniformLocation(this->shader_program, info.name.c_str());
+		// Uniforms inside a block have no location, they are fed through buffers.
+		if (info.location < 0) {
+			continue;
+		}
+		this->uniforms.push_back(info);
+
+		// Arrays are reported as "name[0]", also make them reachable as "name".
+		if (length > 3 && info.name.compare(length - 3, 3, "[0]") == 0) {
+			UniformInfo alias = info;
+			alias.name = info.name.substr(0, length - 3);
+			this->uniforms.push_back(alias);
+		}
+	}
+
+	std::sort(this->uniforms.begin(), this->uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) {
+		return a.name < b.name;
+	});
+}
+
+const UniformInfo* Shader::findUniform(const char* id) {
+	lookup_count++;
+	auto iter = std::lower_bound(this->uniforms.begin(), this->uniforms.end(), id, [](const UniformInfo& u, const char* name) {
+		return std::strcmp(u.name.c_str(), name) < 0;
+	});
+	if (iter == this->uniforms.end() || iter->name.compare(id) != 0) {
+		return nullptr;
+	}
+	return &(*iter);
+}
+
+int Shader::resolve(const char* id, bool (*accepts)(GLenum)) {
+	const UniformInfo* info = this->findUniform(id);
+	if (info == nullptr) {
+		return -1;
+	}
+	if (!accepts(info->type)) {
+		std::cout << "WARNING::SHADER::UNIFORM_TYPE_MISMATCH " << id << std::endl;
+		return -1;
+	}
+	return info->location;
 }
 
 unsigned int Shader::get() {
@@ -71,18 +252,99 @@ void Shader::use() {
 	glUseProgram(this->shader_program);
 }
 
+IntUniform Shader::getIntUniform(const char* id) {
+	IntUniform u;
+	u.location = this->resolve(id, acceptsInt);
+	return u;
+}
+
+FloatUniform Shader::getFloatUniform(const char* id) {
+	FloatUniform u;
+	u.location = this->resolve(id, acceptsFloat);
+	return u;
+}
+
+Vec3Uniform Shader::getVec3Uniform(const char* id) {
+	Vec3Uniform u;
+	u.location = this->resolve(id, acceptsVec3);
+	return u;
+}
+
+Mat4Uniform Shader::getMat4Uniform(const char* id) {
+	Mat4Uniform u;
+	u.location = this->resolve(id, acceptsMat4);
+	return u;
+}
+
+bool Shader::hasUniform(const char* id) {
+	return this->findUniform(id) != nullptr;
+}
+
+bool Shader::bindUniformBlock(const char* block, unsigned int binding) {
+	unsigned int index = glGetUniformBlockIndex(this->shader_program, block);
+	if (index == GL_INVALID_INDEX) {
+		return false;
+	}
+	glUniformBlockBinding(this->shader_program, index, binding);
+	return true;
+}
+
+const std::vector<UniformInfo>& Shader::getUniforms() {
+	return this->uniforms;
+}
+
+void Shader::setInt(IntUniform u, int i) {
+	glUniform1i(u.location, i);
+}
+
+void Shader::setFloat(FloatUniform u, float f) {
+	glUniform1f(u.location, f);
+}
+
+void Shader::setVector(Vec3Uniform u, glm::vec3 v) {
+	glUniform3fv(u.location, 1, value_ptr(v));
+}
+
+void Shader::setMatrix(Mat4Uniform u, glm::mat4 m) {
+	glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(m));
+}
+
+void Shader::setFloats(FloatUniform u, const float* f, int count) {
+	glUniform1fv(u.location, count, f);
+}
+
+void Shader::setMatrices(Mat4Uniform u, const glm::mat4* m, int count) {
+	glUniformMatrix4fv(u.location, count, GL_FALSE, glm::value_ptr(m[0]));
+}
+
 void Shader::setInt(const char* id, int i) {
-	glUniform1i(glGetUniformLocation(this->shader_program, id), i);
+	this->setInt(this->getIntUniform(id), i);
 }
 
 void Shader::setFloat(const char* id, float f) {
-	glUniform1f(glGetUniformLocation(this->shader_program, id), f);
+	this->setFloat(this->getFloatUniform(id), f);
 }
 
 void Shader::setVector(const char* id, glm::vec3 v) {
-	glUniform3fv(glGetUniformLocation(this->shader_program, id), 1, value_ptr(v));
+	this->setVector(this->getVec3Uniform(id), v);
 }
 
 void Shader::setMatrix(const char* id, glm::mat4 m) {
-	glUniformMatrix4fv(glGetUniformLocation(this->shader_program, id), 1, GL_FALSE, glm::value_ptr(m));
-}
\ No newline at end of file
+	this->setMatrix(this->getMat4Uniform(id), m);
+}
+
+unsigned int Shader::getLookupCount() {
+	return lookup_count;
+}
+
+void Shader::resetLookupCount() {
+	lookup_count = 0;
+}
+
+void Shader::setHeader(const std::string& header) {
+	Shader::header = header;
+}
+
+const std::string& Shader::getHeader() {
+	return header;
+}
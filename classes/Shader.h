@@ -5,32 +5,98 @@
 #include <fstream>
 #include <string>
 #include <iostream>
+#include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// One active uniform reflected from the linked program.
+struct UniformInfo {
+	std::string name;
+	int location;
+	GLenum type;
+	int size;
+};
+
+// Pre-resolved uniform location. The template parameter only exists so a
+// handle for a mat4 cannot be handed to setInt by accident.
+template <typename T>
+struct UniformHandle {
+	int location = -1;
+	bool valid() const { return location >= 0; }
+};
+
+typedef UniformHandle<int> IntUniform;
+typedef UniformHandle<float> FloatUniform;
+typedef UniformHandle<glm::vec3> Vec3Uniform;
+typedef UniformHandle<glm::mat4> Mat4Uniform;
 
 class Shader {
 	public:
 		Shader(const char* vertex_path, const char* fragment_path);
+		// With a geometry stage in between, needs a GL 3.2 context.
+		Shader(const char* vertex_path, const char* geometry_path, const char* fragment_path);
+		// Compute program, needs a GL 4.3 context. The header is not applied.
+		Shader(const char* compute_path);
 		unsigned int get();
 		void use();
+
+		IntUniform getIntUniform(const char* id);
+		FloatUniform getFloatUniform(const char* id);
+		Vec3Uniform getVec3Uniform(const char* id);
+		Mat4Uniform getMat4Uniform(const char* id);
+		bool hasUniform(const char* id);
+		bool bindUniformBlock(const char* block, unsigned int binding);
+		const std::vector<UniformInfo>& getUniforms();
+
+		void setInt(IntUniform u, int i);
+		void setFloat(FloatUniform u, float f);
+		void setVector(Vec3Uniform u, glm::vec3 v);
+		void setMatrix(Mat4Uniform u, glm::mat4 m);
+		// Consecutive elements of an array uniform, u resolved from its name.
+		void setFloats(FloatUniform u, const float* f, int count);
+		void setMatrices(Mat4Uniform u, const glm::mat4* m, int count);
+
+		// Name based setters resolve through the uniform table on every call.
+		// Fine for setup code, avoid them in the render loop.
 		void setInt(const char* id, int i);
 		void setFloat(const char* id, float f);
 		void setVector(const char* id, glm::vec3 v);
 		void setMatrix(const char* id, glm::mat4 m);
 
+		// Number of name lookups since the last reset, across all shaders.
+		static unsigned int getLookupCount();
+		static void resetLookupCount();
+
+		// Replaces the #version line of every shader compiled from here on,
+		// e.g. "#version 430 core\n#define MULTI_DRAW 1\n". Empty keeps the
+		// sources as they are.
+		static void setHeader(const std::string& header);
+		static const std::string& getHeader();
+
 	private:
 		const char* vertex_source;
 		const char* fragment_source;
 		unsigned int vertex_shader;
 		unsigned int fragment_shader;
+		unsigned int geometry_shader;
 		unsigned int shader_program;
 
+		// Sorted by name so lookups are a binary search over a flat array.
+		std::vector<UniformInfo> uniforms;
+
+		static unsigned int lookup_count;
+		static std::string header;
+
 		void loadShaders(const char* vertex_path, const char* fragment_path);
+		void loadGeometry(const char* geometry_path);
+		void loadCompute(const char* compute_path);
 		void linkShaders();
+		void reflectUniforms();
+		const UniformInfo* findUniform(const char* id);
+		int resolve(const char* id, bool (*accepts)(GLenum));
 };
 
 #endif
@@ -0,0 +1,314 @@
+#include "ShadowCascades.h"
+
+#include <iostream>
+#include <cmath>
+#include <cfloat>
+
+ShadowCascades::ShadowCascades() {
+	this->cascade_count = MAX_SHADOW_CASCADES;
+	this->max_distance = 0.0f;
+	for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+		this->cascades[i].view_proj = glm::mat4(1.0f);
+		this->cascades[i].shadow_matrix = glm::mat4(1.0f);
+		this->cascades[i].uv_scale = 1.0f;
+		this->cascades[i].split_far = 0.0f;
+		this->cascades[i].texel_size = 0.0f;
+		this->cascades[i].resolution = 1024;
+		this->cascades[i].active = false;
+		this->cascades[i].origin = glm::vec2(0.0f);
+		this->cascades[i].size = 0.0f;
+		this->cascades[i].z_near = 0.0f;
+		this->cascades[i].z_far = 0.0f;
+		this->cascades[i].static_dirty = true;
+	}
+	this->texture = 0;
+	this->fbo = 0;
+	this->layer_size = 0;
+	this->layer_count = 0;
+	this->caching = false;
+	this->static_texture = 0;
+	this->static_fbo = 0;
+	this->light_direction = glm::vec3(0.0f);
+	this->static_revision = 0;
+	this->static_redraws = 0;
+}
+
+void ShadowCascades::setCascadeCount(int count) {
+	this->cascade_count = glm::clamp(count, 1, MAX_SHADOW_CASCADES);
+}
+
+void ShadowCascades::setResolution(int cascade, int resolution) {
+	if (cascade < 0 || cascade >= MAX_SHADOW_CASCADES || resolution < 2) {
+		std::cout << "ERROR::SHADOW_CASCADES::INVALID_RESOLUTION " << cascade << " " << resolution << std::endl;
+		return;
+	}
+	this->cascades[cascade].resolution = resolution;
+	// Refit from scratch, the window was sized for the old texels.
+	this->cascades[cascade].active = false;
+	this->cascades[cascade].static_dirty = true;
+}
+
+void ShadowCascades::setMaxDistance(float distance) {
+	this->max_distance = distance;
+}
+
+void ShadowCascades::setCaching(bool enabled) {
+	this->caching = enabled;
+	for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+		this->cascades[i].static_dirty = true;
+	}
+}
+
+bool ShadowCascades::getCaching() {
+	return this->caching;
+}
+
+void ShadowCascades::allocate(int size, int layers) {
+	this->layer_size = size;
+	this->layer_count = layers;
+	allocateLayers(this->texture, this->fbo, size, layers);
+	if (this->caching) {
+		allocateLayers(this->static_texture, this->static_fbo, size, layers);
+	}
+	for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+		this->cascades[i].static_dirty = true;
+	}
+}
+
+void ShadowCascades::allocateLayers(unsigned int& texture, unsigned int& fbo, int size, int layers) {
+	if (texture == 0) {
+		glGenTextures(1, &texture);
+		glGenFramebuffers(1, &fbo);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	// Linear filtering of a compared texture averages four results.
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "ERROR::SHADOW_CASCADES::FRAMEBUFFER_INCOMPLETE" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowCascades::update(Camera* camera, glm::vec3 light_direction, const AABB& casters, unsigned int static_revision) {
+	this->static_redraws = 0;
+
+	int size = 0;
+	for (int i = 0; i < this->cascade_count; i++) {
+		size = this->cascades[i].resolution > size ? this->cascades[i].resolution : size;
+	}
+	if (this->texture == 0 || size != this->layer_size || this->cascade_count != this->layer_count
+		|| (this->caching && this->static_texture == 0)) {
+		this->allocate(size, this->cascade_count);
+	}
+
+	// A turned light moves every window, changed static casters keep them
+	// where they are but need drawing again.
+	glm::vec3 direction = glm::normalize(light_direction);
+	bool keep = this->caching && direction == this->light_direction;
+	if (!keep || static_revision != this->static_revision) {
+		for (int i = 0; i < this->cascade_count; i++) {
+			this->cascades[i].static_dirty = true;
+		}
+	}
+	this->light_direction = direction;
+	this->static_revision = static_revision;
+
+	float near_distance = camera->getNear();
+	float far_distance = camera->getFar();
+	if (this->max_distance > near_distance && this->max_distance < far_distance) {
+		far_distance = this->max_distance;
+	}
+
+	// Only the rotation, a light view placed at the origin keeps the texel
+	// grid fixed in the world.
+	glm::vec3 up = glm::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 light_view = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+	AABB caster_box;
+	caster_box.min = glm::vec3(FLT_MAX);
+	caster_box.max = glm::vec3(-FLT_MAX);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? casters.max.x : casters.min.x, (i & 2) ? casters.max.y : casters.min.y, (i & 4) ? casters.max.z : casters.min.z);
+		glm::vec3 light_corner = glm::vec3(light_view * glm::vec4(corner, 1.0f));
+		caster_box.min = glm::min(caster_box.min, light_corner);
+		caster_box.max = glm::max(caster_box.max, light_corner);
+	}
+
+	glm::mat4 projection = camera->getProjection();
+	glm::mat4 inverse_view = glm::inverse(camera->getView());
+	float tan_x = 1.0f / projection[0][0];
+	float tan_y = 1.0f / projection[1][1];
+
+	float split_near = near_distance;
+	for (int i = 0; i < this->cascade_count; i++) {
+		float t = (float)(i + 1) / (float)this->cascade_count;
+		float uniform_split = near_distance + (far_distance - near_distance) * t;
+		float log_split = near_distance * std::pow(far_distance / near_distance, t);
+		float split_far = SHADOW_SPLIT_LAMBDA * log_split + (1.0f - SHADOW_SPLIT_LAMBDA) * uniform_split;
+
+		this->fitCascade(this->cascades[i], inverse_view, split_near, split_far, tan_x, tan_y, light_view, caster_box, keep);
+		split_near = split_far;
+	}
+}
+
+// caster_box is in light space, which looks down -z.
+void ShadowCascades::fitCascade(ShadowCascade& cascade, const glm::mat4& inverse_view, float near_distance, float far_distance,
+	float tan_x, float tan_y, const glm::mat4& light_view, const AABB& caster_box, bool keep) {
+	glm::vec3 corners[8];
+	glm::vec3 center(0.0f);
+	for (int i = 0; i < 8; i++) {
+		float d = (i & 4) ? far_distance : near_distance;
+		glm::vec4 view_corner((i & 1) ? d * tan_x : -d * tan_x, (i & 2) ? d * tan_y : -d * tan_y, -d, 1.0f);
+		corners[i] = glm::vec3(inverse_view * view_corner);
+		center += corners[i] / 8.0f;
+	}
+	float radius = 0.0f;
+	for (int i = 0; i < 8; i++) {
+		radius = glm::max(radius, glm::length(corners[i] - center));
+	}
+	radius = std::ceil(radius / SHADOW_RADIUS_STEP) * SHADOW_RADIUS_STEP;
+
+	cascade.split_far = far_distance;
+
+	glm::vec3 light_center = glm::vec3(light_view * glm::vec4(center, 1.0f));
+	glm::vec2 covered_min = glm::max(glm::vec2(light_center) - radius, glm::vec2(caster_box.min));
+	glm::vec2 covered_max = glm::min(glm::vec2(light_center) + radius, glm::vec2(caster_box.max));
+	// Casters past the far side of the sphere shadow nothing in the slice.
+	if (covered_min.x >= covered_max.x || covered_min.y >= covered_max.y || caster_box.max.z < light_center.z - radius) {
+		cascade.active = false;
+		cascade.static_dirty = true;
+		return;
+	}
+	float z_near = -caster_box.max.z;
+	float z_far = -glm::max(caster_box.min.z, light_center.z - radius);
+
+	// One spare texel, so the snapped window still holds the whole sphere.
+	float margin = this->caching ? 1.0f + 2.0f * SHADOW_CACHE_MARGIN : 1.0f;
+	int resolution = cascade.resolution;
+	float size = 2.0f * radius * margin * (float)resolution / (float)(resolution - 1);
+	float extent = glm::max(covered_max.x - covered_min.x, covered_max.y - covered_min.y) * margin;
+	while (size * 0.5f >= extent + 2.0f * size * 0.5f / (float)resolution) {
+		size *= 0.5f;
+	}
+
+	if (keep && cascade.active && size == cascade.size
+		&& covered_min.x >= cascade.origin.x && covered_min.y >= cascade.origin.y
+		&& covered_max.x <= cascade.origin.x + size && covered_max.y <= cascade.origin.y + size
+		&& z_near >= cascade.z_near && z_far <= cascade.z_far) {
+		return;
+	}
+
+	float texel = size / (float)resolution;
+	glm::vec2 origin = glm::floor(covered_min / texel) * texel;
+	// Centered on the casters as far as whole texels allow.
+	origin -= glm::floor((glm::vec2(size) - (covered_max - origin)) * 0.5f / texel) * texel;
+	if (this->caching) {
+		float depth_margin = (z_far - z_near) * SHADOW_CACHE_MARGIN;
+		z_near -= depth_margin;
+		z_far += depth_margin;
+	}
+	glm::mat4 projection = glm::ortho(origin.x, origin.x + size, origin.y, origin.y + size, z_near, z_far);
+
+	glm::mat4 bias(0.5f);
+	bias[3] = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
+
+	cascade.view_proj = projection * light_view;
+	cascade.shadow_matrix = bias * cascade.view_proj;
+	cascade.uv_scale = (float)resolution / (float)this->layer_size;
+	cascade.texel_size = texel;
+	cascade.origin = origin;
+	cascade.size = size;
+	cascade.z_near = z_near;
+	cascade.z_far = z_far;
+	cascade.active = true;
+	cascade.static_dirty = true;
+}
+
+// Clears the whole layer, whatever lies outside a smaller cascade's corner
+// reads as lit.
+void ShadowCascades::bindLayer(unsigned int fbo, unsigned int texture, int cascade) {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+	glViewport(0, 0, this->layer_size, this->layer_size);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void ShadowCascades::beginStatic(int cascade) {
+	this->bindLayer(this->static_fbo, this->static_texture, cascade);
+	int resolution = this->cascades[cascade].resolution;
+	glViewport(0, 0, resolution, resolution);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+	this->cascades[cascade].static_dirty = false;
+	this->static_redraws++;
+}
+
+// The static layer was cleared whole, so copying all of it replaces the
+// clear as well.
+void ShadowCascades::begin(int cascade) {
+	int resolution = this->cascades[cascade].resolution;
+	if (this->caching && this->cascades[cascade].active) {
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->texture, 0, cascade);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->static_fbo);
+		glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->static_texture, 0, cascade);
+		glBlitFramebuffer(0, 0, this->layer_size, this->layer_size, 0, 0, this->layer_size, this->layer_size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	} else {
+		this->bindLayer(this->fbo, this->texture, cascade);
+	}
+	glViewport(0, 0, resolution, resolution);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(SHADOW_SLOPE_BIAS, SHADOW_CONSTANT_BIAS);
+}
+
+void ShadowCascades::end() {
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+unsigned int ShadowCascades::getStaticRedraws() {
+	return this->static_redraws;
+}
+
+int ShadowCascades::getCascadeCount() {
+	return this->cascade_count;
+}
+
+const ShadowCascade& ShadowCascades::getCascade(int cascade) {
+	return this->cascades[cascade];
+}
+
+unsigned int ShadowCascades::getTexture() {
+	return this->texture;
+}
+
+void ShadowCascades::clear() {
+	if (this->texture != 0) {
+		glDeleteTextures(1, &this->texture);
+		glDeleteFramebuffers(1, &this->fbo);
+		this->texture = 0;
+		this->fbo = 0;
+	}
+	if (this->static_texture != 0) {
+		glDeleteTextures(1, &this->static_texture);
+		glDeleteFramebuffers(1, &this->static_fbo);
+		this->static_texture = 0;
+		this->static_fbo = 0;
+	}
+	this->layer_size = 0;
+	this->layer_count = 0;
+}
@@ -0,0 +1,138 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Camera.h"
+#include "Frustum.h"
+
+// Matches the array sizes in fragment_standard.glsl.
+#define MAX_SHADOW_CASCADES 4
+// Blend between uniform (0) and logarithmic (1) split distances.
+#define SHADOW_SPLIT_LAMBDA 0.75f
+// Slice bounding spheres grow in these steps so rounding noise in the
+// camera's corners never changes the texel size.
+#define SHADOW_RADIUS_STEP (1.0f / 16.0f)
+// Unit the shadow map is bound to, above the ones meshes use for their
+// material textures and below DEPTH_PYRAMID_TEXTURE_UNIT.
+#define SHADOW_MAP_TEXTURE_UNIT 14
+// glPolygonOffset while casters are drawn.
+#define SHADOW_SLOPE_BIAS 2.0f
+#define SHADOW_CONSTANT_BIAS 4.0f
+// Room a cached cascade leaves around what it has to cover, in parts of
+// that, so the camera can move a while before the window follows and the
+// static casters have to be drawn again.
+#define SHADOW_CACHE_MARGIN 0.25f
+
+struct ShadowCascade {
+	// Renders the casters of the cascade.
+	glm::mat4 view_proj;
+	// World space to [0, 1] texture coordinates of the cascade and depth.
+	glm::mat4 shadow_matrix;
+	// Part of the layer the cascade renders to, coordinates scale by it.
+	float uv_scale;
+	// View space distance along the camera where the cascade ends.
+	float split_far;
+	// World units covered by one texel.
+	float texel_size;
+	int resolution;
+	// False when no caster falls into the cascade, it is left cleared.
+	bool active;
+	// Light space window and depth range the cascade was fitted to.
+	glm::vec2 origin;
+	float size;
+	float z_near;
+	float z_far;
+	// With caching, the static layer has to be drawn through beginStatic
+	// before begin.
+	bool static_dirty;
+};
+
+// Cascaded shadow map of a directional light, one layer of a depth texture
+// array per slice of the camera frustum.
+//
+// A cascade covers the bounding sphere of its slice, so its size does not
+// change as the camera turns, and its origin is snapped to whole texels in
+// light space, so moving the camera does not make the edges of shadows
+// crawl. The box is then fitted to the casters: the depth range spans only
+// what can throw a shadow into it, and when the casters cover a fraction of
+// the sphere the box shrinks by powers of two around them, which keeps the
+// texel size fixed until the coverage crosses one.
+//
+// Each cascade has a resolution of its own. The layers of an array share a
+// size, so smaller cascades render into the lower left corner of their layer
+// and their coordinates are scaled down by uv_scale.
+//
+// With caching on, the depth of static casters is kept in a second array
+// and only drawn again when its cascade's window moves, the static casters
+// change or the light turns. Windows get SHADOW_CACHE_MARGIN of room and
+// stay put while what they cover fits, so a moving camera refits them
+// every now and then instead of every frame. Each frame begin copies the
+// static layer in and only dynamic casters are drawn on top.
+class ShadowCascades {
+
+	public:
+		ShadowCascades();
+
+		void setCascadeCount(int count);
+		// Takes effect at the next update, which reallocates if the
+		// largest resolution changed.
+		void setResolution(int cascade, int resolution);
+		// Shadows end there, 0 uses the camera's far plane.
+		void setMaxDistance(float distance);
+
+		void setCaching(bool enabled);
+		bool getCaching();
+
+		// Fits the cascades to the camera's frustum and the world box of
+		// every caster. A new static_revision, see Scene::getStaticRevision,
+		// drops the cached static depth.
+		void update(Camera* camera, glm::vec3 light_direction, const AABB& casters, unsigned int static_revision = 0);
+		// Binds the cascade's static layer and clears it, for the static
+		// casters of a cascade with static_dirty set.
+		void beginStatic(int cascade);
+		// Binds the cascade's layer as the depth target with its viewport,
+		// cleared or, with caching, holding the static depth. Depth bias
+		// stays on until end().
+		void begin(int cascade);
+		void end();
+		// Static layers drawn since the last update.
+		unsigned int getStaticRedraws();
+
+		int getCascadeCount();
+		const ShadowCascade& getCascade(int cascade);
+		// GL_TEXTURE_2D_ARRAY with depth compare, sample it through a
+		// sampler2DArrayShadow.
+		unsigned int getTexture();
+		void clear();
+
+	private:
+		ShadowCascade cascades[MAX_SHADOW_CASCADES];
+		int cascade_count;
+		float max_distance;
+
+		unsigned int texture;
+		unsigned int fbo;
+		int layer_size;
+		int layer_count;
+
+		bool caching;
+		unsigned int static_texture;
+		unsigned int static_fbo;
+		glm::vec3 light_direction;
+		unsigned int static_revision;
+		unsigned int static_redraws;
+
+		void allocate(int size, int layers);
+		static void allocateLayers(unsigned int& texture, unsigned int& fbo, int size, int layers);
+		// keep lets the cascade stay where it is if that still covers the slice.
+		void fitCascade(ShadowCascade& cascade, const glm::mat4& inverse_view, float near_distance, float far_distance,
+			float tan_x, float tan_y, const glm::mat4& light_view, const AABB& caster_box, bool keep);
+		void bindLayer(unsigned int fbo, unsigned int texture, int cascade);
+};
+
+#endif
@@ -0,0 +1,488 @@
+#include "TextureCache.h"
+#include "stb_image.h"
+#include "AssetArchive.h"
+
+#include <filesystem>
+#include <iostream>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_USE_SSE2 1
+#endif
+
+static GLenum formatFor(int num_components) {
+	if (num_components == 1) {
+		return GL_RED;
+	} else if (num_components == 2) {
+		return GL_RG;
+	} else if (num_components == 4) {
+		return GL_RGBA;
+	}
+	return GL_RGB;
+}
+
+// Bytes per texel as uploaded, a full mip chain adds a third.
+static size_t textureBytes(int width, int height, int num_components, bool mipmapped) {
+	size_t bytes = (size_t)width * (size_t)height * (size_t)num_components;
+	return mipmapped ? bytes + bytes / 3 : bytes;
+}
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Replaces RGB pixels with opaque RGBA ones, allocated the way stbi_image_free
+// expects.
+static void expandToRgba(TextureData& image) {
+	size_t texels = (size_t)image.width * image.height;
+	unsigned char* rgba = (unsigned char*)malloc(texels * 4);
+	if (!rgba) {
+		return;
+	}
+	for (size_t i = 0; i < texels; i++) {
+		rgba[i * 4 + 0] = image.pixels[i * 3 + 0];
+		rgba[i * 4 + 1] = image.pixels[i * 3 + 1];
+		rgba[i * 4 + 2] = image.pixels[i * 3 + 2];
+		rgba[i * 4 + 3] = 255;
+	}
+	stbi_image_free(image.pixels);
+	image.pixels = rgba;
+	image.num_components = 4;
+}
+
+bool decodeTexture(const std::string& filename, TextureData& image, bool flip_y, bool mipmaps) {
+	auto start = std::chrono::high_resolution_clock::now();
+
+	stbi_set_flip_vertically_on_load_thread(flip_y ? 1 : 0);
+	image.pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.num_components, 0);
+	if (!image.pixels) {
+		image.decode_ms = elapsedMs(start);
+		std::cout << "Texture load failed." << std::endl;
+		return false;
+	}
+	// Mipmapped RGB goes up as RGBA, which the SSE2 downsample handles.
+	if (mipmaps && image.num_components == 3) {
+		expandToRgba(image);
+	}
+	image.decode_ms = elapsedMs(start);
+
+	if (mipmaps) {
+		start = std::chrono::high_resolution_clock::now();
+		buildMipChain(image);
+		image.mip_ms = elapsedMs(start);
+	}
+	return true;
+}
+
+// Taps and weights of output texel i along one axis. Even sizes average two
+// texels. Odd sizes 2n + 1 going down to n use three, weighted so each output
+// texel's box spans (2n + 1) / n source texels: the whole row is covered and
+// nothing shifts or drops off the edge.
+static int axisTaps(int i, int src_size, int dst_size, int* taps, float* weights) {
+	if (src_size == 1) {
+		taps[0] = 0;
+		weights[0] = 1.0f;
+		return 1;
+	}
+	if (src_size % 2 == 0) {
+		taps[0] = 2 * i;
+		taps[1] = 2 * i + 1;
+		weights[0] = 0.5f;
+		weights[1] = 0.5f;
+		return 2;
+	}
+	float norm = 1.0f / (float)src_size;
+	taps[0] = 2 * i;
+	taps[1] = 2 * i + 1;
+	taps[2] = 2 * i + 2;
+	weights[0] = (float)(dst_size - i) * norm;
+	weights[1] = (float)dst_size * norm;
+	weights[2] = (float)(i + 1) * norm;
+	return 3;
+}
+
+// One level down with the polyphase box filter of axisTaps, for sizes with
+// an odd side.
+static void downsampleOdd(const unsigned char* src, int src_width, int src_height, unsigned char* dst, int dst_width, int dst_height, int c) {
+	int x_taps[3];
+	int y_taps[3];
+	float x_weights[3];
+	float y_weights[3];
+	for (int y = 0; y < dst_height; y++) {
+		int ny = axisTaps(y, src_height, dst_height, y_taps, y_weights);
+		for (int x = 0; x < dst_width; x++) {
+			int nx = axisTaps(x, src_width, dst_width, x_taps, x_weights);
+			for (int k = 0; k < c; k++) {
+				float sum = 0.0f;
+				for (int j = 0; j < ny; j++) {
+					const unsigned char* row = src + (size_t)y_taps[j] * src_width * c;
+					for (int i = 0; i < nx; i++) {
+						sum += y_weights[j] * x_weights[i] * row[x_taps[i] * c + k];
+					}
+				}
+				dst[((size_t)y * dst_width + x) * c + k] = (unsigned char)(sum + 0.5f);
+			}
+		}
+	}
+}
+
+// One level down, averaging 2x2 blocks. Sides of one texel repeat it.
+static void downsample(const unsigned char* src, int src_width, int src_height, unsigned char* dst, int dst_width, int dst_height, int c) {
+	if ((src_width > 1 && src_width % 2 == 1) || (src_height > 1 && src_height % 2 == 1)) {
+		downsampleOdd(src, src_width, src_height, dst, dst_width, dst_height, c);
+		return;
+	}
+	for (int y = 0; y < dst_height; y++) {
+		const unsigned char* row_a = src + (size_t)(2 * y < src_height ? 2 * y : src_height - 1) * src_width * c;
+		const unsigned char* row_b = src + (size_t)(2 * y + 1 < src_height ? 2 * y + 1 : src_height - 1) * src_width * c;
+		unsigned char* out = dst + (size_t)y * dst_width * c;
+		int x = 0;
+
+#ifdef TEXTURE_USE_SSE2
+		// Four source texels from each row make two output texels.
+		if (c == 4) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi16(2);
+			for (; x + 2 <= dst_width && 2 * x + 4 <= src_width; x += 2) {
+				__m128i a = _mm_loadu_si128((const __m128i*)(row_a + 2 * x * 4));
+				__m128i b = _mm_loadu_si128((const __m128i*)(row_b + 2 * x * 4));
+				__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+				__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+				lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+				hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+				__m128i sum = _mm_unpacklo_epi64(lo, hi);
+				sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+				_mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(sum, zero));
+			}
+		}
+#endif
+
+		for (; x < dst_width; x++) {
+			int x0 = 2 * x < src_width ? 2 * x : src_width - 1;
+			int x1 = 2 * x + 1 < src_width ? 2 * x + 1 : src_width - 1;
+			for (int k = 0; k < c; k++) {
+				int sum = row_a[x0 * c + k] + row_a[x1 * c + k] + row_b[x0 * c + k] + row_b[x1 * c + k];
+				out[x * c + k] = (unsigned char)((sum + 2) >> 2);
+			}
+		}
+	}
+}
+
+void buildMipChain(TextureData& image) {
+	image.mip_data.clear();
+	image.mip_offsets.clear();
+	if (!image.pixels) {
+		return;
+	}
+
+	int c = image.num_components;
+	size_t total = 0;
+	for (int w = image.width, h = image.height; w > 1 || h > 1;) {
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+		image.mip_offsets.push_back(total);
+		total += (size_t)w * h * c;
+	}
+	image.mip_data.resize(total);
+
+	const unsigned char* src = image.pixels;
+	int src_width = image.width;
+	int src_height = image.height;
+	for (unsigned int level = 0; level < image.mip_offsets.size(); level++) {
+		int dst_width = src_width > 1 ? src_width / 2 : 1;
+		int dst_height = src_height > 1 ? src_height / 2 : 1;
+		unsigned char* dst = image.mip_data.data() + image.mip_offsets[level];
+		downsample(src, src_width, src_height, dst, dst_width, dst_height, c);
+		src = dst;
+		src_width = dst_width;
+		src_height = dst_height;
+	}
+}
+
+void freeTextureData(TextureData& image) {
+	if (!image.mapped) {
+		stbi_image_free(image.pixels);
+	}
+	image.pixels = nullptr;
+	image.mapped = false;
+	image.mapped_mips = nullptr;
+	std::vector<unsigned char>().swap(image.mip_data);
+}
+
+unsigned int uploadTexture(TextureData& image) {
+	auto start = std::chrono::high_resolution_clock::now();
+	glGenTextures(1, &image.id);
+
+	if (image.pixels) {
+		GLenum format = formatFor(image.num_components);
+
+		// Small levels of 1 and 2 component images have unaligned rows.
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D, image.id);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+		if (image.mip_offsets.empty()) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+		} else {
+			const unsigned char* mips = image.mapped ? image.mapped_mips : image.mip_data.data();
+			int width = image.width;
+			int height = image.height;
+			for (unsigned int level = 0; level < image.mip_offsets.size(); level++) {
+				width = width > 1 ? width / 2 : 1;
+				height = height > 1 ? height / 2 : 1;
+				glTexImage2D(GL_TEXTURE_2D, level + 1, format, width, height, 0, format, GL_UNSIGNED_BYTE, mips + image.mip_offsets[level]);
+			}
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.mip_offsets.size());
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		freeTextureData(image);
+	}
+
+	image.upload_ms = elapsedMs(start);
+	return image.id;
+}
+
+TextureCache::TextureCache() {
+	this->memory_usage = 0;
+	this->pool = nullptr;
+}
+
+TextureCache& TextureCache::get() {
+	static TextureCache cache;
+	return cache;
+}
+
+std::string TextureCache::canonicalPath(const std::string& path) {
+	std::error_code error;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+	if (error) {
+		return std::filesystem::path(path).lexically_normal().generic_string();
+	}
+	return canonical.generic_string();
+}
+
+std::string TextureCache::makeKey(const std::string& canonical_path, unsigned int flags) {
+	return canonical_path + '|' + std::to_string(flags);
+}
+
+void TextureCache::decodeAll(const std::vector<std::string>& filenames, std::vector<TextureData*>& images, bool flip_y, bool mipmaps) {
+	if (images.size() == 1) {
+		decodeTexture(filenames[0], *images[0], flip_y, mipmaps);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->pool_mutex);
+		if (this->pool == nullptr) {
+			this->pool = new ThreadPool();
+		}
+	}
+
+	// Only this batch is waited on, other users of the pool keep running.
+	struct Batch {
+		std::mutex mutex;
+		std::condition_variable done;
+		size_t remaining;
+	};
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+	batch->remaining = images.size();
+
+	for (unsigned int i = 0; i < images.size(); i++) {
+		std::string filename = filenames[i];
+		TextureData* image = images[i];
+		this->pool->submit([batch, filename, image, flip_y, mipmaps]() {
+			decodeTexture(filename, *image, flip_y, mipmaps);
+			std::lock_guard<std::mutex> lock(batch->mutex);
+			if (--batch->remaining == 0) {
+				batch->done.notify_all();
+			}
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->done.wait(lock, [&batch] { return batch->remaining == 0; });
+}
+
+unsigned int TextureCache::acquire(const std::string& path, unsigned int flags) {
+	std::string key = makeKey(canonicalPath(path), flags);
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto iter = this->entries.find(key);
+		if (iter != this->entries.end()) {
+			iter->second.info.refs++;
+			return iter->second.info.id;
+		}
+	}
+
+	TextureData image;
+	image.path = path;
+	if (!AssetArchive::get().loadTexture(path, flags, image)) {
+		decodeTexture(path, image, (flags & TEXTURE_FLIP_Y) != 0);
+	}
+	return this->insert(path, flags, image);
+}
+
+unsigned int TextureCache::acquireCubemap(const std::vector<std::string>& faces) {
+	std::string joined;
+	for (unsigned int i = 0; i < faces.size(); i++) {
+		joined += canonicalPath(faces[i]) + ';';
+	}
+	std::string key = makeKey(joined, TEXTURE_CUBEMAP);
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto iter = this->entries.find(key);
+		if (iter != this->entries.end()) {
+			iter->second.info.refs++;
+			return iter->second.info.id;
+		}
+	}
+
+	std::vector<TextureData> images(faces.size());
+	std::vector<std::string> filenames;
+	std::vector<TextureData*> targets;
+	for (unsigned int i = 0; i < faces.size(); i++) {
+		images[i].path = faces[i];
+		if (!AssetArchive::get().loadTexture(faces[i], 0, images[i])) {
+			filenames.push_back(faces[i]);
+			targets.push_back(&images[i]);
+		}
+	}
+	if (!targets.empty()) {
+		this->decodeAll(filenames, targets, false, false);
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	unsigned int texture_id;
+	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture_id);
+
+	TextureData cubemap;
+	cubemap.path = faces.empty() ? "" : faces[0];
+	cubemap.id = texture_id;
+	size_t gpu_bytes = 0;
+	bool failed = false;
+	for (unsigned int i = 0; i < images.size(); i++) {
+		TextureData& face = images[i];
+		if (face.pixels && !failed) {
+			GLenum format = formatFor(face.num_components);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, face.width, face.height, 0, format, GL_UNSIGNED_BYTE, face.pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			gpu_bytes += textureBytes(face.width, face.height, face.num_components, false);
+			cubemap.width = face.width;
+			cubemap.height = face.height;
+			cubemap.decode_ms += face.decode_ms;
+		} else if (!failed) {
+			std::cout << "Failed to load skybox texture!" << std::endl;
+			failed = true;
+		}
+		freeTextureData(face);
+	}
+	if (failed) {
+		glDeleteTextures(1, &texture_id);
+		return 0;
+	}
+
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	cubemap.upload_ms = elapsedMs(start);
+
+	std::cout << "Texture " << cubemap.path << " (cubemap): decode " << cubemap.decode_ms << " ms over " << images.size() << " faces, upload " << cubemap.upload_ms << " ms" << std::endl;
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->addEntry(key, cubemap.path, cubemap, gpu_bytes);
+}
+
+unsigned int TextureCache::insert(const std::string& path, unsigned int flags, TextureData& image) {
+	std::string key = makeKey(canonicalPath(path), flags);
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto iter = this->entries.find(key);
+		if (iter != this->entries.end()) {
+			freeTextureData(image);
+			image.id = iter->second.info.id;
+			iter->second.info.refs++;
+			return image.id;
+		}
+	}
+
+	size_t gpu_bytes = image.pixels ? textureBytes(image.width, image.height, image.num_components, true) : 0;
+	uploadTexture(image);
+
+	if (image.width > 0) {
+		std::cout << "Texture " << path << ": decode " << image.decode_ms << " ms, mips " << image.mip_ms << " ms, upload " << image.upload_ms << " ms" << std::endl;
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->addEntry(key, path, image, gpu_bytes);
+}
+
+bool TextureCache::contains(const std::string& path, unsigned int flags) {
+	std::string key = makeKey(canonicalPath(path), flags);
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->entries.find(key) != this->entries.end();
+}
+
+// Expects the mutex to be held.
+unsigned int TextureCache::addEntry(const std::string& key, const std::string& path, const TextureData& image, size_t gpu_bytes) {
+	Entry entry;
+	entry.key = key;
+	entry.info.path = path;
+	entry.info.id = image.id;
+	entry.info.width = image.width;
+	entry.info.height = image.height;
+	entry.info.refs = 1;
+	entry.info.gpu_bytes = gpu_bytes;
+	entry.info.decode_ms = image.decode_ms + image.mip_ms;
+	entry.info.upload_ms = image.upload_ms;
+	this->entries.insert(std::make_pair(key, entry));
+	this->keys_by_id.insert(std::make_pair(image.id, key));
+	this->memory_usage += gpu_bytes;
+	return image.id;
+}
+
+void TextureCache::release(unsigned int id) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto key_iter = this->keys_by_id.find(id);
+	if (key_iter == this->keys_by_id.end()) {
+		return;
+	}
+	auto iter = this->entries.find(key_iter->second);
+	if (--iter->second.info.refs > 0) {
+		return;
+	}
+
+	glDeleteTextures(1, &id);
+	this->memory_usage -= iter->second.info.gpu_bytes;
+	this->entries.erase(iter);
+	this->keys_by_id.erase(key_iter);
+}
+
+unsigned int TextureCache::getTextureCount() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return (unsigned int)this->entries.size();
+}
+
+size_t TextureCache::getMemoryUsage() {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->memory_usage;
+}
+
+void TextureCache::getTextures(std::vector<TextureInfo>& out) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	for (auto iter = this->entries.begin(); iter != this->entries.end(); ++iter) {
+		out.push_back(iter->second.info);
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstddef>
+
+#include "ThreadPool.h"
+
+// Load parameters, part of the cache key.
+#define TEXTURE_FLIP_Y 1u
+#define TEXTURE_CUBEMAP 2u
+
+// Decoded image waiting for its GL upload.
+struct TextureData {
+	std::string path;
+	unsigned char* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int num_components = 0;
+	unsigned int id = 0;
+	// Levels 1 and down, built on the CPU. Level 0 stays in pixels.
+	std::vector<unsigned char> mip_data;
+	std::vector<size_t> mip_offsets;
+	double decode_ms = 0.0;
+	double mip_ms = 0.0;
+	double upload_ms = 0.0;
+	// Set when pixels and the mip levels point into a mounted asset archive,
+	// mapped_mips then stands in for mip_data and nothing is freed.
+	bool mapped = false;
+	const unsigned char* mapped_mips = nullptr;
+};
+
+// Thread safe, stb's flip flag is set per thread. With mipmaps the full chain
+// is built here, RGB images are widened to RGBA for it so every level keeps
+// 4-byte rows.
+bool decodeTexture(const std::string& filename, TextureData& image, bool flip_y = true, bool mipmaps = true);
+// Drops the CPU side of an image that is not going to be uploaded.
+void freeTextureData(TextureData& image);
+// 2x2 box filter down to 1x1, SSE2 for 4 component images.
+void buildMipChain(TextureData& image);
+// Creates the 2D texture with every level in one go and frees the CPU copies.
+// A failed decode still gets a texture name, as TextureFromFile always did.
+unsigned int uploadTexture(TextureData& image);
+
+struct TextureInfo {
+	std::string path;
+	unsigned int id;
+	int width;
+	int height;
+	unsigned int refs;
+	// Estimate from the upload size, mip chain and cube faces included.
+	size_t gpu_bytes;
+	double decode_ms;
+	double upload_ms;
+};
+
+// Process wide, reference counted textures keyed by canonical path and load
+// flags. Every acquire (or insert) hands out one reference that has to be
+// given back with release; the GL texture goes when the last one does.
+// GL work happens on the render thread only, contains() may be called from
+// loader threads.
+class TextureCache {
+
+	public:
+		static TextureCache& get();
+
+		unsigned int acquire(const std::string& path, unsigned int flags = TEXTURE_FLIP_Y);
+		unsigned int acquireCubemap(const std::vector<std::string>& faces);
+		// Takes an image decoded elsewhere, if another load got there first
+		// the pixels are dropped and the existing texture is returned.
+		unsigned int insert(const std::string& path, unsigned int flags, TextureData& image);
+		bool contains(const std::string& path, unsigned int flags = TEXTURE_FLIP_Y);
+		// Texture import stage: decodes (and mips) every image on the pool and
+		// returns once all are done. Not for use from inside the pool.
+		void decodeAll(const std::vector<std::string>& filenames, std::vector<TextureData*>& images, bool flip_y, bool mipmaps);
+		void release(unsigned int id);
+
+		unsigned int getTextureCount();
+		size_t getMemoryUsage();
+		void getTextures(std::vector<TextureInfo>& out);
+
+		static std::string canonicalPath(const std::string& path);
+
+	private:
+		struct Entry {
+			TextureInfo info;
+			std::string key;
+		};
+
+		std::mutex mutex;
+		std::unordered_map<std::string, Entry> entries;
+		std::unordered_map<unsigned int, std::string> keys_by_id;
+		size_t memory_usage;
+		ThreadPool* pool;
+		std::mutex pool_mutex;
+
+		TextureCache();
+		TextureCache(const TextureCache&);
+		TextureCache& operator=(const TextureCache&);
+
+		static std::string makeKey(const std::string& canonical_path, unsigned int flags);
+		unsigned int addEntry(const std::string& key, const std::string& path, const TextureData& image, size_t gpu_bytes);
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int num_threads) {
+	if (num_threads == 0) {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		num_threads = hardware > 1 ? hardware - 1 : 1;
+	}
+	this->running = 0;
+	this->stopping = false;
+	for (unsigned int i = 0; i < num_threads; i++) {
+		this->workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->job_available.notify_all();
+	for (unsigned int i = 0; i < this->workers.size(); i++) {
+		this->workers[i].join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->jobs.push_back(job);
+	}
+	this->job_available.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idle.wait(lock, [this] { return this->jobs.empty() && this->running == 0; });
+}
+
+unsigned int ThreadPool::getThreadCount() {
+	return (unsigned int)this->workers.size();
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->job_available.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+			if (this->stopping && this->jobs.empty()) {
+				return;
+			}
+			job = this->jobs.front();
+			this->jobs.pop_front();
+			this->running++;
+		}
+
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->running--;
+			if (this->jobs.empty() && this->running == 0) {
+				this->idle.notify_all();
+			}
+		}
+	}
+}
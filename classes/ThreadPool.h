@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads pulling jobs from one FIFO queue.
+class ThreadPool {
+
+	public:
+		// 0 uses one thread per hardware thread, less the render thread.
+		ThreadPool(unsigned int num_threads = 0);
+		~ThreadPool();
+
+		void submit(std::function<void()> job);
+		// Blocks until the queue is empty and no job is running.
+		void wait();
+		unsigned int getThreadCount();
+
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> jobs;
+		std::mutex mutex;
+		std::condition_variable job_available;
+		std::condition_variable idle;
+		unsigned int running;
+		bool stopping;
+
+		void workerLoop();
+
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+};
+
+#endif
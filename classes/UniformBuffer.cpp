@@ -0,0 +1,31 @@
+#include "UniformBuffer.h"
+
+UniformBuffer::UniformBuffer(unsigned int binding, size_t size) {
+	this->binding = binding;
+	this->size = size;
+
+	glGenBuffers(1, &this->UBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, this->UBO);
+}
+
+UniformBuffer::~UniformBuffer() {
+	glDeleteBuffers(1, &this->UBO);
+}
+
+void UniformBuffer::update(const void* data, size_t size, size_t offset) {
+	glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+unsigned int UniformBuffer::get() {
+	return this->UBO;
+}
+
+unsigned int UniformBuffer::getBinding() {
+	return this->binding;
+}
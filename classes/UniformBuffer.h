@@ -0,0 +1,28 @@
+#ifndef UNIFORMBUFFER_H
+#define UNIFORMBUFFER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <cstddef>
+
+// Fixed binding points shared by every program that declares the block.
+#define CAMERA_UBO_BINDING 0
+#define LIGHTS_UBO_BINDING 1
+
+class UniformBuffer {
+
+	public:
+		UniformBuffer(unsigned int binding, size_t size);
+		~UniformBuffer();
+
+		void update(const void* data, size_t size, size_t offset = 0);
+		unsigned int get();
+		unsigned int getBinding();
+
+	private:
+		unsigned int UBO;
+		unsigned int binding;
+		size_t size;
+};
+
+#endif
@@ -12,6 +12,8 @@
 #include <iostream>
 #include <sstream>
 #include "classes/Scene.h"
+#include "classes/ShadowCascades.h"
+#include "classes/PointShadows.h"
 
 void framebuffer_size_callback(GLFWwindow* w, int width, int height);
 void processInput(GLFWwindow* w);
@@ -28,9 +30,45 @@ void renderScene(Shader* shader);
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+// Cooked by tools/AssetCooker.cpp, anything missing from it or edited since is read loose.
+const char* ASSET_ARCHIVE_PATH = "build/assets.pak";
+// Imported meshes are cached here, out of the source tree.
+const char* MESH_CACHE_DIRECTORY = "build/meshcache";
+// GL upload time per frame for models loading in the background
+const double ASSET_UPLOAD_BUDGET_MS = 2.0;
+// GPU vertex layout, tools/MeshBenchmark.cpp compares the two.
+const VertexFormat MESH_VERTEX_FORMAT = VERTEX_FORMAT_PACKED;
+// Submit with glMultiDrawElementsIndirect when the context is 4.3 or newer.
+const bool USE_MULTI_DRAW = true;
+const char* MULTI_DRAW_SHADER_HEADER = "#version 430 core\n#define MULTI_DRAW 1\n";
+// Cull static models in a compute pass, only with multi-draw.
+const bool USE_GPU_CULLING = true;
+// Also test them against a depth pyramid of the main view.
+const bool USE_OCCLUSION_CULLING = true;
+// Directional shadow cascades, nearest first, and where the last one ends.
+const int SHADOW_CASCADE_COUNT = 4;
+const int SHADOW_CASCADE_RESOLUTIONS[SHADOW_CASCADE_COUNT] = { 2048, 2048, 1024, 1024 };
+const float SHADOW_DISTANCE = 40.0f;
+// Keep the depth of static casters between frames, only moving ones are drawn every frame.
+// C toggles it, P prints the shadow pass time since the last print.
+const bool USE_SHADOW_CACHE = true;
+// Timer queries of the shadow pass in flight, each is read once the GPU has its result.
+const int SHADOW_QUERY_SLOTS = 4;
+// A small cube circling the gun, the dynamic caster drawn over the cached depth.
+const float ORBITER_RADIUS = 1.5f;
+const float ORBITER_SPEED = 0.8f;
+// Cube shadow maps of the point lights and the size of the largest tier,
+// only with multi-draw as the standard shader needs a 4.x build to sample them.
+const bool USE_POINT_SHADOWS = true;
+const int POINT_SHADOW_RESOLUTION = 512;
+// Small lights scattered over the floor on top of the four big ones, shaded
+// through the light clusters.
+const int SCATTERED_POINT_LIGHTS = 1020;
 
 GLFWwindow* window;
 Camera* camera;
+bool print_stats = false;
+bool toggle_shadow_cache = false;
 
 Scene scene;
 
@@ -38,15 +76,24 @@ unsigned int planeVAO;
 
 int initGLFW() {
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     #ifdef __APPLE__
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     #endif
 
-    window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    // 4.3 for multi-draw indirect, 3.3 is all the fallback path needs. The
+    // glad loader must be generated for 4.3 too, see isMultiDrawSupported.
+    if (USE_MULTI_DRAW) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    }
+    if (window == NULL) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -62,7 +109,7 @@ int initGLFW() {
 
     glEnable(GL_DEPTH_TEST);
 
-    scene = Scene(window);
+    scene.init(window);
     scene.addCamera("main");
     camera = scene.getCamera("main");
 
@@ -77,6 +124,20 @@ int main() {
     // glfw: initialize and configure
     initGLFW();
 
+    MeshCache::setDirectory(MESH_CACHE_DIRECTORY);
+    if (AssetArchive::get().mount(ASSET_ARCHIVE_PATH)) {
+        std::cout << "Mounted " << ASSET_ARCHIVE_PATH << " (" << AssetArchive::get().getEntryCount() << " assets)" << std::endl;
+    }
+    Mesh::setDefaultVertexFormat(MESH_VERTEX_FORMAT);
+    if (USE_MULTI_DRAW && RenderQueue::isMultiDrawSupported()) {
+        Shader::setHeader(MULTI_DRAW_SHADER_HEADER);
+        scene.setMultiDraw(true);
+    }
+    std::cout << "Multi-draw indirect: " << (scene.getMultiDraw() ? "on" : "off") << std::endl;
+    scene.setGpuCulling(USE_GPU_CULLING);
+    std::cout << "GPU culling: " << (scene.getGpuCulling() ? "on" : "off") << std::endl;
+    scene.setOcclusionCulling(USE_OCCLUSION_CULLING);
+
     // build and compile our shader program
     
     scene.addShader("standard", "shaders/vertex_standard.glsl", "shaders/fragment_standard.glsl");
@@ -88,6 +149,36 @@ int main() {
     Shader* shader_quad = scene.getShader("quad");
     Shader* shader_skybox = scene.getShader("skybox");
     Shader* shader_depth = scene.getShader("depth");
+    Shader* shader_standard = scene.getShader("standard");
+    bool point_shadows_enabled = USE_POINT_SHADOWS && scene.getMultiDraw() && PointShadows::isSupported();
+    Shader* shader_depth_cube = nullptr;
+    if (point_shadows_enabled) {
+        scene.addShader("depth_cube", "shaders/vertex_depth_cube.glsl", "shaders/geometry_depth_cube.glsl", "shaders/fragment_depth.glsl");
+        shader_depth_cube = scene.getShader("depth_cube");
+    }
+    std::cout << "Point light shadows: " << (point_shadows_enabled ? "on" : "off") << std::endl;
+
+    // Resolve everything the render loop sets so it never looks a uniform up by name
+    Mat4Uniform depth_light_space = shader_depth->getMat4Uniform("lightSpaceMatrix");
+    IntUniform standard_shadow_map = shader_standard->getIntUniform("shadowMap");
+    Mat4Uniform standard_cascade_matrices = shader_standard->getMat4Uniform("cascadeMatrices");
+    FloatUniform standard_cascade_scales = shader_standard->getFloatUniform("cascadeScales");
+    FloatUniform standard_cascade_splits = shader_standard->getFloatUniform("cascadeSplits");
+    IntUniform standard_cascade_count = shader_standard->getIntUniform("numCascades");
+    IntUniform standard_point_shadow_map = shader_standard->getIntUniform("pointShadowMap");
+    FloatUniform standard_point_shadow_levels = shader_standard->getFloatUniform("pointShadowLevels");
+    FloatUniform standard_point_shadow_far = shader_standard->getFloatUniform("pointShadowFar");
+    Mat4Uniform cube_face_matrices;
+    IntUniform cube_layer_base;
+    if (shader_depth_cube != nullptr) {
+        cube_face_matrices = shader_depth_cube->getMat4Uniform("faceMatrices");
+        cube_layer_base = shader_depth_cube->getIntUniform("layerBase");
+    }
+    Mat4Uniform skybox_view = shader_skybox->getMat4Uniform("mat_view");
+    Mat4Uniform skybox_proj = shader_skybox->getMat4Uniform("mat_proj");
+    FloatUniform quad_near_plane = shader_quad->getFloatUniform("near_plane");
+    FloatUniform quad_far_plane = shader_quad->getFloatUniform("far_plane");
+    IntUniform quad_tbo = shader_quad->getIntUniform("TBO");
 
     //set up vertex data(and buffer(s)) and configure vertex attributes
     float vertices[] = {
@@ -129,17 +220,25 @@ int main() {
         -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f
     };
 
-    scene.addModel("gun", "obj/cube.obj");
+    scene.addModelAsync("gun", "obj/cube.obj", MODEL_LOADER_OBJ);
     scene.getModel("gun")->setPosition(glm::vec3(0.0f, 1.2f, 0.0f));
     scene.getModel("gun")->setScale(glm::vec3(0.5f));
     scene.getModel("gun")->setColor(glm::vec3(0.4f));
     scene.assignShader("gun", "standard");
+    scene.setStatic("gun", true);
 
-    scene.addModel("floor", "obj/plane.obj");
+    scene.addModelAsync("floor", "obj/plane.obj", MODEL_LOADER_OBJ);
     scene.getModel("floor")->setPosition(glm::vec3(0.0f, 0.0f, 0.0f));
     scene.getModel("floor")->setScale(glm::vec3(5.0f));
     scene.getModel("floor")->setColor(glm::vec3(1.0f));
     scene.assignShader("floor", "standard");
+    scene.setStatic("floor", true);
+
+    // Left dynamic, it moves every frame.
+    scene.addModelAsync("orbiter", "obj/cube.obj", MODEL_LOADER_OBJ);
+    scene.getModel("orbiter")->setScale(glm::vec3(0.25f));
+    scene.getModel("orbiter")->setColor(glm::vec3(0.8f, 0.3f, 0.2f));
+    scene.assignShader("orbiter", "standard");
     
 
     //Positions Array
@@ -175,16 +274,25 @@ int main() {
         ss << i;
         std::string pname = "plight_" + ss.str();
         scene.addPointLight(pname, plight_positions[i], glm::vec3(0.075f), plight_diffuse[i], glm::vec3(1.0f), 1.0f, 0.09f, 0.032f);
-        //char obj_path[] = "obj/cube.obj";
-        
+
+        // Gizmos share the cube asset with "gun" and are drawn in one instanced batch
+        scene.addModelAsync(pname, "obj/cube.obj", MODEL_LOADER_OBJ);
+        Model* plight = scene.getModel(pname);
+        plight->setColor(glm::vec3(1.0f, 1.0f, 1.0f));
+        plight->setScale(glm::vec3(0.1f));
+        plight->setPosition(plight_positions[i]);
+        scene.assignShader(pname, "standard");
+        scene.setStatic(pname, true);
     }
 
-    scene.addModel("plight", "obj/cube.obj");
-    Model* plight = scene.getModel("plight");
-    plight->setColor(glm::vec3(1.0f, 1.0f, 1.0f));
-    plight->setScale(glm::vec3(0.1f));
-    plight->setPosition(glm::vec3(0.0f, -0.65f, 0.0f));
-    scene.assignShader("plight", "standard");
+    // A grid of dim, short ranged lights just above the floor, whose top sits at y = -5.
+    int scatter_columns = (int)glm::ceil(glm::sqrt((float)SCATTERED_POINT_LIGHTS));
+    for (int i = 0; i < SCATTERED_POINT_LIGHTS; i++) {
+        float u = ((i % scatter_columns) + 0.5f) / scatter_columns;
+        float v = ((i / scatter_columns) + 0.5f) / scatter_columns;
+        glm::vec3 color = 0.15f * glm::vec3(glm::fract(i * 0.37f), glm::fract(i * 0.61f), glm::fract(i * 0.83f));
+        scene.addPointLight("plight_scatter_" + std::to_string(i), glm::vec3(u * 10.0f - 5.0f, -4.85f, v * 10.0f - 5.0f), glm::vec3(0.0f), color, color, 1.0f, 2.0f, 8.0f);
+    }
 
     float light_phi = glm::cos(glm::radians(15.0f));
     float light_gamma = glm::cos(glm::radians(30.0f));
@@ -210,13 +318,18 @@ int main() {
     glBindTexture(GL_TEXTURE_2D, 0);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, TBO, 0);
 
-    unsigned int RBO;
-    glGenRenderbuffers(1, &RBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 800, 600);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, RBO);
+    // A texture rather than a renderbuffer so the scene can build its
+    // occlusion pyramid from it.
+    unsigned int DTO;
+    glGenTextures(1, &DTO);
+    glBindTexture(GL_TEXTURE_2D, DTO);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, 800, 600, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, DTO, 0);
+    scene.setOcclusionDepth(DTO, 800, 600);
+    scene.setViewportHeight(600);
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         std::cout << "Framebuffer not complete!" << std::endl;
@@ -251,25 +364,32 @@ int main() {
     shader_quad->use();
     shader_quad->setInt("depthMapTexture", 0);
     
-    unsigned int depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
-
-    const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
-
-    unsigned int depthMapTexture;
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    ShadowCascades shadow_cascades;
+    shadow_cascades.setCascadeCount(SHADOW_CASCADE_COUNT);
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+        shadow_cascades.setResolution(i, SHADOW_CASCADE_RESOLUTIONS[i]);
+    }
+    shadow_cascades.setMaxDistance(SHADOW_DISTANCE);
+    shadow_cascades.setCaching(USE_SHADOW_CACHE);
+    glm::mat4 cascade_matrices[MAX_SHADOW_CASCADES];
+    float cascade_scales[MAX_SHADOW_CASCADES];
+    float cascade_splits[MAX_SHADOW_CASCADES];
+    // GPU time of the cascade passes. Results are polled rather than waited
+    // for, one still pending when its slot comes round again is dropped.
+    unsigned int shadow_queries[SHADOW_QUERY_SLOTS];
+    bool shadow_query_pending[SHADOW_QUERY_SLOTS] = {};
+    glGenQueries(SHADOW_QUERY_SLOTS, shadow_queries);
+    unsigned int shadow_query_frame = 0;
+    double shadow_pass_ms = 0.0;
+    unsigned int shadow_pass_frames = 0;
+
+    PointShadows point_shadows;
+    point_shadows.setResolution(POINT_SHADOW_RESOLUTION);
+    std::vector<PointLight*> point_lights;
+    // Cube of each light, -1 leaves it unshadowed.
+    std::vector<int> point_shadow_layers;
+    float point_shadow_levels[MAX_POINT_SHADOWS];
+    float point_shadow_far[MAX_POINT_SHADOWS];
     
     std::vector<std::string> faces =
     {
@@ -327,59 +447,140 @@ int main() {
     // render looping
     while (!glfwWindowShouldClose(window))
     {
+        Shader::resetLookupCount();
+        scene.updateAssets(ASSET_UPLOAD_BUDGET_MS);
+
         // input
-        
-        
+        processInput(window);
+        // Once per frame, the cascades are fitted to the view the scene is drawn with.
+        scene.updateCameras();
+
+        float orbit = (float)glfwGetTime() * ORBITER_SPEED;
+        scene.getModel("orbiter")->setPosition(glm::vec3(glm::cos(orbit) * ORBITER_RADIUS, 1.2f, glm::sin(orbit) * ORBITER_RADIUS));
+        if (toggle_shadow_cache) {
+            shadow_cascades.setCaching(!shadow_cascades.getCaching());
+            std::cout << "Shadow cache: " << (shadow_cascades.getCaching() ? "on" : "off") << std::endl;
+            shadow_pass_ms = 0.0;
+            shadow_pass_frames = 0;
+            for (int i = 0; i < SHADOW_QUERY_SLOTS; i++) {
+                shadow_query_pending[i] = false;
+            }
+            toggle_shadow_cache = false;
+        }
+
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         float near_plane = 1.0f, far_plane = 7.5f;
-        glm::mat4 light_proj = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, near_plane, far_plane);
-        glm::mat4 light_view = glm::lookAt(glm::vec3(-2.0f, 4.0f, -1.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 light_mat = light_proj * light_view;
-        
-        shader_depth->use();
-        shader_depth->setMatrix("lightSpaceMatrix", light_mat);
 
         //Capture shadow mappings
-        
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glActiveTexture(GL_TEXTURE0);
-        //glBindTexture(GL_TEXTURE_2D, wood_texture);
-        //renderScene(shader_depth);
-
-        scene.assignShader("gun", "depth");
-        scene.assignShader("floor", "depth");
-        scene.assignShader("plight", "depth");
-        scene.prepareShaders();
-
-        scene.renderScene();
-
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        processInput(window);
+        // The output quad at the end of the last frame turned depth testing off,
+        // without it the shadow passes write no depth.
+        glEnable(GL_DEPTH_TEST);
+        AABB casters = { glm::vec3(0.0f), glm::vec3(0.0f) };
+        scene.getShadowCasterBounds(casters);
+        shadow_cascades.update(camera, scene.getDirectionalLight("main")->getDirection(), casters, scene.getStaticRevision());
+
+        for (int i = 0; i < SHADOW_QUERY_SLOTS; i++) {
+            GLint available = 0;
+            if (shadow_query_pending[i]) {
+                glGetQueryObjectiv(shadow_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (available) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(shadow_queries[i], GL_QUERY_RESULT, &elapsed);
+                shadow_pass_ms += elapsed / 1000000.0;
+                shadow_pass_frames++;
+                shadow_query_pending[i] = false;
+            }
+        }
+        unsigned int shadow_query = shadow_query_frame % SHADOW_QUERY_SLOTS;
+        glBeginQuery(GL_TIME_ELAPSED, shadow_queries[shadow_query]);
+        shader_depth->use();
+        for (int i = 0; i < shadow_cascades.getCascadeCount(); i++) {
+            const ShadowCascade& cascade = shadow_cascades.getCascade(i);
+            if (cascade.active) {
+                shader_depth->setMatrix(depth_light_space, cascade.view_proj);
+            }
+            if (cascade.active && shadow_cascades.getCaching() && cascade.static_dirty) {
+                shadow_cascades.beginStatic(i);
+                scene.renderShadowCasters(shader_depth, cascade.view_proj, SHADOW_CASTERS_STATIC);
+                shadow_cascades.end();
+            }
+            shadow_cascades.begin(i);
+            if (cascade.active) {
+                scene.renderShadowCasters(shader_depth, cascade.view_proj, shadow_cascades.getCaching() ? SHADOW_CASTERS_DYNAMIC : SHADOW_CASTERS_ALL);
+            }
+            shadow_cascades.end();
+            cascade_matrices[i] = cascade.shadow_matrix;
+            cascade_scales[i] = cascade.uv_scale;
+            cascade_splits[i] = cascade.split_far;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        shadow_query_pending[shadow_query] = true;
+        shadow_query_frame++;
+
+        // One pass per light, the geometry shader spreads the casters over
+        // its six faces. Lights sharing a tier are drawn after one clear.
+        scene.getPointLights(point_lights);
+        point_shadow_layers.assign(point_lights.size(), -1);
+        if (point_shadows_enabled) {
+            point_shadows.update(camera, point_lights, SCR_HEIGHT);
+            shader_depth_cube->use();
+            for (int level = 0; level < POINT_SHADOW_LEVELS; level++) {
+                if (!point_shadows.isLevelUsed(level)) {
+                    continue;
+                }
+                point_shadows.begin(level);
+                for (int i = 0; i < point_shadows.getShadowCount(); i++) {
+                    const PointShadow& shadow = point_shadows.getShadow(i);
+                    if (!shadow.active || shadow.level != level) {
+                        continue;
+                    }
+                    shader_depth_cube->setMatrices(cube_face_matrices, shadow.face_matrices, 6);
+                    shader_depth_cube->setInt(cube_layer_base, shadow.layer * 6);
+                    scene.renderShadowCasters(shader_depth_cube, shadow.cull_matrix);
+                }
+                point_shadows.end();
+            }
+        }
+        for (int i = 0; i < MAX_POINT_SHADOWS; i++) {
+            bool shadowed = point_shadows_enabled && point_shadows.getShadow(i).active;
+            if (shadowed) {
+                point_shadow_layers[point_shadows.getShadow(i).light] = point_shadows.getShadow(i).layer;
+            }
+            point_shadow_levels[i] = shadowed ? (float)point_shadows.getShadow(i).level : 0.0f;
+            point_shadow_far[i] = shadowed ? point_shadows.getShadow(i).far_plane : 0.0f;
+        }
 
 
         glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         scene.assignShader("gun", "standard");
         scene.assignShader("floor", "standard");
-        scene.assignShader("plight", "light");
+        for (int i = 0; i < 4; i++) {
+            scene.assignShader("plight_" + std::to_string(i), "light");
+        }
 
         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
-        scene.getShader("standard")->use();
-        scene.getShader("standard")->setMatrix("lightSpaceMatrix", light_mat);
-        scene.getShader("standard")->setInt("shadowMap", 1);
+        shader_standard->use();
+        shader_standard->setInt(standard_shadow_map, SHADOW_MAP_TEXTURE_UNIT);
+        shader_standard->setMatrices(standard_cascade_matrices, cascade_matrices, shadow_cascades.getCascadeCount());
+        shader_standard->setFloats(standard_cascade_scales, cascade_scales, shadow_cascades.getCascadeCount());
+        shader_standard->setFloats(standard_cascade_splits, cascade_splits, shadow_cascades.getCascadeCount());
+        shader_standard->setInt(standard_cascade_count, shadow_cascades.getCascadeCount());
+        shader_standard->setInt(standard_point_shadow_map, POINT_SHADOW_TEXTURE_UNIT);
+        shader_standard->setFloats(standard_point_shadow_levels, point_shadow_levels, MAX_POINT_SHADOWS);
+        shader_standard->setFloats(standard_point_shadow_far, point_shadow_far, MAX_POINT_SHADOWS);
+        scene.setPointLightShadows(point_shadow_layers);
         scene.prepareShaders();
         
         glDepthMask(GL_FALSE);
         shader_skybox->use();
-        shader_skybox->setMatrix("mat_view", glm::mat4(glm::mat3(camera->getView())));
-        shader_skybox->setMatrix("mat_proj", camera->getProjection());
+        shader_skybox->setMatrix(skybox_view, glm::mat4(glm::mat3(camera->getView())));
+        shader_skybox->setMatrix(skybox_proj, camera->getProjection());
         
         glBindVertexArray(skyboxVAO);
         glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap_texture);
@@ -387,9 +588,14 @@ int main() {
         glDepthMask(GL_TRUE);
         glBindVertexArray(0);
         
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        scene.renderScene();
+        glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_cascades.getTexture());
+        if (point_shadows_enabled) {
+            glActiveTexture(GL_TEXTURE0 + POINT_SHADOW_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, point_shadows.getTexture());
+        }
+        glActiveTexture(GL_TEXTURE0);
+        scene.renderModels();
         
         /*
         // Render scene to quad texture
@@ -424,22 +630,71 @@ int main() {
         shader_quad->use();
         glBindVertexArray(quadVAO);
         glDisable(GL_DEPTH_TEST);
-        shader_quad->setFloat("near_plane", near_plane);
-        shader_quad->setFloat("far_plane", far_plane);
-        shader_quad->setInt("TBO", 0);
+        shader_quad->setFloat(quad_near_plane, near_plane);
+        shader_quad->setFloat(quad_far_plane, far_plane);
+        shader_quad->setInt(quad_tbo, 0);
         glActiveTexture(GL_TEXTURE0);
         
         glBindTexture(GL_TEXTURE_2D, TBO);
         
         glDrawArrays(GL_TRIANGLES, 0, 6);
         glBindVertexArray(0);
+
+        if (print_stats) {
+            const RenderQueueStats& stats = scene.getRenderStats();
+            std::cout << "Uniform lookups this frame: " << Shader::getLookupCount() << std::endl;
+            const CullStats& cull = scene.getCullStats();
+            std::cout << "Models visible: " << cull.models_visible << "/" << cull.models_tested << ", meshes visible: " << cull.meshes_visible << std::endl;
+            std::cout << "Draws: " << stats.draws << " (" << stats.instances << " instances, " << stats.triangles << " triangles)" << std::endl;
+            if (scene.getMultiDraw()) {
+                std::cout << "Multi-draw calls: " << stats.multi_draws << " (" << stats.indirect_commands << " commands)" << std::endl;
+            }
+            const LodStats& lods = scene.getLodStats();
+            std::cout << "LOD instances:";
+            for (unsigned int i = 0; i < MESH_MAX_LODS; i++) {
+                std::cout << " " << lods.instances[i];
+            }
+            std::cout << std::endl;
+            if (scene.getGpuCulling()) {
+                const GpuCullStats& gpu = scene.getGpuCullStats();
+                std::cout << "GPU culled: " << gpu.visible << "/" << gpu.instances << " static instances visible (" << gpu.occluded << " occluded, " << gpu.second_phase << " from the second phase), " << gpu.latency << " frames old, LOD instances:";
+                for (unsigned int i = 0; i < MESH_MAX_LODS; i++) {
+                    std::cout << " " << gpu.lod_instances[i];
+                }
+                std::cout << std::endl;
+            }
+            const LightClusterStats& clusters = scene.getLightClusterStats();
+            std::cout << "Light clusters: " << clusters.lights_visible << "/" << clusters.lights << " point lights in view, " << clusters.indices << " indices, at most " << clusters.max_per_cluster << " per cluster" << std::endl;
+            std::cout << "Shadow cascades redrawn from static casters: " << shadow_cascades.getStaticRedraws() << "/" << shadow_cascades.getCascadeCount() << std::endl;
+            if (shadow_pass_frames > 0) {
+                std::cout << "Shadow cascade passes: " << shadow_pass_ms / shadow_pass_frames << " ms GPU per frame over " << shadow_pass_frames << " frames, cache " << (shadow_cascades.getCaching() ? "on" : "off") << std::endl;
+                shadow_pass_ms = 0.0;
+                shadow_pass_frames = 0;
+            }
+            std::cout << "Program binds: " << stats.program_binds << " (skipped " << stats.program_binds_skipped << ")" << std::endl;
+            std::cout << "Material updates: " << stats.material_updates << " (skipped " << stats.material_updates_skipped << ")" << std::endl;
+            std::cout << "Texture binds: " << stats.texture_binds << " (skipped " << stats.texture_binds_skipped << ")" << std::endl;
+            std::cout << "VAO binds: " << stats.vao_binds << " (skipped " << stats.vao_binds_skipped << ")" << std::endl;
+            GeometryArena& arena = GeometryArena::get();
+            std::cout << "Mesh buffers: " << Mesh::getTotalGpuMemory() / 1024 << " KB in a " << arena.getCapacity() / 1024 << " KB arena (" << arena.getFreeRangeCount() << " free ranges)" << std::endl;
+            std::vector<TextureInfo> textures;
+            TextureCache::get().getTextures(textures);
+            std::cout << "Textures: " << textures.size() << ", " << TextureCache::get().getMemoryUsage() / 1024 << " KB" << std::endl;
+            for (unsigned int i = 0; i < textures.size(); i++) {
+                std::cout << "  " << textures[i].path << " " << textures[i].width << "x" << textures[i].height << ", " << textures[i].gpu_bytes / 1024 << " KB, " << textures[i].refs << " refs, decode " << textures[i].decode_ms << " ms, upload " << textures[i].upload_ms << " ms" << std::endl;
+            }
+            print_stats = false;
+        }
         
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
     glDeleteFramebuffers(1, &FBO);
-    glDeleteFramebuffers(1, &depthMapFBO);
+    glDeleteTextures(1, &DTO);
+    glDeleteQueries(SHADOW_QUERY_SLOTS, shadow_queries);
+    shadow_cascades.clear();
+    point_shadows.clear();
     scene.clearAll();
 
     glfwTerminate();
@@ -469,6 +724,52 @@ void processInput(GLFWwindow* w)
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
         camera->moveUp();
     }
+
+    static bool stats_key_down = false;
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+        if (!stats_key_down) {
+            print_stats = true;
+        }
+        stats_key_down = true;
+    } else {
+        stats_key_down = false;
+    }
+
+    static bool shadow_cache_key_down = false;
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+        if (!shadow_cache_key_down) {
+            toggle_shadow_cache = true;
+        }
+        shadow_cache_key_down = true;
+    } else {
+        shadow_cache_key_down = false;
+    }
+
+    // Freezes culling where the camera is, fly off to see what got rejected.
+    static bool cull_debug_key_down = false;
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+        if (!cull_debug_key_down) {
+            scene.setCullDebug(!scene.getCullDebug());
+            std::cout << "Cull debug view: " << (scene.getCullDebug() ? "on" : "off") << std::endl;
+        }
+        cull_debug_key_down = true;
+    } else {
+        cull_debug_key_down = false;
+    }
+
+    // The cursor is captured, so picking goes through the centre of the screen.
+    static bool pick_button_down = false;
+    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+        if (!pick_button_down) {
+            int width, height;
+            glfwGetWindowSize(window, &width, &height);
+            std::string picked = scene.pickModel(width * 0.5, height * 0.5);
+            std::cout << "Picked: " << (picked.empty() ? "nothing" : picked) << std::endl;
+        }
+        pick_button_down = true;
+    } else {
+        pick_button_down = false;
+    }
 }
 
 void framebuffer_size_callback(GLFWwindow* w, int width, int height)
@@ -489,76 +790,11 @@ void scroll_callback(GLFWwindow* w, double xoffset, double yoffset) {
 }
 
 unsigned int loadCubemap(std::vector<std::string> faces) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, channels;
-    std::vector<unsigned int> sides = {
-        GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-        GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-    };
-    for (unsigned int i = 0; i < faces.size(); i++) {
-        stbi_set_flip_vertically_on_load(0);
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &channels, 0);
-
-        if (data) {
-            glTexImage2D(sides[i], 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        } else {
-            std::cout << "Failed to load skybox texture!" << std::endl;
-            stbi_image_free(data);
-            return 0;
-        }
-
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-     
-    }
-    return textureID;
+    return TextureCache::get().acquireCubemap(faces);
 }
 
 unsigned int loadTexture(std::string filename){
-    unsigned int texture_id;
-	glGenTextures(1, &texture_id);
-
-	int width, height, num_components;
-	stbi_set_flip_vertically_on_load(1);
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &num_components, 0);
-	if (data) {
-		GLenum format;
-		if (num_components == 1) {
-			format = GL_RED;
-		} else if (num_components == 3) {
-			format = GL_RGB;
-		} else if (num_components == 4) {
-			format = GL_RGBA;
-		}
-
-		glBindTexture(GL_TEXTURE_2D, texture_id);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-
-	} else {
-		std::cout << "Texture load failed." << std::endl;
-		stbi_image_free(data);
-	}
-
-	return texture_id;
+    return TextureCache::get().acquire(filename);
 }
 
 unsigned int quadVAO = 0;
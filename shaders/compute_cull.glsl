@@ -0,0 +1,232 @@
+#version 430 core
+// Frustum and occlusion culls and picks a level of detail for every static
+// instance, then appends the survivors to the instance range of their
+// (shader, mesh, level) group. compute_cull_commands.glsl turns the group
+// counts into the instance counts of the indirect commands.
+layout (local_size_x = 64) in;
+
+// Mirrors CullInstanceBlock.
+struct CullInstance {
+	mat4 model;
+	vec4 color;
+	vec4 sphere;
+	vec4 boundsMin;
+	vec4 boundsMax;
+	vec4 lodErrors;
+	// first group, mesh count, level count, current level and DEFERRED
+	uvec4 info;
+};
+
+// Mirrors InstanceData, the layout the instanced vertex attributes read.
+struct DrawInstance {
+	mat4 model;
+	vec3 color;
+	uint drawId;
+};
+
+layout (std430, binding = 1) buffer Instances {
+	CullInstance instances[];
+};
+layout (std430, binding = 2) readonly buffer GroupBases {
+	uint groupBases[];
+};
+layout (std430, binding = 3) buffer GroupCounts {
+	uint groupCounts[];
+};
+layout (std430, binding = 4) writeonly buffer DrawInstances {
+	DrawInstance drawInstances[];
+};
+// visible, instances per level, occluded, visible in the second phase
+layout (std430, binding = 5) buffer Counters {
+	uint counters[];
+};
+
+uniform mat4 viewProj;
+uniform vec3 cameraPos;
+uniform float nearPlane;
+uniform float pixelsPerUnit;
+uniform float lodPixelError;
+uniform float lodHysteresis;
+uniform int instanceCount;
+uniform int debugView;
+// GPU_CULL_PHASE_ALL, _FIRST or _SECOND
+uniform int phase;
+uniform int occlusion;
+uniform mat4 hizViewProj;
+// DepthPyramid, farthest depth per texel.
+uniform sampler2D hiZ;
+
+// Set by the first phase on instances the second one has to test again.
+const uint DEFERRED = 0x100u;
+const uint LOD_MASK = 0xFFu;
+
+const vec3 lodColors[4] = vec3[4](
+	vec3(0.2, 0.9, 0.2),
+	vec3(0.9, 0.9, 0.2),
+	vec3(0.9, 0.5, 0.1),
+	vec3(0.2, 0.4, 0.9)
+);
+
+shared uint localVisible;
+shared uint localLods[4];
+shared uint localOccluded;
+shared uint localSecond;
+
+// Gribb/Hartmann, same as Frustum::update.
+bool sphereVisible(vec3 center, float radius) {
+	vec4 row0 = vec4(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+	vec4 row1 = vec4(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+	vec4 row2 = vec4(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+	vec4 row3 = vec4(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+	vec4 planes[6] = vec4[6](row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2);
+	for (int i = 0; i < 6; i++) {
+		vec4 plane = planes[i] / length(planes[i].xyz);
+		if (dot(plane.xyz, center) + plane.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Projects the box with the matrix the pyramid was built with and compares
+// its nearest depth against the farthest depth under it, read at the level
+// where the box covers at most 2x2 texels.
+bool boxOccluded(vec3 boundsMin, vec3 boundsMax) {
+	vec2 minUv = vec2(1.0);
+	vec2 maxUv = vec2(0.0);
+	float nearest = 1.0;
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3((i & 1) != 0 ? boundsMax.x : boundsMin.x, (i & 2) != 0 ? boundsMax.y : boundsMin.y, (i & 4) != 0 ? boundsMax.z : boundsMin.z);
+		vec4 clip = hizViewProj * vec4(corner, 1.0);
+		// Reaches behind the camera, the projection says nothing.
+		if (clip.w <= 0.0) {
+			return false;
+		}
+		vec3 ndc = clip.xyz / clip.w;
+		minUv = min(minUv, ndc.xy * 0.5 + 0.5);
+		maxUv = max(maxUv, ndc.xy * 0.5 + 0.5);
+		nearest = min(nearest, ndc.z * 0.5 + 0.5);
+	}
+	minUv = clamp(minUv, vec2(0.0), vec2(1.0));
+	maxUv = clamp(maxUv, vec2(0.0), vec2(1.0));
+
+	vec2 extent = (maxUv - minUv) * vec2(textureSize(hiZ, 0));
+	int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+	level = clamp(level, 0, textureQueryLevels(hiZ) - 1);
+	ivec2 size = textureSize(hiZ, level);
+	ivec2 first = clamp(ivec2(minUv * vec2(size)), ivec2(0), size - 1);
+	ivec2 last = clamp(ivec2(maxUv * vec2(size)), ivec2(0), size - 1);
+
+	float farthest = max(
+		max(texelFetch(hiZ, first, level).r, texelFetch(hiZ, ivec2(last.x, first.y), level).r),
+		max(texelFetch(hiZ, ivec2(first.x, last.y), level).r, texelFetch(hiZ, last, level).r));
+	return nearest > farthest;
+}
+
+// Same rule as Scene::selectLod, the errors are already in world units.
+uint selectLod(CullInstance instance) {
+	uint count = instance.info.z;
+	if (count <= 1u || lodPixelError <= 0.0 || pixelsPerUnit <= 0.0) {
+		return 0u;
+	}
+	float distance = max(length(instance.sphere.xyz - cameraPos) - instance.sphere.w, nearPlane);
+	float toPixels = pixelsPerUnit / distance;
+
+	uint current = min(instance.info.w & LOD_MASK, count - 1u);
+	uint desired = 0u;
+	for (uint level = count - 1u; level > 0u; level--) {
+		if (instance.lodErrors[level] * toPixels <= lodPixelError) {
+			desired = level;
+			break;
+		}
+	}
+	while (desired > current && instance.lodErrors[desired] * toPixels > lodPixelError * (1.0 - lodHysteresis)) {
+		desired--;
+	}
+	return desired;
+}
+
+void cullInstance(uint index) {
+	CullInstance instance = instances[index];
+	uint meshCount = instance.info.y;
+	if (meshCount == 0u) {
+		return;
+	}
+	bool deferred = (instance.info.w & DEFERRED) != 0u;
+	if (phase == 2 && !deferred) {
+		return;
+	}
+	instance.info.w &= LOD_MASK;
+
+	// Deferred instances already passed the frustum test.
+	bool inside = phase == 2 || sphereVisible(instance.sphere.xyz, instance.sphere.w);
+	bool occluded = inside && occlusion != 0 && boxOccluded(instance.boundsMin.xyz, instance.boundsMax.xyz);
+	if (phase == 1 && occluded) {
+		instances[index].info.w = instance.info.w | DEFERRED;
+		return;
+	}
+	if (deferred) {
+		instances[index].info.w = instance.info.w;
+	}
+	if (occluded) {
+		atomicAdd(localOccluded, 1u);
+	}
+
+	bool visible = inside && !occluded;
+	if (!visible && debugView == 0) {
+		return;
+	}
+
+	uint lod = selectLod(instance);
+	vec3 color = instance.color.rgb;
+	if (visible) {
+		instances[index].info.w = lod;
+		atomicAdd(localVisible, 1u);
+		atomicAdd(localLods[lod], 1u);
+		if (phase == 2) {
+			atomicAdd(localSecond, 1u);
+		}
+		if (debugView != 0) {
+			color = lodColors[lod];
+		}
+	} else {
+		color = inside ? vec3(0.6, 0.0, 0.8) : vec3(1.0, 0.0, 0.0);
+	}
+
+	for (uint mesh = 0u; mesh < meshCount; mesh++) {
+		uint group = instance.info.x + mesh * instance.info.z + lod;
+		uint slot = groupBases[group] + atomicAdd(groupCounts[group], 1u);
+		drawInstances[slot].model = instance.model;
+		drawInstances[slot].color = color;
+		drawInstances[slot].drawId = group;
+	}
+}
+
+void main() {
+	if (gl_LocalInvocationIndex == 0u) {
+		localVisible = 0u;
+		for (int i = 0; i < 4; i++) {
+			localLods[i] = 0u;
+		}
+		localOccluded = 0u;
+		localSecond = 0u;
+	}
+	memoryBarrierShared();
+	barrier();
+
+	if (gl_GlobalInvocationID.x < uint(instanceCount)) {
+		cullInstance(gl_GlobalInvocationID.x);
+	}
+	memoryBarrierShared();
+	barrier();
+
+	// One atomic per workgroup on the shared counters.
+	if (gl_LocalInvocationIndex == 0u) {
+		atomicAdd(counters[0], localVisible);
+		for (int i = 0; i < 4; i++) {
+			atomicAdd(counters[1 + i], localLods[i]);
+		}
+		atomicAdd(counters[5], localOccluded);
+		atomicAdd(counters[6], localSecond);
+	}
+}
@@ -0,0 +1,25 @@
+#version 430 core
+// Copies the per group instance counts of compute_cull.glsl into every
+// indirect command of the group, chunked meshes have several.
+layout (local_size_x = 64) in;
+
+layout (std430, binding = 3) readonly buffer GroupCounts {
+	uint groupCounts[];
+};
+// DrawElementsIndirectCommand, five uints each.
+layout (std430, binding = 6) buffer Commands {
+	uint commands[];
+};
+layout (std430, binding = 7) readonly buffer CommandGroups {
+	uint commandGroups[];
+};
+
+uniform int commandCount;
+
+void main() {
+	uint index = gl_GlobalInvocationID.x;
+	if (index >= uint(commandCount)) {
+		return;
+	}
+	commands[index * 5u + 1u] = groupCounts[commandGroups[index]];
+}
@@ -0,0 +1,30 @@
+#version 430 core
+// One level of the occlusion pyramid: every texel keeps the farthest depth
+// of the source texels under it. Odd sources give some texels a third row or
+// column, so nothing is skipped.
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// The depth buffer for level 0, the previous level otherwise.
+uniform sampler2D source;
+uniform int sourceLevel;
+layout (r32f) writeonly uniform image2D destination;
+
+void main() {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 destinationSize = imageSize(destination);
+	if (texel.x >= destinationSize.x || texel.y >= destinationSize.y) {
+		return;
+	}
+
+	ivec2 sourceSize = textureSize(source, sourceLevel);
+	ivec2 first = (texel * sourceSize) / destinationSize;
+	ivec2 last = min(((texel + 1) * sourceSize + destinationSize - 1) / destinationSize - 1, sourceSize - 1);
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; y++) {
+		for (int x = first.x; x <= last.x; x++) {
+			farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+		}
+	}
+	imageStore(destination, texel, vec4(farthest));
+}
@@ -1,5 +1,6 @@
 #version 330 core
 
+// Depth only, the fixed function depth write is all a caster needs. Writing
+// gl_FragDepth would turn off early depth testing.
 void main(){
-	gl_FragDepth = gl_FragCoord.z;
 }
\ No newline at end of file
@@ -12,16 +12,17 @@ struct DirectionalLight{
 	vec3 specular;
 };
 
+// Attenuation terms sit in the w slot of each vec3, as in the light buffer.
 struct PointLight{
 	vec3 position;
-	
 	float kc;
-	float kl;
-	float kq;
-
 	vec3 ambient;
+	float kl;
 	vec3 diffuse;
+	float kq;
 	vec3 specular;
+	// Cube of the point shadow atlas, below 0 for none.
+	float shadowLayer;
 };
 
 struct SpotLight{
@@ -38,7 +39,7 @@ in VS_OUT {
 	vec3 fragPos;
 	vec3 normal;
 	vec2 texCoords;
-	vec4 fragPosLightSpace;
+	vec3 color;
 } fs_in;
 
 uniform Material material;
@@ -49,17 +50,54 @@ uniform sampler2D texture_diffuse3;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_specular2;
 
-uniform sampler2D shadowMap;
+// Cascades of the first directional light, see ShadowCascades.
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeScales[MAX_CASCADES];
+// View space distance where each cascade ends.
+uniform float cascadeSplits[MAX_CASCADES];
+uniform int numCascades;
 
-#define NR_POINT_LIGHTS 4
 #define NR_DIR_LIGHTS 4
-uniform DirectionalLight dLights[NR_DIR_LIGHTS];
-uniform PointLight pLights[NR_POINT_LIGHTS];
+layout (std140) uniform Lights {
+	DirectionalLight dLights[NR_DIR_LIGHTS];
+	int num_dlights;
+	int num_plights;
+	// Cluster slice of a view space depth d is log(d) * clusterScale + clusterBias.
+	float clusterScale;
+	float clusterBias;
+};
+
+// Point lights, four texels each, and the froxel grid listing the ones that
+// reach each froxel, see LightClusters.
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+uniform samplerBuffer pointLightData;
+// Offset into clusterLights and light count of each froxel.
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLights;
 uniform SpotLight sLight;
 
+// Cube shadow maps of the point lights, see PointShadows, indexed by the
+// light's shadowLayer. Cube map arrays need a 4.x build.
+#define MAX_POINT_SHADOWS 4
+#if __VERSION__ >= 400
+#define POINT_SHADOWS 1
+uniform samplerCubeArray pointShadowMap;
+uniform float pointShadowLevels[MAX_POINT_SHADOWS];
+uniform float pointShadowFar[MAX_POINT_SHADOWS];
+#endif
+#define POINT_SHADOW_NEAR 0.2
+
 out vec4 FragColor;
 
-uniform vec3 cameraPos;
+layout (std140) uniform Camera {
+	mat4 mat_view;
+	mat4 mat_proj;
+	vec3 cameraPos;
+};
 
 in vec3 normal_in;
 in vec3 fragPos;
@@ -73,15 +111,76 @@ uniform int has_specular;
 
 uniform samplerCube skybox;
 
-uniform vec3 output_color;
+// Share of the light that reaches the fragment, from the nearest cascade
+// holding it. Lit past the last one and outside the caster fit.
+float shadowCalc(vec3 fragPos){
+	float viewDepth = -(mat_view * vec4(fragPos, 1.0)).z;
+	int cascade = 0;
+	while(cascade < numCascades && viewDepth > cascadeSplits[cascade]){
+		cascade++;
+	}
+	if(cascade >= numCascades){
+		return 1.0;
+	}
+	vec3 projCoords = (cascadeMatrices[cascade] * vec4(fragPos, 1.0)).xyz;
+	if(any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0)))){
+		return 1.0;
+	}
+	return texture(shadowMap, vec4(projCoords.xy * cascadeScales[cascade], float(cascade), projCoords.z));
+}
+
+PointLight fetchPointLight(int index){
+	vec4 t0 = texelFetch(pointLightData, index * 4);
+	vec4 t1 = texelFetch(pointLightData, index * 4 + 1);
+	vec4 t2 = texelFetch(pointLightData, index * 4 + 2);
+	vec4 t3 = texelFetch(pointLightData, index * 4 + 3);
+	PointLight light;
+	light.position = t0.xyz;
+	light.kc = t0.w;
+	light.ambient = t1.xyz;
+	light.kl = t1.w;
+	light.diffuse = t2.xyz;
+	light.kq = t2.w;
+	light.specular = t3.xyz;
+	light.shadowLayer = t3.w;
+	return light;
+}
 
-float shadowCalc(vec4 fragPosLightSpace){
-	vec3 projCoords = fragPos.xyz / fragPosLightSpace.w;
-	projCoords = projCoords * 0.5 + 0.5;
-	float closestDepth = texture(shadowMap, projCoords.xy).r;
-	float currDepth = projCoords.z;
-	float shadow = currDepth > closestDepth ? 1.0 : 0.0;
-	return shadow;
+// Froxel of a world space position, tiles from its NDC and the slice from
+// its view depth.
+int clusterIndex(vec3 fragPos){
+	vec4 viewPos = mat_view * vec4(fragPos, 1.0);
+	vec4 clipPos = mat_proj * viewPos;
+	vec2 ndc = clipPos.xy / clipPos.w;
+	ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(CLUSTER_X, CLUSTER_Y)), ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	int slice = clamp(int(floor(log(max(-viewPos.z, 1e-4)) * clusterScale + clusterBias)), 0, CLUSTER_Z - 1);
+	return (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+}
+
+// Share of a point light that reaches the fragment. A face stores the depth
+// of the major axis, taken back to a distance to compare with the fragment's.
+float pointShadowCalc(PointLight light, vec3 fragPos){
+#ifdef POINT_SHADOWS
+	if(light.shadowLayer < 0.0){
+		return 1.0;
+	}
+	int cube = int(light.shadowLayer);
+	vec3 toFrag = fragPos - light.position;
+	vec3 axis = abs(toFrag);
+	float fragDepth = max(axis.x, max(axis.y, axis.z));
+	float far = pointShadowFar[cube];
+	if(fragDepth >= far){
+		return 1.0;
+	}
+	float level = pointShadowLevels[cube];
+	float ndc = textureLod(pointShadowMap, vec4(toFrag, light.shadowLayer), level).r * 2.0 - 1.0;
+	float storedDepth = 2.0 * far * POINT_SHADOW_NEAR / (far + POINT_SHADOW_NEAR - ndc * (far - POINT_SHADOW_NEAR));
+	// A texel and a half of slack at the fragment's distance.
+	float texel = 2.0 * fragDepth / float(textureSize(pointShadowMap, int(level)).x);
+	return fragDepth - 1.5 * texel <= storedDepth ? 1.0 : 0.0;
+#else
+	return 1.0;
+#endif
 }
 
 vec3 calcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir, vec3 lightSpec){
@@ -93,7 +192,7 @@ vec3 calcSpecular(vec3 lightDir, vec3 normal, vec3 viewDir, vec3 lightSpec){
 	return specular;
 }
 
-vec3 calcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir){
+vec3 calcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir, float lit){
 	vec3 lightDir = normalize(-light.direction);
 	float diff = max(dot(normal, lightDir), 0.0);
 	vec3 diffuse = light.diffuse * diff * output_diffuse;
@@ -102,18 +201,16 @@ vec3 calcDirLight(DirectionalLight light, vec3 normal, vec3 viewDir){
 
 	vec3 specular = calcSpecular(lightDir, normal, viewDir, light.specular);
 
-	float shadow = shadowCalc(fs_in.fragPosLightSpace);
-
-	vec3 result = (ambient + (1.0 * shadow) * (diffuse + specular));
+	vec3 result = (ambient + lit * (diffuse + specular));
 
 	//vec3 result = ambient + diffuse + specular;
 
 	return result;
 }
 
-vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
+vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float lit){
 	
-	vec3 lightDir = normalize(light.position - fs_in.fragPos);
+	vec3 lightDir = normalize(light.position - fragPos);
 
 	float diff = max(dot(normal, lightDir), 0.0);
 
@@ -128,7 +225,7 @@ vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir){
 	diffuse *= attenuation;
 	specular *= attenuation;
 
-	vec3 result = ambient + diffuse + specular;
+	vec3 result = ambient + lit * (diffuse + specular);
 	return result;
 }
 
@@ -137,13 +234,13 @@ void main()
 	if(has_diffuse > 0){
 		output_diffuse = vec3(texture(material.diffuse,fs_in.texCoords)).rgb;
 	}else{
-		output_diffuse = output_color;
+		output_diffuse = fs_in.color;
 	}
 
 	if(has_specular > 0){
 		output_specular = vec3(texture(material.specular,fs_in.texCoords)).rgb;
 	}else{
-		output_specular = output_color;
+		output_specular = fs_in.color;
 	}
 
 	vec3 norm = normalize(fs_in.normal);
@@ -158,12 +255,16 @@ void main()
 	//output_diffuse = result;
 	//output_specular = result;
 	
-	for(int i=0;i<NR_DIR_LIGHTS; i++){
-		result += calcDirLight(dLights[i], norm, cameraDir);
+	float lit = shadowCalc(fs_in.fragPos);
+	for(int i=0;i<num_dlights; i++){
+		result += calcDirLight(dLights[i], norm, cameraDir, i == 0 ? lit : 1.0);
 	}
 
-	for(int i=0;i<NR_POINT_LIGHTS; i++){
-		//result += calcPointLight(pLights[i], norm, fragPos, cameraDir);
+	// Only the point lights whose sphere reaches the fragment's froxel.
+	uvec2 cluster = texelFetch(clusterGrid, clusterIndex(fs_in.fragPos)).xy;
+	for(uint i = 0u; i < cluster.y; i++){
+		PointLight light = fetchPointLight(int(texelFetch(clusterLights, int(cluster.x + i)).r));
+		result += calcPointLight(light, norm, fs_in.fragPos, cameraDir, pointShadowCalc(light, fs_in.fragPos));
 	}
 	
 	FragColor = vec4(result, 1.0);
@@ -0,0 +1,39 @@
+#version 330 core
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+// View projection of each face of the light's cube, in cube map face order,
+// and the layer of its first face in the cube map array.
+uniform mat4 faceMatrices[6];
+uniform int layerBase;
+
+void main(){
+	for(int face = 0; face < 6; face++){
+		vec4 clip0 = faceMatrices[face] * gl_in[0].gl_Position;
+		vec4 clip1 = faceMatrices[face] * gl_in[1].gl_Position;
+		vec4 clip2 = faceMatrices[face] * gl_in[2].gl_Position;
+
+		// Faces the triangle lies entirely outside of get nothing, most
+		// triangles only touch one or two.
+		vec3 x = vec3(clip0.x, clip1.x, clip2.x);
+		vec3 y = vec3(clip0.y, clip1.y, clip2.y);
+		vec3 z = vec3(clip0.z, clip1.z, clip2.z);
+		vec3 w = vec3(clip0.w, clip1.w, clip2.w);
+		if(all(lessThan(x, -w)) || all(greaterThan(x, w)) ||
+			all(lessThan(y, -w)) || all(greaterThan(y, w)) ||
+			all(lessThan(z, -w)) || all(greaterThan(z, w))){
+			continue;
+		}
+
+		gl_Layer = layerBase + face;
+		gl_Position = clip0;
+		EmitVertex();
+		gl_Layer = layerBase + face;
+		gl_Position = clip1;
+		EmitVertex();
+		gl_Layer = layerBase + face;
+		gl_Position = clip2;
+		EmitVertex();
+		EndPrimitive();
+	}
+}
\ No newline at end of file
@@ -1,9 +1,28 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 3) in mat4 aModel;
 
 uniform mat4 lightSpaceMatrix;
-uniform mat4 mat_model;
+#ifdef MULTI_DRAW
+// Per-draw state of the multi-draw path, mirrors DrawDataBlock.
+layout (location = 8) in uint aDrawId;
+struct DrawData {
+	vec4 positionOffset;
+	vec4 positionScale;
+};
+layout (std430, binding = 0) readonly buffer Draws {
+	DrawData draws[];
+};
+#define POSITION_OFFSET draws[aDrawId].positionOffset.xyz
+#define POSITION_SCALE draws[aDrawId].positionScale.xyz
+#else
+// Identity for float vertices, the mesh bounds for packed ones.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#define POSITION_OFFSET positionOffset
+#define POSITION_SCALE positionScale
+#endif
 
 void main(){
-	gl_Position = lightSpaceMatrix * mat_model * vec4(aPos, 1.0);
+	gl_Position = lightSpaceMatrix * aModel * vec4(POSITION_OFFSET + aPos * POSITION_SCALE, 1.0);
 }
\ No newline at end of file
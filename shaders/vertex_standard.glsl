@@ -2,33 +2,56 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in vec3 aColor;
 
 out VS_OUT {
 	vec3 fragPos;
 	vec3 normal;
 	vec2 texCoords;
-	vec4 fragPosLightSpace;
+	vec3 color;
 } vs_out;
 
 out vec3 fragPos;
 out vec3 normal_in;
 out vec2 texCoords; 
 
-uniform mat4 mat_proj;
-uniform mat4 mat_view;
-uniform mat4 lightSpaceMatrix;
-uniform mat4 mat_model;
+layout (std140) uniform Camera {
+	mat4 mat_view;
+	mat4 mat_proj;
+	vec3 cameraPos;
+};
+#ifdef MULTI_DRAW
+// Per-draw state of the multi-draw path, mirrors DrawDataBlock.
+layout (location = 8) in uint aDrawId;
+struct DrawData {
+	vec4 positionOffset;
+	vec4 positionScale;
+};
+layout (std430, binding = 0) readonly buffer Draws {
+	DrawData draws[];
+};
+#define POSITION_OFFSET draws[aDrawId].positionOffset.xyz
+#define POSITION_SCALE draws[aDrawId].positionScale.xyz
+#else
+// Identity for float vertices, the mesh bounds for packed ones.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#define POSITION_OFFSET positionOffset
+#define POSITION_SCALE positionScale
+#endif
 
 void main(){
-	vs_out.fragPos = vec3(mat_model * vec4(aPos, 1.0));
-	vs_out.normal = transpose(inverse(mat3(mat_model))) * aNormal;
+	vec3 position = POSITION_OFFSET + aPos * POSITION_SCALE;
+	vs_out.fragPos = vec3(aModel * vec4(position, 1.0));
+	vs_out.normal = transpose(inverse(mat3(aModel))) * aNormal;
 	vs_out.texCoords = aTexCoords;
-	vs_out.fragPosLightSpace = lightSpaceMatrix * vec4(vs_out.fragPos, 1.0);
+	vs_out.color = aColor;
 	gl_Position = mat_proj * mat_view * vec4(vs_out.fragPos, 1.0);
 
 
-   normal_in = mat3(transpose(inverse(mat_model))) * aNormal;
-   fragPos = vec3(mat_model * vec4(aPos, 1.0));
+   normal_in = mat3(transpose(inverse(aModel))) * aNormal;
+   fragPos = vec3(aModel * vec4(position, 1.0));
    //gl_Position = mat_proj * mat_view * vec4(fragPos, 1.0);
 
    texCoords = aTexCoords;
@@ -0,0 +1,248 @@
+// Offline asset cooker. Walks a directory and packs every model, image and
+// shader in it into one archive that the engine mounts through AssetArchive:
+// meshes as mesh cache images, images decoded with their full mip chain and
+// shaders as plain source, all behind a hash index.
+//
+// Links against the engine classes (glad only resolves symbols, no context
+// is ever created):
+//   g++ -std=c++17 -O2 -Iclasses tools/AssetCooker.cpp classes/*.cpp glad.c -lassimp -lglfw -lpthread -o asset_cooker
+//
+// Usage:
+//   asset_cooker <source dir> [archive] [--unflipped <path>]...
+// The archive defaults to COOKER_DEFAULT_ARCHIVE. Nothing is written into
+// the source tree: the mesh caches of the imports go to a meshcache
+// directory next to the archive, which the walk skips. Every entry records
+// the hash, size and time of its source, so the engine ignores entries
+// whose source was edited after cooking.
+// Images are cooked flipped for the usual 2D textures, paths given with
+// --unflipped keep their rows as stored and skip the mips (cubemap faces):
+//   asset_cooker . build/assets.pak --unflipped img/right.jpg --unflipped img/left.jpg ...
+
+#include "AssetArchive.h"
+#include "Model.h"
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#define COOKER_TEXTURE_ALIGNMENT 16
+#define COOKER_DEFAULT_ARCHIVE "build/assets.pak"
+
+static std::string lowerExtension(const std::filesystem::path& path) {
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return extension;
+}
+
+static bool isModel(const std::string& extension) {
+	return extension == ".obj" || extension == ".fbx" || extension == ".gltf" || extension == ".glb" || extension == ".dae" || extension == ".3ds";
+}
+
+static bool isImage(const std::string& extension) {
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+}
+
+static bool isShader(const std::string& extension) {
+	return extension == ".glsl" || extension == ".vert" || extension == ".frag" || extension == ".geom" || extension == ".comp";
+}
+
+static bool cookModel(const std::string& path, const std::string& extension, AssetArchiveItem& item) {
+	int loader = extension == ".obj" ? MODEL_LOADER_OBJ : MODEL_LOADER_ASSIMP;
+	ModelData data;
+	Model::prepare(path, loader, data);
+	// Referenced images are cooked on their own, the decoded copies are not needed.
+	for (unsigned int i = 0; i < data.textures.size(); i++) {
+		freeTextureData(data.textures[i]);
+	}
+	if (!data.loaded) {
+		return false;
+	}
+
+	unsigned int import_flags = loader == MODEL_LOADER_OBJ ? OBJ_LOADER_CACHE_FLAGS : MODEL_IMPORT_FLAGS;
+	unsigned int material_flags = (data.has_diffuse ? MESH_CACHE_HAS_DIFFUSE : 0) | (data.has_specular ? MESH_CACHE_HAS_SPECULAR : 0);
+	item.type = ASSET_ARCHIVE_MESH;
+	return MeshCache::serialize(item.source.hash, import_flags, data.meshes, material_flags, item.data);
+}
+
+static bool cookTexture(TextureData& image, unsigned int flags, AssetArchiveItem& item) {
+	if (!image.pixels) {
+		return false;
+	}
+
+	AssetArchiveTexture header;
+	std::memset(&header, 0, sizeof(AssetArchiveTexture));
+	header.width = (uint32_t)image.width;
+	header.height = (uint32_t)image.height;
+	header.num_components = (uint32_t)image.num_components;
+	header.flags = flags;
+	header.mip_count = (uint32_t)image.mip_offsets.size();
+
+	size_t level_size = (size_t)image.width * image.height * image.num_components;
+	size_t mips_offset = (sizeof(AssetArchiveTexture) + level_size + COOKER_TEXTURE_ALIGNMENT - 1) & ~(size_t)(COOKER_TEXTURE_ALIGNMENT - 1);
+	header.mips_offset = mips_offset;
+
+	item.type = ASSET_ARCHIVE_TEXTURE;
+	item.data.assign(mips_offset + image.mip_data.size(), 0);
+	std::memcpy(item.data.data(), &header, sizeof(AssetArchiveTexture));
+	std::memcpy(item.data.data() + sizeof(AssetArchiveTexture), image.pixels, level_size);
+	if (!image.mip_data.empty()) {
+		std::memcpy(item.data.data() + mips_offset, image.mip_data.data(), image.mip_data.size());
+	}
+	return true;
+}
+
+static bool readFile(const std::string& path, std::vector<unsigned char>& out) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "usage: asset_cooker <source dir> [archive] [--unflipped <path>]..." << std::endl;
+		return 1;
+	}
+	std::filesystem::path root = argv[1];
+	int first_option = 2;
+	std::string archive_path = COOKER_DEFAULT_ARCHIVE;
+	if (argc > 2 && std::strncmp(argv[2], "--", 2) != 0) {
+		archive_path = argv[2];
+		first_option = 3;
+	}
+	std::set<std::string> unflipped;
+	for (int i = first_option; i < argc; i++) {
+		if (std::strcmp(argv[i], "--unflipped") == 0 && i + 1 < argc) {
+			unflipped.insert(AssetArchive::normalizeName(argv[++i]));
+		} else {
+			std::cout << "ERROR::COOKER::UNKNOWN_ARGUMENT " << argv[i] << std::endl;
+			return 1;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::path output_dir = std::filesystem::absolute(archive_path, error).parent_path();
+	std::filesystem::create_directories(output_dir, error);
+	if (error) {
+		std::cout << "ERROR::COOKER::CANNOT_CREATE " << output_dir.string() << std::endl;
+		return 1;
+	}
+	MeshCache::setDirectory((output_dir / "meshcache").generic_string());
+	std::filesystem::path canonical_output = std::filesystem::weakly_canonical(output_dir, error);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<AssetArchiveItem> items;
+	std::vector<std::string> image_names;
+	std::vector<std::string> image_paths;
+	unsigned int failed = 0;
+
+	std::filesystem::recursive_directory_iterator iter(root, error);
+	if (error) {
+		std::cout << "ERROR::COOKER::CANNOT_OPEN " << root.string() << std::endl;
+		return 1;
+	}
+	for (; iter != std::filesystem::recursive_directory_iterator(); ++iter) {
+		std::string file_name = iter->path().filename().string();
+		if (iter->is_directory() && (file_name.empty() || file_name[0] == '.' || file_name[0] == '_' || std::filesystem::weakly_canonical(iter->path(), error) == canonical_output)) {
+			iter.disable_recursion_pending();
+			continue;
+		}
+		if (!iter->is_regular_file()) {
+			continue;
+		}
+
+		std::string path = iter->path().generic_string();
+		std::string name = AssetArchive::normalizeName(iter->path().lexically_relative(root).generic_string());
+		std::string extension = lowerExtension(iter->path());
+		if (isImage(extension)) {
+			image_names.push_back(name);
+			image_paths.push_back(path);
+			continue;
+		}
+
+		if (!isModel(extension) && !isShader(extension)) {
+			continue;
+		}
+		AssetArchiveItem item;
+		item.name = name;
+		AssetArchive::stampSource(path, item.source);
+		bool cooked = false;
+		if (isModel(extension)) {
+			cooked = cookModel(path, extension, item);
+		} else {
+			item.type = ASSET_ARCHIVE_SHADER;
+			cooked = readFile(path, item.data);
+		}
+
+		if (cooked) {
+			std::cout << "  " << name << " (" << item.data.size() / 1024 << " KB)" << std::endl;
+			items.push_back(std::move(item));
+		} else {
+			std::cout << "WARNING::COOKER::FAILED " << name << std::endl;
+			failed++;
+		}
+	}
+
+	// Images are decoded and mipped side by side, flipped and unflipped in
+	// two batches since the flag is per call.
+	for (int pass = 0; pass < 2; pass++) {
+		bool flip = pass == 0;
+		std::vector<std::string> paths;
+		std::vector<std::string> names;
+		for (unsigned int i = 0; i < image_paths.size(); i++) {
+			if ((unflipped.count(image_names[i]) == 0) == flip) {
+				paths.push_back(image_paths[i]);
+				names.push_back(image_names[i]);
+			}
+		}
+
+		std::vector<TextureData> images(paths.size());
+		std::vector<TextureData*> targets;
+		for (unsigned int i = 0; i < images.size(); i++) {
+			images[i].path = names[i];
+			targets.push_back(&images[i]);
+		}
+		if (!targets.empty()) {
+			TextureCache::get().decodeAll(paths, targets, flip, flip);
+		}
+
+		for (unsigned int i = 0; i < images.size(); i++) {
+			AssetArchiveItem item;
+			item.name = names[i];
+			AssetArchive::stampSource(paths[i], item.source);
+			if (cookTexture(images[i], flip ? TEXTURE_FLIP_Y : 0, item)) {
+				std::cout << "  " << names[i] << " " << images[i].width << "x" << images[i].height << ", " << images[i].mip_offsets.size() << " mips (" << item.data.size() / 1024 << " KB)" << std::endl;
+				items.push_back(std::move(item));
+			} else {
+				std::cout << "WARNING::COOKER::FAILED " << names[i] << std::endl;
+				failed++;
+			}
+			freeTextureData(images[i]);
+		}
+	}
+
+	size_t total = 0;
+	for (unsigned int i = 0; i < items.size(); i++) {
+		total += items[i].data.size();
+	}
+	if (!AssetArchive::write(archive_path, items)) {
+		return 1;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Cooked " << items.size() << " assets (" << total / 1024 << " KB) into " << archive_path << " in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms";
+	if (failed > 0) {
+		std::cout << ", " << failed << " failed";
+	}
+	std::cout << std::endl;
+	return failed > 0 ? 2 : 0;
+}
@@ -0,0 +1,278 @@
+// Mesh rendering benchmark. Uploads one model once per vertex format, draws
+// a grid of instances of it through the render queue into a hidden window
+// and reports GPU time and CPU submit time per frame and the memory the
+// vertex and index buffers take. On a 4.3 context every format also runs
+// through the multi-draw indirect path.
+//
+// Links against the engine classes and needs a GL 3.3 context at least:
+//   g++ -std=c++17 -O2 -Iclasses tools/MeshBenchmark.cpp classes/*.cpp glad.c -lassimp -lglfw -lpthread -o mesh_benchmark
+//
+// Usage, run from the repository root so the shaders are found:
+//   mesh_benchmark [model] [grid size] [frames] [unique]
+//   mesh_benchmark obj/Skull.obj 32 200
+// With unique set to 1 every grid cell gets its own copy of the meshes, so
+// nothing batches and submission cost dominates (headless with Mesa:
+// LIBGL_ALWAYS_SOFTWARE=1 xvfb-run mesh_benchmark obj/cube.obj 32 200 1).
+// llvmpipe's timer query misses most of the work of small draws, there the
+// CPU column, which waits for glFinish, is the one to compare.
+
+#include "Scene.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BENCHMARK_WIDTH 1280
+#define BENCHMARK_HEIGHT 720
+#define BENCHMARK_WARMUP_FRAMES 20
+
+// One way of submitting: the program and how the queue drives it.
+struct BenchmarkPath {
+	const char* name;
+	Shader* shader;
+	SceneUniforms uniforms;
+	bool multi_draw;
+};
+
+struct BenchmarkResult {
+	size_t vertex_bytes;
+	size_t total_bytes;
+	unsigned int short_index_meshes;
+	double gpu_ms;
+	double cpu_ms;
+	unsigned int triangles;
+};
+
+static const char* formatName(VertexFormat format) {
+	return format == VERTEX_FORMAT_PACKED ? "packed" : "float";
+}
+
+// Largest distance between a position and its 16 bit reconstruction, as a
+// fraction of the mesh diagonal.
+static float quantizationError(const MeshData& mesh) {
+	std::vector<PackedVertex> packed;
+	packVertices(mesh.vertex_data, mesh.num_vertices, mesh.bounds, packed);
+	glm::vec3 scale = mesh.bounds.max - mesh.bounds.min;
+	float diagonal = glm::length(scale);
+	float error = 0.0f;
+	for (unsigned int i = 0; i < mesh.num_vertices; i++) {
+		glm::vec3 q(packed[i].position[0], packed[i].position[1], packed[i].position[2]);
+		glm::vec3 p = mesh.bounds.min + q / 65535.0f * scale;
+		error = glm::max(error, glm::length(p - mesh.vertex_data[i].position));
+	}
+	return diagonal > 0.0f ? error / diagonal : 0.0f;
+}
+
+static AABB modelBounds(const ModelData& data) {
+	AABB bounds = data.meshes[0].bounds;
+	for (unsigned int i = 1; i < data.meshes.size(); i++) {
+		bounds.min = glm::min(bounds.min, data.meshes[i].bounds.min);
+		bounds.max = glm::max(bounds.max, data.meshes[i].bounds.max);
+	}
+	return bounds;
+}
+
+static SceneUniforms resolveUniforms(Shader* shader) {
+	shader->bindUniformBlock("Camera", CAMERA_UBO_BINDING);
+	SceneUniforms uniforms;
+	uniforms.has_diffuse = shader->getIntUniform("has_diffuse");
+	uniforms.has_specular = shader->getIntUniform("has_specular");
+	uniforms.position_offset = shader->getVec3Uniform("positionOffset");
+	uniforms.position_scale = shader->getVec3Uniform("positionScale");
+	return uniforms;
+}
+
+static BenchmarkResult run(ModelData& data, VertexFormat format, BenchmarkPath& path, unsigned int grid, unsigned int frames, bool unique, unsigned int query) {
+	BenchmarkResult result = BenchmarkResult();
+
+	// Memory is reported for one copy.
+	unsigned int copies = unique ? grid * grid : 1;
+	unsigned int mesh_count = (unsigned int)data.meshes.size();
+	std::vector<Mesh> meshes;
+	for (unsigned int c = 0; c < copies; c++) {
+		for (unsigned int i = 0; i < mesh_count; i++) {
+			const MeshData& m = data.meshes[i];
+			meshes.push_back(Mesh(m.vertex_data, m.num_vertices, m.index_data, m.num_indices, std::vector<Texture>(), m.bounds, m.sphere, m.lods, format));
+			if (c == 0) {
+				result.vertex_bytes += m.num_vertices * (format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex));
+				result.total_bytes += meshes.back().getGpuMemory();
+				result.short_index_meshes += meshes.back().getIndexType() == GL_UNSIGNED_SHORT ? 1 : 0;
+			}
+		}
+	}
+
+	// Instances one bounding box diagonal apart in the XY plane, the camera
+	// in main backs off until the whole grid is in view.
+	AABB bounds = modelBounds(data);
+	glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+	float spacing = glm::length(bounds.max - bounds.min);
+	float extent = spacing * grid;
+	std::vector<glm::mat4> transforms;
+	for (unsigned int y = 0; y < grid; y++) {
+		for (unsigned int x = 0; x < grid; x++) {
+			glm::vec3 offset((x + 0.5f) * spacing - extent * 0.5f, (y + 0.5f) * spacing - extent * 0.5f, 0.0f);
+			transforms.push_back(glm::translate(glm::mat4(1.0f), offset - center));
+		}
+	}
+
+	RenderQueue queue;
+	queue.setMultiDraw(path.multi_draw);
+	for (unsigned int frame = 0; frame < BENCHMARK_WARMUP_FRAMES + frames; frame++) {
+		bool measured = frame >= BENCHMARK_WARMUP_FRAMES;
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		queue.clear();
+		for (unsigned int i = 0; i < transforms.size(); i++) {
+			Mesh* copy = &meshes[(unique ? i : 0) * mesh_count];
+			for (unsigned int j = 0; j < mesh_count; j++) {
+				queue.push(PASS_OPAQUE, &copy[j], path.shader, &path.uniforms, transforms[i], glm::vec3(1.0f), false, false, 0.5f);
+			}
+		}
+		if (measured) {
+			glBeginQuery(GL_TIME_ELAPSED, query);
+		}
+		queue.submit();
+		if (measured) {
+			glEndQuery(GL_TIME_ELAPSED);
+		}
+		glFinish();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		if (measured) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			result.gpu_ms += elapsed / 1000000.0;
+			result.cpu_ms += std::chrono::duration<double, std::milli>(end - start).count();
+			result.triangles = queue.getStats().triangles;
+		}
+	}
+	result.gpu_ms /= frames;
+	result.cpu_ms /= frames;
+
+	for (unsigned int i = 0; i < meshes.size(); i++) {
+		meshes[i].release();
+	}
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::string path = argc > 1 ? argv[1] : "obj/Skull.obj";
+	unsigned int grid = argc > 2 ? (unsigned int)std::atoi(argv[2]) : 32;
+	unsigned int frames = argc > 3 ? (unsigned int)std::atoi(argv[3]) : 200;
+	bool unique = argc > 4 && std::atoi(argv[4]) != 0;
+	if (grid == 0 || frames == 0) {
+		std::cout << "usage: mesh_benchmark [model] [grid size] [frames] [unique]" << std::endl;
+		return 1;
+	}
+
+	glfwInit();
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	#ifdef __APPLE__
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	#endif
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	GLFWwindow* window = glfwCreateWindow(BENCHMARK_WIDTH, BENCHMARK_HEIGHT, "mesh_benchmark", NULL, NULL);
+	if (window == NULL) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(BENCHMARK_WIDTH, BENCHMARK_HEIGHT, "mesh_benchmark", NULL, NULL);
+	}
+	if (window == NULL) {
+		std::cout << "ERROR::BENCHMARK::NO_WINDOW" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(0);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+		std::cout << "ERROR::BENCHMARK::NO_GL" << std::endl;
+		return 1;
+	}
+	glViewport(0, 0, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+	glEnable(GL_DEPTH_TEST);
+
+	int loader = path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0 ? MODEL_LOADER_OBJ : MODEL_LOADER_ASSIMP;
+	ModelData data;
+	Model::prepare(path, loader, data);
+	for (unsigned int i = 0; i < data.textures.size(); i++) {
+		freeTextureData(data.textures[i]);
+	}
+	if (!data.loaded || data.meshes.empty()) {
+		std::cout << "ERROR::BENCHMARK::CANNOT_LOAD " << path << std::endl;
+		return 1;
+	}
+
+	// The flat fragment shader keeps fragment cost out of the numbers.
+	std::vector<BenchmarkPath> paths;
+	BenchmarkPath batches;
+	batches.name = "batches";
+	batches.shader = new Shader("shaders/vertex_standard.glsl", "shaders/fragment_flat.glsl");
+	batches.uniforms = resolveUniforms(batches.shader);
+	batches.multi_draw = false;
+	paths.push_back(batches);
+	if (RenderQueue::isMultiDrawSupported()) {
+		Shader::setHeader("#version 430 core\n#define MULTI_DRAW 1\n");
+		BenchmarkPath multi;
+		multi.name = "multi-draw";
+		multi.shader = new Shader("shaders/vertex_standard.glsl", "shaders/fragment_flat.glsl");
+		multi.uniforms = resolveUniforms(multi.shader);
+		multi.multi_draw = true;
+		paths.push_back(multi);
+		Shader::setHeader("");
+	}
+
+	AABB bounds = modelBounds(data);
+	float extent = glm::length(bounds.max - bounds.min) * grid;
+	float distance = extent * 0.5f / glm::tan(glm::radians(22.5f)) + extent * 0.5f;
+	UniformBuffer camera_ubo(CAMERA_UBO_BINDING, sizeof(CameraBlock));
+	CameraBlock camera;
+	camera.camera_pos = glm::vec3(0.0f, 0.0f, distance);
+	camera.mat_view = glm::lookAt(camera.camera_pos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	camera.mat_proj = glm::perspective(glm::radians(45.0f), (float)BENCHMARK_WIDTH / BENCHMARK_HEIGHT, distance * 0.01f, distance * 2.0f);
+	camera.pad = 0.0f;
+	camera_ubo.update(&camera, sizeof(CameraBlock));
+
+	unsigned int query;
+	glGenQueries(1, &query);
+
+	float max_error = 0.0f;
+	for (unsigned int i = 0; i < data.meshes.size(); i++) {
+		max_error = glm::max(max_error, quantizationError(data.meshes[i]));
+	}
+	std::cout << path << ": " << data.meshes.size() << " meshes, " << grid * grid << (unique ? " unique" : "") << " instances, " << frames << " frames" << std::endl;
+	std::cout << "Packed position error: " << max_error * 100.0f << "% of the diagonal at most" << std::endl;
+	if (paths.size() == 1) {
+		std::cout << "Multi-draw indirect needs GL 4.3, only timing the batch path" << std::endl;
+	}
+
+	VertexFormat formats[] = { VERTEX_FORMAT_FLOAT, VERTEX_FORMAT_PACKED };
+	// results[format][path]
+	BenchmarkResult results[2][2];
+	for (unsigned int i = 0; i < 2; i++) {
+		for (unsigned int p = 0; p < paths.size(); p++) {
+			BenchmarkResult& r = results[i][p];
+			r = run(data, formats[i], paths[p], grid, frames, unique, query);
+			std::cout << formatName(formats[i]) << ", " << paths[p].name << ": vertices " << r.vertex_bytes / 1024 << " KB, indices and depth positions " << (r.total_bytes - r.vertex_bytes) / 1024 << " KB ("
+				<< r.short_index_meshes << "/" << data.meshes.size() << " meshes 16 bit), "
+				<< r.triangles << " triangles, GPU " << r.gpu_ms << " ms, CPU " << r.cpu_ms << " ms per frame" << std::endl;
+		}
+	}
+	if (results[0][0].gpu_ms > 0.0) {
+		std::cout << "packed/float: vertex memory " << (double)results[1][0].vertex_bytes / results[0][0].vertex_bytes << ", GPU time " << results[1][0].gpu_ms / results[0][0].gpu_ms << std::endl;
+	}
+	if (paths.size() > 1 && results[0][0].cpu_ms > 0.0) {
+		std::cout << "multi-draw/batches: CPU time " << results[0][1].cpu_ms / results[0][0].cpu_ms << ", GPU time " << results[0][1].gpu_ms / results[0][0].gpu_ms << std::endl;
+	}
+
+	for (unsigned int p = 0; p < paths.size(); p++) {
+		delete paths[p].shader;
+	}
+	glDeleteQueries(1, &query);
+	glfwTerminate();
+	return 0;
+}